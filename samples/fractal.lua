@@ -1,3 +1,5 @@
+-- the fractal is computed by one Lua state per CPU core, this chunk runs in each of them
+generator = [[
 -- change this to select the view area
 depth = 32
 x0 = -0.65
@@ -5,7 +7,7 @@ y0 = -0.7
 x1 = -0.5
 y1 = -0.6
 
--- some nice palette
+-- some nice palette, colors are integers in ABGR layout
 palette = {}
 for i=0,depth do
 	b = math.floor(i / depth * 1024)
@@ -26,28 +28,29 @@ for i=0,depth do
 	if r < 0 then
 		r = 0
 	end
-	palette[i] = Color.new(r, g, b)
+	palette[i] = 0xFF000000 | b << 16 | g << 8 | r
 end
-palette[depth-1] = Color.new(0, 0, 0)
+palette[depth-1] = 0xFF000000
 
--- draw mandelbrot fractal
+-- the mandelbrot fractal
 w = 480
 h = 272
-image = Image.createEmpty(w, h)
 dx = x1 - x0
 dy = y1 - y0
-for y=0,h-1 do
-	for x=0,w-1 do
-		r = 0; n = 0; b = x / w * dx + x0; e = y / h * dy + y0; i = 0
-		while i < depth-1 and r * r < 4 do
-			d = r; r = r * r - n * n + b; n = 2 * d * n + e; i = i + 1
-		end
-		image:pixel(x, y, palette[i])
+return function(x, y)
+	local r = 0; local n = 0; local b = x / w * dx + x0; local e = y / h * dy + y0; local i = 0
+	while i < depth-1 and r * r < 4 do
+		local d = r; r = r * r - n * n + b; n = 2 * d * n + e; i = i + 1
 	end
-	screen:blit(0, 0, image)
-	screen.waitVblankStart()
-	screen.flip()
+	return palette[i]
 end
+]]
+
+image = Image.createEmpty(480, 272)
+image:parallelGenerate(generator)
+screen:blit(0, 0, image)
+screen.waitVblankStart()
+screen.flip()
 
 screen:save("screenshot.tga")
 
@@ -1,27 +1,12 @@
-function rotate(image)
-	local w = image:width()
-	local h = image:height()
-	local result = Image.createEmpty(h, w)
-	for x=0,w-1 do
-		for y=0,h-1 do
-			result:pixel(h-y-1, x, image:pixel(x, y))
-		end
-	end
-	return result
-end
-
 function printRotated(x, y, text, color, image, rotateIndex)
 	rotateIndex = math.mod(rotateIndex, 4)
-	local w = string.len(text)
-	local result = Image.createEmpty(w * 8, 8)
+	local w = string.len(text) * 8
+	local result = Image.createEmpty(w, 8)
 	result:print(0, 0, text, color)
-	if rotateIndex > 0 then
-		rotateIndex = rotateIndex - 1
-		for i=0,rotateIndex do
-			result = rotate(result)
-		end
-	end
-	image:blit(x, y, result)
+	-- the top left corner of the image is the pivot, moved to keep x, y the top left corner
+	local offsets = { { 0, 0 }, { 8, 0 }, { w, 8 }, { 0, w } }
+	local offset = offsets[rotateIndex + 1]
+	image:blitTransformed(result, x + offset[1], y + offset[2], rotateIndex * math.pi / 2, 1, 1, { 0, 0 })
 end
 
 cadetBlue = Color.new(95, 158, 160)
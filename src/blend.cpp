@@ -0,0 +1,329 @@
+#include "blend.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define BLEND_HAVE_AVX2
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BLEND_HAVE_NEON
+#endif
+
+#define IS_OPAQUE(color) (((color) & 0xff000000) == 0xff000000)
+#define IS_TRANSPARENT(color) (((color) & 0xff000000) == 0)
+
+// reference implementation, every other kernel must produce exactly the same pixels
+static void blendAlphaRowScalar(Color* destinationData, const Color* sourceData, int count)
+{
+	s32 rcolorc, gcolorc, bcolorc, acolorc, rcolord, gcolord, bcolord, acolord;
+	for (int x = 0; x < count; x++, destinationData++, sourceData++) {
+		Color color = *sourceData;
+		if (IS_OPAQUE(color)) {
+			*destinationData = color;
+		} else if (!IS_TRANSPARENT(color)) {
+			rcolorc = color & 0xff;
+			gcolorc = (color >> 8) & 0xff;
+			bcolorc = (color >> 16) & 0xff;
+			acolorc = (color >> 24) & 0xff;
+			rcolord = *destinationData & 0xff;
+			gcolord = (*destinationData >> 8) & 0xff;
+			bcolord = (*destinationData >> 16) & 0xff;
+			acolord = (*destinationData >> 24) & 0xff;
+
+			rcolorc = ((acolorc*rcolorc)>>8) + (((255-acolorc) * rcolord)>>8);
+			if (rcolorc > 255) rcolorc = 255;
+			gcolorc = ((acolorc*gcolorc)>>8) + (((255-acolorc) * gcolord)>>8);
+			if (gcolorc > 255) gcolorc = 255;
+			bcolorc = ((acolorc*bcolorc)>>8) + (((255-acolorc) * bcolord)>>8);
+			if (bcolorc > 255) bcolorc = 255;
+			if (acolord + acolorc < 255) {
+				acolorc = acolord+acolorc;
+			} else {
+				acolorc = 255;
+			}
+			*destinationData = rcolorc | (gcolorc << 8) | (bcolorc << 16) | (acolorc << 24);
+		}
+	}
+}
+
+static void sampleNearestRowScalar(Color* destinationData, const Color* sourceData, int sourceStride,
+	int maxU, int maxV, int u, int v, int du, int dv, int count)
+{
+	for (int x = 0; x < count; x++, u += du, v += dv) {
+		destinationData[x] = sourceData[(v >> 16) * sourceStride + (u >> 16)];
+	}
+}
+
+// (a * (256 - weight) + b * weight + 128) >> 8 per channel, weight is 0 - 256
+static inline Color lerpColors(Color a, Color b, int weight)
+{
+	Color result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		int ca = (a >> shift) & 0xff, cb = (b >> shift) & 0xff;
+		result |= (Color)((ca * (256 - weight) + cb * weight + 128) >> 8) << shift;
+	}
+	return result;
+}
+
+// the texel rows and columns of a bilinear sample; the clamped coordinate of the last
+// row or column has the weight 0 and the same texel on both sides
+static inline void bilinearTaps(int u, int v, int maxU, int maxV, int sourceStride,
+	int* offset, int* nextX, int* nextY, int* weightX, int* weightY)
+{
+	if (u < 0) u = 0;
+	if (u > maxU) u = maxU;
+	if (v < 0) v = 0;
+	if (v > maxV) v = maxV;
+	*offset = (v >> 16) * sourceStride + (u >> 16);
+	*nextX = u < maxU ? 1 : 0;
+	*nextY = v < maxV ? sourceStride : 0;
+	*weightX = (u >> 8) & 0xff;
+	*weightY = (v >> 8) & 0xff;
+}
+
+// reference implementation of bilinear sampling
+static void sampleBilinearRowScalar(Color* destinationData, const Color* sourceData, int sourceStride,
+	int maxU, int maxV, int u, int v, int du, int dv, int count)
+{
+	int offset, nextX, nextY, weightX, weightY;
+	for (int x = 0; x < count; x++, u += du, v += dv) {
+		bilinearTaps(u, v, maxU, maxV, sourceStride, &offset, &nextX, &nextY, &weightX, &weightY);
+		const Color* texel = sourceData + offset;
+		destinationData[x] = lerpColors(
+			lerpColors(texel[0], texel[nextX], weightX),
+			lerpColors(texel[nextY], texel[nextY + nextX], weightX), weightY);
+	}
+}
+
+#if defined(__SSE2__)
+// Blends 4 pixels. Every channel is widened to 16 bit, where a * c <= 65025
+// fits without overflow, so the shifts match the scalar code. packus clamps
+// to 255 like the scalar code and adds_epu8 is the saturated alpha sum.
+static inline __m128i blend4SSE2(__m128i source, __m128i destination)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ff = _mm_set1_epi16(255);
+	const __m128i alphaMask = _mm_set1_epi32(0xff000000);
+
+	__m128i sourceLo = _mm_unpacklo_epi8(source, zero);
+	__m128i sourceHi = _mm_unpackhi_epi8(source, zero);
+	__m128i destinationLo = _mm_unpacklo_epi8(destination, zero);
+	__m128i destinationHi = _mm_unpackhi_epi8(destination, zero);
+	__m128i alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sourceLo, 0xff), 0xff);
+	__m128i alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sourceHi, 0xff), 0xff);
+
+	__m128i lo = _mm_add_epi16(
+		_mm_srli_epi16(_mm_mullo_epi16(alphaLo, sourceLo), 8),
+		_mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(ff, alphaLo), destinationLo), 8));
+	__m128i hi = _mm_add_epi16(
+		_mm_srli_epi16(_mm_mullo_epi16(alphaHi, sourceHi), 8),
+		_mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(ff, alphaHi), destinationHi), 8));
+	__m128i color = _mm_packus_epi16(lo, hi);
+	__m128i alpha = _mm_adds_epu8(source, destination);
+	__m128i blended = _mm_or_si128(_mm_andnot_si128(alphaMask, color), _mm_and_si128(alphaMask, alpha));
+
+	__m128i opaque = _mm_cmpeq_epi32(_mm_and_si128(source, alphaMask), alphaMask);
+	__m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(source, alphaMask), _mm_setzero_si128());
+	blended = _mm_or_si128(_mm_and_si128(transparent, destination), _mm_andnot_si128(transparent, blended));
+	return _mm_or_si128(_mm_and_si128(opaque, source), _mm_andnot_si128(opaque, blended));
+}
+
+static void blendAlphaRowSSE2(Color* destinationData, const Color* sourceData, int count)
+{
+	const __m128i alphaMask = _mm_set1_epi32(0xff000000);
+	int x = 0;
+	for (; x + 4 <= count; x += 4) {
+		__m128i source = _mm_loadu_si128((const __m128i*) (sourceData + x));
+		__m128i alpha = _mm_and_si128(source, alphaMask);
+		__m128i opaque = _mm_cmpeq_epi32(alpha, alphaMask);
+		if (_mm_movemask_epi8(opaque) == 0xffff) {
+			_mm_storeu_si128((__m128i*) (destinationData + x), source);
+		} else if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_setzero_si128())) != 0xffff) {
+			__m128i destination = _mm_loadu_si128((const __m128i*) (destinationData + x));
+			_mm_storeu_si128((__m128i*) (destinationData + x), blend4SSE2(source, destination));
+		}
+	}
+	blendAlphaRowScalar(destinationData + x, sourceData + x, count - x);
+}
+#endif
+
+#if defined(__SSE2__)
+// Mixes 2 pixels from their left texels [a00, a01, b00, b01] and right
+// texels [a10, a11, b10, b11]. The products are at most 255 * 256 and the
+// sums with rounding at most 65408, so they fit unsigned 16 bit lanes.
+static inline __m128i bilinear2SSE2(__m128i left, __m128i right, int weightXA, int weightYA, int weightXB, int weightYB)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i full = _mm_set1_epi16(256);
+	__m128i weightX = _mm_set_epi16(weightXB, weightXB, weightXB, weightXB, weightXA, weightXA, weightXA, weightXA);
+	__m128i weightY = _mm_set_epi16(weightYB, weightYB, weightYB, weightYB, weightYA, weightYA, weightYA, weightYA);
+	__m128i weightXLo = _mm_unpacklo_epi64(weightX, weightX);
+	__m128i weightXHi = _mm_unpackhi_epi64(weightX, weightX);
+
+	// [top, bottom] of pixel a and of pixel b
+	__m128i a = _mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(_mm_unpacklo_epi8(left, zero), _mm_sub_epi16(full, weightXLo)),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(right, zero), weightXLo)), round);
+	__m128i b = _mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(_mm_unpackhi_epi8(left, zero), _mm_sub_epi16(full, weightXHi)),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(right, zero), weightXHi)), round);
+	a = _mm_srli_epi16(a, 8);
+	b = _mm_srli_epi16(b, 8);
+
+	__m128i top = _mm_unpacklo_epi64(a, b);
+	__m128i bottom = _mm_unpackhi_epi64(a, b);
+	__m128i mixed = _mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(top, _mm_sub_epi16(full, weightY)),
+		_mm_mullo_epi16(bottom, weightY)), round);
+	return _mm_srli_epi16(mixed, 8);
+}
+
+// the texel addresses are computed in scalar code, the mixing is done for 4 pixels at once
+static void sampleBilinearRowSSE2(Color* destinationData, const Color* sourceData, int sourceStride,
+	int maxU, int maxV, int u, int v, int du, int dv, int count)
+{
+	int x = 0;
+	for (; x + 4 <= count; x += 4) {
+		Color left[8], right[8];
+		int weightX[4], weightY[4];
+		for (int i = 0; i < 4; i++, u += du, v += dv) {
+			int offset, nextX, nextY;
+			bilinearTaps(u, v, maxU, maxV, sourceStride, &offset, &nextX, &nextY, &weightX[i], &weightY[i]);
+			const Color* texel = sourceData + offset;
+			left[i * 2] = texel[0];
+			left[i * 2 + 1] = texel[nextY];
+			right[i * 2] = texel[nextX];
+			right[i * 2 + 1] = texel[nextY + nextX];
+		}
+		__m128i first = bilinear2SSE2(_mm_loadu_si128((const __m128i*) left), _mm_loadu_si128((const __m128i*) right),
+			weightX[0], weightY[0], weightX[1], weightY[1]);
+		__m128i second = bilinear2SSE2(_mm_loadu_si128((const __m128i*) (left + 4)), _mm_loadu_si128((const __m128i*) (right + 4)),
+			weightX[2], weightY[2], weightX[3], weightY[3]);
+		_mm_storeu_si128((__m128i*) (destinationData + x), _mm_packus_epi16(first, second));
+	}
+	sampleBilinearRowScalar(destinationData + x, sourceData, sourceStride, maxU, maxV, u, v, du, dv, count - x);
+}
+#endif
+
+#ifdef BLEND_HAVE_AVX2
+// same as blend4SSE2, but for 8 pixels; unpack and pack work per 128 bit lane,
+// so the pixel order is preserved
+__attribute__((target("avx2")))
+static void blendAlphaRowAVX2(Color* destinationData, const Color* sourceData, int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ff = _mm256_set1_epi16(255);
+	const __m256i alphaMask = _mm256_set1_epi32(0xff000000);
+	int x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m256i source = _mm256_loadu_si256((const __m256i*) (sourceData + x));
+		__m256i sourceAlpha = _mm256_and_si256(source, alphaMask);
+		__m256i opaque = _mm256_cmpeq_epi32(sourceAlpha, alphaMask);
+		if (_mm256_movemask_epi8(opaque) == -1) {
+			_mm256_storeu_si256((__m256i*) (destinationData + x), source);
+			continue;
+		}
+		__m256i transparent = _mm256_cmpeq_epi32(sourceAlpha, zero);
+		if (_mm256_movemask_epi8(transparent) == -1) continue;
+		__m256i destination = _mm256_loadu_si256((const __m256i*) (destinationData + x));
+
+		__m256i sourceLo = _mm256_unpacklo_epi8(source, zero);
+		__m256i sourceHi = _mm256_unpackhi_epi8(source, zero);
+		__m256i destinationLo = _mm256_unpacklo_epi8(destination, zero);
+		__m256i destinationHi = _mm256_unpackhi_epi8(destination, zero);
+		__m256i alphaLo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sourceLo, 0xff), 0xff);
+		__m256i alphaHi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sourceHi, 0xff), 0xff);
+
+		__m256i lo = _mm256_add_epi16(
+			_mm256_srli_epi16(_mm256_mullo_epi16(alphaLo, sourceLo), 8),
+			_mm256_srli_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(ff, alphaLo), destinationLo), 8));
+		__m256i hi = _mm256_add_epi16(
+			_mm256_srli_epi16(_mm256_mullo_epi16(alphaHi, sourceHi), 8),
+			_mm256_srli_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(ff, alphaHi), destinationHi), 8));
+		__m256i color = _mm256_packus_epi16(lo, hi);
+		__m256i alpha = _mm256_adds_epu8(source, destination);
+		__m256i blended = _mm256_or_si256(_mm256_andnot_si256(alphaMask, color), _mm256_and_si256(alphaMask, alpha));
+		blended = _mm256_or_si256(_mm256_and_si256(transparent, destination), _mm256_andnot_si256(transparent, blended));
+		__m256i result = _mm256_or_si256(_mm256_and_si256(opaque, source), _mm256_andnot_si256(opaque, blended));
+		_mm256_storeu_si256((__m256i*) (destinationData + x), result);
+	}
+	blendAlphaRowScalar(destinationData + x, sourceData + x, count - x);
+}
+
+static int hasAVX2()
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#ifdef BLEND_HAVE_NEON
+// vld4 splits 8 pixels into r, g, b and a planes; vqmovn clamps to 255
+static void blendAlphaRowNEON(Color* destinationData, const Color* sourceData, int count)
+{
+	int x = 0;
+	for (; x + 8 <= count; x += 8) {
+		uint8x8x4_t source = vld4_u8((const uint8_t*) (sourceData + x));
+		uint8x8x4_t destination = vld4_u8((const uint8_t*) (destinationData + x));
+		uint8x8_t alpha = source.val[3];
+		uint8x8_t inverseAlpha = vmvn_u8(alpha);
+		uint8x8_t opaque = vceq_u8(alpha, vdup_n_u8(255));
+		uint8x8_t transparent = vceq_u8(alpha, vdup_n_u8(0));
+		uint8x8x4_t result;
+		for (int c = 0; c < 3; c++) {
+			uint16x8_t sum = vaddq_u16(
+				vshrq_n_u16(vmull_u8(alpha, source.val[c]), 8),
+				vshrq_n_u16(vmull_u8(inverseAlpha, destination.val[c]), 8));
+			uint8x8_t mixed = vbsl_u8(transparent, destination.val[c], vqmovn_u16(sum));
+			result.val[c] = vbsl_u8(opaque, source.val[c], mixed);
+		}
+		result.val[3] = vqadd_u8(destination.val[3], alpha);
+		vst4_u8((uint8_t*) (destinationData + x), result);
+	}
+	blendAlphaRowScalar(destinationData + x, sourceData + x, count - x);
+}
+#endif
+
+static int alwaysSupported()
+{
+	return 1;
+}
+
+typedef struct
+{
+	BlendKernels kernels;
+	int (*supported)();
+} BlendKernelEntry;
+
+// the dispatch table, best first
+static const BlendKernelEntry blendKernelTable[] = {
+#ifdef BLEND_HAVE_AVX2
+#if defined(__SSE2__)
+	{ { "avx2", blendAlphaRowAVX2, sampleNearestRowScalar, sampleBilinearRowSSE2 }, hasAVX2 },
+#else
+	{ { "avx2", blendAlphaRowAVX2, sampleNearestRowScalar, sampleBilinearRowScalar }, hasAVX2 },
+#endif
+#endif
+#if defined(__SSE2__)
+	{ { "sse2", blendAlphaRowSSE2, sampleNearestRowScalar, sampleBilinearRowSSE2 }, alwaysSupported },
+#endif
+#ifdef BLEND_HAVE_NEON
+	{ { "neon", blendAlphaRowNEON, sampleNearestRowScalar, sampleBilinearRowScalar }, alwaysSupported },
+#endif
+	{ { "scalar", blendAlphaRowScalar, sampleNearestRowScalar, sampleBilinearRowScalar }, alwaysSupported },
+};
+
+BlendKernels blendKernels = { "scalar", blendAlphaRowScalar, sampleNearestRowScalar, sampleBilinearRowScalar };
+
+void initBlendKernels()
+{
+	for (size_t i = 0; i < sizeof(blendKernelTable) / sizeof(blendKernelTable[0]); i++) {
+		if (blendKernelTable[i].supported()) {
+			blendKernels = blendKernelTable[i].kernels;
+			return;
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include "platform/platform.h"
+
+/**
+ * Blend one row of source pixels over destination pixels, with the same
+ * arithmetic as the original blitAlphaImageToImage loop: opaque source pixels
+ * are copied, transparent ones leave the destination unchanged and all
+ * others are mixed per channel with ((a * src) >> 8) + (((255 - a) * dst) >> 8)
+ * and the alpha values are added with saturation.
+ *
+ * @param destination - first destination pixel
+ * @param source - first source pixel
+ * @param count - number of pixels
+ */
+typedef void (*BlendAlphaRowFunction)(Color* destination, const Color* source, int count);
+
+/**
+ * Sample source pixels along a line of an affine transformation. Source
+ * coordinates are 16.16 fixed point, pixel x covers [x, x + 1).
+ *
+ * @param destination - the count sampled pixels
+ * @param source - first pixel of the source image
+ * @param sourceStride - pixels per source row
+ * @param maxU - (width - 1) << 16 of the source, bilinear filtering clamps to it
+ * @param maxV - (height - 1) << 16 of the source
+ * @param u - x coordinate of the first sample, for bilinear filtering 0.5 left of the pixel center
+ * @param v - y coordinate of the first sample
+ * @param du - added to u for every pixel
+ * @param dv - added to v for every pixel
+ * @param count - number of pixels
+ */
+typedef void (*SampleRowFunction)(Color* destination, const Color* source, int sourceStride,
+	int maxU, int maxV, int u, int v, int du, int dv, int count);
+
+typedef struct
+{
+	const char* name;  // "scalar", "sse2", "avx2" or "neon"
+	BlendAlphaRowFunction blendAlphaRow;
+	SampleRowFunction sampleNearestRow;  // u and v must be within the source
+	SampleRowFunction sampleBilinearRow;  // the 2x2 pixels at (u, v), mixed along x, then y
+} BlendKernels;
+
+/**
+ * The kernels selected by initBlendKernels. Until then the scalar reference
+ * implementation is used.
+ */
+extern BlendKernels blendKernels;
+
+/**
+ * Select the fastest kernels the CPU supports. Called from initGraphics.
+ */
+extern void initBlendKernels();
+
+#endif
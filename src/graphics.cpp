@@ -2,6 +2,7 @@
 #include <malloc.h>
 #include <string.h>
 #include <strings.h>
+#include <math.h>
 #include <png.h>
 
 #include "platform/platform.h"
@@ -13,6 +14,8 @@ extern "C" {
 
 #include "graphics.h"
 #include "framebuffer.h"
+#include "blend.h"
+#include "imagepool.h"
 
 #define IS_ALPHA(color) (((color)&0xff000000)==0xff000000?0:1)
 #define FRAMEBUFFER_SIZE (LINE_SIZE*SCREEN_HEIGHT*4)
@@ -136,6 +139,52 @@ static int getNextPower2(int width)
 	return b;
 }
 
+// the mipmaps are generated again when the image is bound the next time
+static inline void imageChanged(Image* image)
+{
+	image->mipmapLevels = 0;
+	image->changes++;
+	if (image->parent) {
+		image->parent->mipmapLevels = 0;
+		image->parent->changes++;
+	}
+}
+
+static int imageDataSize(const Image* image)
+{
+	return image->textureWidth * image->textureHeight * sizeof(Color);
+}
+
+// the bytes of the mipmap levels below the image
+static int mipmapDataSize(const Image* image)
+{
+	int size = 0;
+	int width = image->textureWidth;
+	int height = image->textureHeight;
+	for (int levels = 1; levels < MAX_MIPMAP_LEVELS && (width > 1 || height > 1); levels++) {
+		if (width > 1) width >>= 1;
+		if (height > 1) height >>= 1;
+		size += width * height;
+	}
+	return size * sizeof(Color);
+}
+
+// sets all fields but data
+static void initImage(Image* image, int width, int height)
+{
+	image->mipmaps = NULL;
+	image->mipmapLevels = 0;
+	image->parent = NULL;
+	image->references = 1;
+	image->skyline = NULL;
+	image->changes = 0;
+	image->alphaRuns = NULL;
+	image->imageWidth = width;
+	image->imageHeight = height;
+	image->textureWidth = getNextPower2(width);
+	image->textureHeight = getNextPower2(height);
+}
+
 #ifndef PLATFORM_LINUX
 Color* getVramDrawBuffer()
 {
@@ -150,8 +199,46 @@ Color* getVramDisplayBuffer()
 	if (dispBufferNumber == 1) vram += FRAMEBUFFER_SIZE / sizeof(Color);
 	return vram;
 }
+
+// the GE always displays the whole frame, so there is nothing to track
+void markDrawBufferDirty(int x, int y, int width, int height)
+{
+}
+
+void getDrawBufferDirtyTiles(u32* tiles)
+{
+	for (int ty = 0; ty < PLATFORM_TILES_Y; ty++) tiles[ty] = (1 << PLATFORM_TILES_X) - 1;
+}
 #endif
 
+int dirtyTilesToRects(const u32* tiles, DirtyRect* rects)
+{
+	int count = 0;
+	int ty = 0;
+	while (ty < PLATFORM_TILES_Y) {
+		// consecutive tile rows with the same tiles are merged
+		int rows = 1;
+		while (ty + rows < PLATFORM_TILES_Y && tiles[ty + rows] == tiles[ty]) rows++;
+		u32 row = tiles[ty];
+		while (row) {
+			int tx = __builtin_ctz(row);
+			int run = __builtin_ctz(~(row >> tx));
+			row &= ~(((1 << run) - 1) << tx);
+			DirtyRect* rect = &rects[count++];
+			rect->x = tx * PLATFORM_TILE_SIZE;
+			rect->y = ty * PLATFORM_TILE_SIZE;
+			rect->width = (tx + run) * PLATFORM_TILE_SIZE;
+			if (rect->width > SCREEN_WIDTH) rect->width = SCREEN_WIDTH;
+			rect->width -= rect->x;
+			rect->height = (ty + rows) * PLATFORM_TILE_SIZE;
+			if (rect->height > SCREEN_HEIGHT) rect->height = SCREEN_HEIGHT;
+			rect->height -= rect->y;
+		}
+		ty += rows;
+	}
+	return count;
+}
+
 void user_warning_fn(png_structp png_ptr, png_const_charp warning_msg)
 {
 }
@@ -194,17 +281,14 @@ Image* loadPngImageImpl(png_structp png_ptr)
 		return NULL;
 	}
 	Image* image = (Image*) malloc(sizeof(Image));
-	image->imageWidth = width;
-	image->imageHeight = height;
-	image->textureWidth = getNextPower2(width);
-	image->textureHeight = getNextPower2(height);
+	initImage(image, width, height);
 	png_set_strip_16(png_ptr);
 	png_set_packing(png_ptr);
 	if (color_type == PNG_COLOR_TYPE_PALETTE) png_set_palette_to_rgb(png_ptr);
 	if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) png_set_expand_gray_1_2_4_to_8(png_ptr);
 	if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) png_set_tRNS_to_alpha(png_ptr);
 	png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
-	image->data = (Color*) memalign(16, image->textureWidth * image->textureHeight * sizeof(Color));
+	image->data = (Color*) allocImageMemory(imageDataSize(image));
 	if (!image->data) {
 		free(image);
 		png_destroy_read_struct(&png_ptr, NULL, NULL);
@@ -212,7 +296,7 @@ Image* loadPngImageImpl(png_structp png_ptr)
 	}
 	line = (u32*) malloc(width * 4);
 	if (!line) {
-		free(image->data);
+		freeImageMemory(image->data, imageDataSize(image));
 		free(image);
 		png_destroy_read_struct(&png_ptr, NULL, NULL);
 		return NULL;
@@ -262,11 +346,8 @@ Image* loadJpegImageImpl(struct jpeg_decompress_struct dinfo)
 		jpeg_destroy_decompress(&dinfo);
 		return NULL;
 	}
-	image->imageWidth = width;
-	image->imageHeight = height;
-	image->textureWidth = getNextPower2(width);
-	image->textureHeight = getNextPower2(height);
-	image->data = (Color*) memalign(16, image->textureWidth * image->textureHeight * sizeof(Color));
+	initImage(image, width, height);
+	image->data = (Color*) allocImageMemory(imageDataSize(image));
 	u8* line = (u8*) malloc(width * 3);
 	if (!line) {
 		jpeg_destroy_decompress(&dinfo);
@@ -478,6 +559,7 @@ Image* loadImageFromMemory(const unsigned char* data, int len)
 
 void blitImageToImage(int sx, int sy, int width, int height, Image* source, int dx, int dy, Image* destination)
 {
+	imageChanged(destination);
 	Color* destinationData = &destination->data[destination->textureWidth * dy + dx];
 	int destinationSkipX = destination->textureWidth - width;
 	Color* sourceData = &source->data[source->textureWidth * sy + sx];
@@ -501,57 +583,137 @@ void blitImageToScreen(int sx, int sy, int width, int height, Image* source, int
 	sceGuSync(0,0);
 }
 
+// shorter runs of transparent or opaque pixels are blended like mixed pixels
+#define MIN_ALPHA_RUN 8
+
+static inline int alphaRunType(Color color)
+{
+	u32 alpha = color >> 24;
+	if (alpha == 0) return ALPHA_RUN_TRANSPARENT;
+	return alpha == 255 ? ALPHA_RUN_OPAQUE : ALPHA_RUN_MIXED;
+}
+
+// appends a run to the row, which starts at the run rowStart
+static int addAlphaRun(AlphaRuns* runs, int rowStart, int x, int count, int type)
+{
+	if (count < MIN_ALPHA_RUN) type = ALPHA_RUN_MIXED;
+	if (runs->count > rowStart && runs->runs[runs->count - 1].type == type) {
+		runs->runs[runs->count - 1].count += count;
+		return 1;
+	}
+	if (runs->count == runs->capacity) {
+		int capacity = runs->capacity ? 2 * runs->capacity : 256;
+		AlphaRun* grown = (AlphaRun*) realloc(runs->runs, capacity * sizeof(AlphaRun));
+		if (!grown) return 0;
+		runs->runs = grown;
+		runs->capacity = capacity;
+	}
+	AlphaRun* run = &runs->runs[runs->count++];
+	run->x = x;
+	run->count = count;
+	run->type = type;
+	return 1;
+}
+
+// the alpha runs of the image, built again if the image changed; NULL if there is not enough memory
+static const AlphaRuns* getAlphaRuns(Image* image)
+{
+	// the screen image isn't allocated by createImage, its pixels change without imageChanged
+	if (image->references == 0) return NULL;
+	const Image* owner = image->parent ? image->parent : image;
+	AlphaRuns* runs = image->alphaRuns;
+	if (runs && runs->valid && runs->changes == owner->changes) return runs;
+	if (!runs) {
+		runs = (AlphaRuns*) calloc(1, sizeof(AlphaRuns));
+		if (!runs) return NULL;
+		runs->rows = (int*) malloc((image->imageHeight + 1) * sizeof(int));
+		if (!runs->rows) {
+			free(runs);
+			return NULL;
+		}
+		image->alphaRuns = runs;
+	}
+
+	runs->valid = 0;
+	runs->count = 0;
+	for (int y = 0; y < image->imageHeight; y++) {
+		const Color* row = image->data + y * image->textureWidth;
+		int rowStart = runs->count;
+		runs->rows[y] = rowStart;
+		int start = 0;
+		int type = alphaRunType(row[0]);
+		for (int x = 1; x <= image->imageWidth; x++) {
+			int next = x < image->imageWidth ? alphaRunType(row[x]) : -1;
+			if (next == type) continue;
+			if (!addAlphaRun(runs, rowStart, start, x - start, type)) return NULL;
+			start = x;
+			type = next;
+		}
+	}
+	runs->rows[image->imageHeight] = runs->count;
+	runs->data = image->data;
+	runs->stride = image->textureWidth;
+	runs->width = image->imageWidth;
+	runs->height = image->imageHeight;
+	runs->changes = owner->changes;
+	runs->valid = 1;
+	return runs;
+}
+
+// transparent runs are skipped, opaque runs copied and only mixed runs blended
 void blitAlphaImageToImage(int sx, int sy, int width, int height, Image* source, int dx, int dy, Image* destination)
 {
+	imageChanged(destination);
 	Color* destinationData = &destination->data[destination->textureWidth * dy + dx];
-	int destinationSkipX = destination->textureWidth - width;
 	Color* sourceData = &source->data[source->textureWidth * sy + sx];
-	int sourceSkipX = source->textureWidth - width;
-	int x, y;
-	s32 rcolorc, gcolorc, bcolorc, acolorc,rcolord, gcolord, bcolord, acolord;
-	for (y = 0; y < height; y++, destinationData += destinationSkipX, sourceData += sourceSkipX) {
-		for (x = 0; x < width; x++, destinationData++, sourceData++) {
-			Color color = *sourceData;
-			if (!IS_ALPHA(color)) {
-				*destinationData = color;
+	BlendAlphaRowFunction blendAlphaRow = blendKernels.blendAlphaRow;
+	const AlphaRuns* runs = getAlphaRuns(source);
+	if (!runs) {
+		for (int y = 0; y < height; y++) {
+			blendAlphaRow(destinationData, sourceData, width);
+			destinationData += destination->textureWidth;
+			sourceData += source->textureWidth;
+		}
+		return;
+	}
+
+	// indexed by the x of the source
+	destinationData -= sx;
+	sourceData -= sx;
+	for (int y = 0; y < height; y++) {
+		for (int i = runs->rows[sy + y]; i < runs->rows[sy + y + 1]; i++) {
+			const AlphaRun* run = &runs->runs[i];
+			if (run->x >= sx + width) break;
+			int start = run->x > sx ? run->x : sx;
+			int end = run->x + run->count < sx + width ? run->x + run->count : sx + width;
+			if (start >= end || run->type == ALPHA_RUN_TRANSPARENT) continue;
+			if (run->type == ALPHA_RUN_OPAQUE) {
+				memcpy(destinationData + start, sourceData + start, (end - start) * sizeof(Color));
 			} else {
-				rcolorc = color & 0xff;
-				gcolorc = (color >> 8) & 0xff;
-				bcolorc = (color >> 16) & 0xff;
-				acolorc = (color >> 24) & 0xff;
-				rcolord = *destinationData & 0xff;
-				gcolord = (*destinationData >> 8) & 0xff;
-				bcolord = (*destinationData >> 16) & 0xff;
-				acolord = (*destinationData >> 24) & 0xff;
-				
-				rcolorc = ((acolorc*rcolorc)>>8) + (((255-acolorc) * rcolord)>>8);
-				if (rcolorc > 255) rcolorc = 255;
-				gcolorc = ((acolorc*gcolorc)>>8) + (((255-acolorc) * gcolord)>>8);
-				if (gcolorc > 255) gcolorc = 255;
-				bcolorc = ((acolorc*bcolorc)>>8) + (((255-acolorc) * bcolord)>>8);
-				if (bcolorc > 255) bcolorc = 255;
-				if (acolord + acolorc < 255) {
-					acolorc = acolord+acolorc;
-				} else {
-					acolorc = 255;
-				}
-				*destinationData = rcolorc | (gcolorc << 8) | (bcolorc << 16) | (acolorc << 24);
+				blendAlphaRow(destinationData + start, sourceData + start, end - start);
 			}
 		}
+		destinationData += destination->textureWidth;
+		sourceData += source->textureWidth;
 	}
 }
 
-void blitAlphaImageToScreen(int sx, int sy, int width, int height, Image* source, int dx, int dy)
+// sets the texture for drawSprites, within guStart and sceGuFinish
+static void setSpriteTexture(Image* source)
 {
-	if (!initialized) return;
-
-	sceKernelDcacheWritebackInvalidateAll();
-	guStart();
+	sceGuTexMode(GU_PSM_8888, 0, 0, 0);
 	sceGuTexImage(0, source->textureWidth, source->textureHeight, source->textureWidth, (void*) source->data);
+#ifdef PLATFORM_LINUX
+	setTextureAlphaRuns(getAlphaRuns(source));
+#endif
 	float u = 1.0f / ((float)source->textureWidth);
 	float v = 1.0f / ((float)source->textureHeight);
 	sceGuTexScale(u, v);
-	
+}
+
+// draws a rectangle of the sprite texture in slices of 64 pixels
+static void drawSprites(int sx, int sy, int width, int height, int dx, int dy)
+{
 	int j = 0;
 	while (j < width) {
 		Vertex* vertices = (Vertex*) sceGuGetMemory(2 * sizeof(Vertex));
@@ -570,36 +732,503 @@ void blitAlphaImageToScreen(int sx, int sy, int width, int height, Image* source
 		sceGuDrawArray(GU_SPRITES, GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D, 2, 0, vertices);
 		j += sliceWidth;
 	}
-	
+}
+
+void blitAlphaImageToScreen(int sx, int sy, int width, int height, Image* source, int dx, int dy)
+{
+	if (!initialized) return;
+
+	sceKernelDcacheWritebackInvalidateAll();
+	guStart();
+	setSpriteTexture(source);
+	drawSprites(sx, sy, width, height, dx, dy);
+	sceGuFinish();
+	sceGuSync(0, 0);
+}
+
+// clips a span to the source and destination, returns 0 if nothing is left
+static int clipSpan(BlitSpan* span, const Image* source, int destinationWidth, int destinationHeight)
+{
+	if (span->sx < 0) {
+		span->dx -= span->sx;
+		span->width += span->sx;
+		span->sx = 0;
+	}
+	if (span->sy < 0) {
+		span->dy -= span->sy;
+		span->height += span->sy;
+		span->sy = 0;
+	}
+	if (span->sx + span->width > source->imageWidth) span->width = source->imageWidth - span->sx;
+	if (span->sy + span->height > source->imageHeight) span->height = source->imageHeight - span->sy;
+	if (span->dx < 0) {
+		span->sx -= span->dx;
+		span->width += span->dx;
+		span->dx = 0;
+	}
+	if (span->dy < 0) {
+		span->sy -= span->dy;
+		span->height += span->dy;
+		span->dy = 0;
+	}
+	if (span->dx + span->width > destinationWidth) span->width = destinationWidth - span->dx;
+	if (span->dy + span->height > destinationHeight) span->height = destinationHeight - span->dy;
+	return span->width > 0 && span->height > 0;
+}
+
+void blitBatchToImage(const BlitSpan* spans, int count, Image* source, Image* destination, int alpha)
+{
+	for (int i = 0; i < count; i++) {
+		BlitSpan span = spans[i];
+		if (!clipSpan(&span, source, destination->imageWidth, destination->imageHeight)) continue;
+		if (alpha) {
+			blitAlphaImageToImage(span.sx, span.sy, span.width, span.height, source, span.dx, span.dy, destination);
+		} else {
+			blitImageToImage(span.sx, span.sy, span.width, span.height, source, span.dx, span.dy, destination);
+		}
+	}
+}
+
+void blitBatchToScreen(const BlitSpan* spans, int count, Image* source, int alpha)
+{
+	if (!initialized) return;
+
+	sceKernelDcacheWritebackInvalidateAll();
+	guStart();
+	if (alpha) setSpriteTexture(source);
+	Color* vram = getVramDrawBuffer();
+	for (int i = 0; i < count; i++) {
+		BlitSpan span = spans[i];
+		if (!clipSpan(&span, source, SCREEN_WIDTH, SCREEN_HEIGHT)) continue;
+		if (alpha) {
+			drawSprites(span.sx, span.sy, span.width, span.height, span.dx, span.dy);
+		} else {
+			sceGuCopyImage(GU_PSM_8888, span.sx, span.sy, span.width, span.height, source->textureWidth, source->data, span.dx, span.dy, LINE_SIZE, vram);
+		}
+	}
 	sceGuFinish();
 	sceGuSync(0, 0);
 }
 
+static long long floorDivide(long long a, long long b)
+{
+	long long q = a / b;
+	if (a % b != 0 && (a < 0) != (b < 0)) q--;
+	return q;
+}
+
+// narrows [*first, *last] to the steps i with 0 <= start + i * step < limit
+static void clipSteps(int start, int step, int limit, int* first, int* last)
+{
+	long long low, high;
+	if (step == 0) {
+		if (start < 0 || start >= limit) *last = *first - 1;
+		return;
+	}
+	if (step > 0) {
+		low = -floorDivide(start, step);
+		high = floorDivide(limit - 1 - start, step);
+	} else {
+		low = -floorDivide(start - limit + 1, step);
+		high = floorDivide(-start, step);
+	}
+	if (low > *first) *first = low > *last ? *last + 1 : (int) low;
+	if (high < *last) *last = high < *first ? *first - 1 : (int) high;
+}
+
+#define TRANSFORM_CHUNK 256
+
+// rows of a transformed image per job of the job system
+#define TRANSFORM_GRAIN 16
+
+typedef struct {
+	const Image* source;
+	const ImageTransform* t;
+	Color* target;
+	int lineSize;
+	int x0, x1;
+	float dudx, dudy, dvdx, dvdy;
+	int du, dv;
+	int limitU, limitV;
+	int maxU, maxV;
+} TransformRows;
+
+// the fixed point source position of the first pixel of row y, and the
+// steps [first, last] of the row which hit the source
+static int transformRow(const TransformRows* rows, int y, int* u, int* v, int* first, int* last)
+{
+	const ImageTransform* t = rows->t;
+	float rx = rows->x0 + 0.5f - t->x;
+	float ry = y + 0.5f - t->y;
+	*u = (int) floorf((t->pivotX + rows->dudx * rx + rows->dudy * ry) * 65536.0f);
+	*v = (int) floorf((t->pivotY + rows->dvdx * rx + rows->dvdy * ry) * 65536.0f);
+	*first = 0;
+	*last = rows->x1 - rows->x0 - 1;
+	clipSteps(*u, rows->du, rows->limitU, first, last);
+	clipSteps(*v, rows->dv, rows->limitV, first, last);
+	return *first <= *last;
+}
+
+static void drawTransformedRows(void* data, int y0, int y1)
+{
+	const TransformRows* rows = (const TransformRows*) data;
+	const Image* source = rows->source;
+	SampleRowFunction sampleRow = rows->t->linear ? blendKernels.sampleBilinearRow : blendKernels.sampleNearestRow;
+	BlendAlphaRowFunction blendAlphaRow = blendKernels.blendAlphaRow;
+	int du = rows->du, dv = rows->dv;
+	Color buffer[TRANSFORM_CHUNK];
+
+	for (int y = y0; y < y1; y++) {
+		int u, v, first, last;
+		if (!transformRow(rows, y, &u, &v, &first, &last)) continue;
+		u += first * du;
+		v += first * dv;
+		if (rows->t->linear) {
+			u -= 0x8000;
+			v -= 0x8000;
+		}
+		Color* target = rows->target + y * rows->lineSize + rows->x0 + first;
+		for (int count = last - first + 1; count > 0; ) {
+			int n = count < TRANSFORM_CHUNK ? count : TRANSFORM_CHUNK;
+			sampleRow(buffer, source->data, source->textureWidth, rows->maxU, rows->maxV, u, v, du, dv, n);
+			blendAlphaRow(target, buffer, n);
+			target += n;
+			u += n * du;
+			v += n * dv;
+			count -= n;
+		}
+	}
+}
+
+// Inverse maps every destination pixel center to the source, in 16.16 fixed
+// point. The pixels of a row, which hit the source, are found exactly for
+// the fixed point steps, so the samplers never read outside of the source.
+// Returns 0, if nothing was drawn, otherwise the drawn rectangle in box.
+static int transformImage(const Image* source, const ImageTransform* t, Color* target, int targetWidth, int targetHeight, int lineSize, DirtyRect* box)
+{
+	// smaller images would overflow the fixed point steps
+	if (fabsf(t->scaleX) < 1.0f / 4096 || fabsf(t->scaleY) < 1.0f / 4096) return 0;
+	float c = cosf(t->angle);
+	float s = sinf(t->angle);
+
+	// the bounding box of the source corners in the destination
+	float minX = 1e9f, minY = 1e9f, maxX = -1e9f, maxY = -1e9f;
+	for (int corner = 0; corner < 4; corner++) {
+		float px = ((corner & 1) ? source->imageWidth : 0) - t->pivotX;
+		float py = ((corner & 2) ? source->imageHeight : 0) - t->pivotY;
+		px *= t->scaleX;
+		py *= t->scaleY;
+		float x = t->x + c * px - s * py;
+		float y = t->y + s * px + c * py;
+		if (x < minX) minX = x;
+		if (x > maxX) maxX = x;
+		if (y < minY) minY = y;
+		if (y > maxY) maxY = y;
+	}
+	int x0 = minX > 0 ? (int) floorf(minX) : 0;
+	int y0 = minY > 0 ? (int) floorf(minY) : 0;
+	int x1 = maxX < targetWidth ? (int) ceilf(maxX) : targetWidth;
+	int y1 = maxY < targetHeight ? (int) ceilf(maxY) : targetHeight;
+	if (x0 >= x1 || y0 >= y1) return 0;
+
+	TransformRows rows;
+	rows.source = source;
+	rows.t = t;
+	rows.target = target;
+	rows.lineSize = lineSize;
+	rows.x0 = x0;
+	rows.x1 = x1;
+	rows.dudx = c / t->scaleX;
+	rows.dudy = s / t->scaleX;
+	rows.dvdx = -s / t->scaleY;
+	rows.dvdy = c / t->scaleY;
+	rows.du = (int) lrintf(rows.dudx * 65536.0f);
+	rows.dv = (int) lrintf(rows.dvdx * 65536.0f);
+	rows.limitU = source->imageWidth << 16;
+	rows.limitV = source->imageHeight << 16;
+	rows.maxU = (source->imageWidth - 1) << 16;
+	rows.maxV = (source->imageHeight - 1) << 16;
+
+	// the drawn rectangle, and the rows to draw, are found before drawing
+	int boxX0 = x1, boxY0 = y1, boxX1 = x0, boxY1 = y0;
+	for (int y = y0; y < y1; y++) {
+		int u, v, first, last;
+		if (!transformRow(&rows, y, &u, &v, &first, &last)) continue;
+		if (x0 + first < boxX0) boxX0 = x0 + first;
+		if (x0 + last + 1 > boxX1) boxX1 = x0 + last + 1;
+		if (y < boxY0) boxY0 = y;
+		boxY1 = y + 1;
+	}
+	if (boxX0 >= boxX1) return 0;
+
+#ifdef PLATFORM_LINUX
+	parallelFor(boxY0, boxY1, TRANSFORM_GRAIN, drawTransformedRows, &rows);
+#else
+	drawTransformedRows(&rows, boxY0, boxY1);
+#endif
+	box->x = boxX0;
+	box->y = boxY0;
+	box->width = boxX1 - boxX0;
+	box->height = boxY1 - boxY0;
+	return 1;
+}
+
+void blitTransformedImageToImage(Image* source, const ImageTransform* transform, Image* destination)
+{
+	DirtyRect box;
+	if (transformImage(source, transform, destination->data, destination->imageWidth, destination->imageHeight, destination->textureWidth, &box)) {
+		imageChanged(destination);
+	}
+}
+
+void blitTransformedImageToScreen(Image* source, const ImageTransform* transform)
+{
+	if (!initialized) return;
+	DirtyRect box;
+	if (transformImage(source, transform, getVramDrawBuffer(), SCREEN_WIDTH, SCREEN_HEIGHT, LINE_SIZE, &box)) {
+		markDrawBufferDirty(box.x, box.y, box.width, box.height);
+	}
+}
+
 Image* createImage(int width, int height)
 {
 	Image* image = (Image*) malloc(sizeof(Image));
 	if (!image) return NULL;
-	image->imageWidth = width;
-	image->imageHeight = height;
-	image->textureWidth = getNextPower2(width);
-	image->textureHeight = getNextPower2(height);
-	image->data = (Color*) memalign(16, image->textureWidth * image->textureHeight * sizeof(Color));
-	if (!image->data) return NULL;
+	initImage(image, width, height);
+	image->data = (Color*) allocImageMemory(imageDataSize(image));
+	if (!image->data) {
+		free(image);
+		return NULL;
+	}
 	memset(image->data, 0, image->textureWidth * image->textureHeight * sizeof(Color));
 	return image;
 }
 
+typedef struct
+{
+	int x, y, width;
+} SkylineNode;
+
+// the top edges of the packed images, left to right, covering the atlas width
+struct Skyline
+{
+	int count;
+	int capacity;
+	SkylineNode* nodes;
+};
+
 void freeImage(Image* image)
 {
-	free(image->data);
+	if (--image->references > 0) return;
+	if (image->parent) {
+		freeImage(image->parent);
+	} else {
+		freeImageMemory(image->data, imageDataSize(image));
+	}
+	if (image->skyline) {
+		free(image->skyline->nodes);
+		free(image->skyline);
+	}
+	if (image->alphaRuns) {
+		free(image->alphaRuns->rows);
+		free(image->alphaRuns->runs);
+		free(image->alphaRuns);
+	}
+	freeImageMemory(image->mipmaps, mipmapDataSize(image));
 	free(image);
 }
 
+int getImageMemorySize(const Image* image)
+{
+	return image->parent ? 0 : imageDataSize(image);
+}
+
+Image* createAtlas(int width, int height)
+{
+	Image* atlas = createImage(width, height);
+	if (!atlas) return NULL;
+	Skyline* skyline = (Skyline*) malloc(sizeof(Skyline));
+	SkylineNode* nodes = (SkylineNode*) malloc(16 * sizeof(SkylineNode));
+	if (!skyline || !nodes) {
+		free(skyline);
+		free(nodes);
+		freeImage(atlas);
+		return NULL;
+	}
+	skyline->count = 1;
+	skyline->capacity = 16;
+	skyline->nodes = nodes;
+	nodes[0].x = 0;
+	nodes[0].y = 0;
+	nodes[0].width = width;
+	atlas->skyline = skyline;
+	return atlas;
+}
+
+// the top of a width wide image, whose left edge is at node index, or -1, if it doesn't fit
+static int skylineFit(const Skyline* skyline, int index, int width, int height, int atlasHeight)
+{
+	const SkylineNode* nodes = skyline->nodes;
+	int y = 0;
+	for (int i = index; width > 0; i++) {
+		if (i == skyline->count) return -1;
+		if (nodes[i].y > y) y = nodes[i].y;
+		width -= nodes[i].width;
+	}
+	return y + height <= atlasHeight ? y : -1;
+}
+
+// places a rectangle at the lowest position, returns 0, if there is no space
+static int skylinePack(Skyline* skyline, int width, int height, int atlasHeight, int* x, int* y)
+{
+	int best = -1, bestY = 0;
+	for (int i = 0; i < skyline->count; i++) {
+		int top = skylineFit(skyline, i, width, height, atlasHeight);
+		if (top >= 0 && (best < 0 || top < bestY)) {
+			best = i;
+			bestY = top;
+		}
+	}
+	if (best < 0) return 0;
+
+	if (skyline->count == skyline->capacity) {
+		SkylineNode* nodes = (SkylineNode*) realloc(skyline->nodes, 2 * skyline->capacity * sizeof(SkylineNode));
+		if (!nodes) return 0;
+		skyline->nodes = nodes;
+		skyline->capacity *= 2;
+	}
+	SkylineNode* nodes = skyline->nodes;
+	*x = nodes[best].x;
+	*y = bestY;
+
+	// the new node replaces the covered parts of the nodes under it
+	memmove(&nodes[best + 1], &nodes[best], (skyline->count - best) * sizeof(SkylineNode));
+	skyline->count++;
+	nodes[best].y = bestY + height;
+	nodes[best].width = width;
+	int right = *x + width;
+	int i = best + 1;
+	while (i < skyline->count && nodes[i].x < right) {
+		int end = nodes[i].x + nodes[i].width;
+		if (end <= right) {
+			memmove(&nodes[i], &nodes[i + 1], (skyline->count - i - 1) * sizeof(SkylineNode));
+			skyline->count--;
+		} else {
+			nodes[i].width = end - right;
+			nodes[i].x = right;
+			break;
+		}
+	}
+
+	// neighbours at the same height are merged
+	for (i = 0; i + 1 < skyline->count; ) {
+		if (nodes[i].y == nodes[i + 1].y) {
+			nodes[i].width += nodes[i + 1].width;
+			memmove(&nodes[i + 1], &nodes[i + 2], (skyline->count - i - 2) * sizeof(SkylineNode));
+			skyline->count--;
+		} else {
+			i++;
+		}
+	}
+	return 1;
+}
+
+Image* addToAtlas(Image* atlas, Image* image)
+{
+	// 4 pixels are 16 bytes
+	int width = (image->imageWidth + 3) & ~3;
+	int height = image->imageHeight;
+	int x, y;
+	if (width > atlas->imageWidth) return NULL;
+	if (!skylinePack(atlas->skyline, width, height, atlas->imageHeight, &x, &y)) return NULL;
+
+	Image* view = (Image*) malloc(sizeof(Image));
+	if (!view) return NULL;
+	initImage(view, image->imageWidth, image->imageHeight);
+	view->textureWidth = atlas->textureWidth;
+	view->data = atlas->data + y * atlas->textureWidth + x;
+	view->parent = atlas;
+	atlas->references++;
+	blitImageToImage(0, 0, image->imageWidth, image->imageHeight, image, 0, 0, view);
+	return view;
+}
+
+// every texel of a level is the average of 2x2 texels of the level above
+static void generateMipmaps(Image* image)
+{
+	// the texture of a view would cover other images of the atlas
+	if (image->parent) {
+		image->mipmapLevels = 1;
+		return;
+	}
+	int levels = 1;
+	for (int width = image->textureWidth, height = image->textureHeight; levels < MAX_MIPMAP_LEVELS && (width > 1 || height > 1); levels++) {
+		if (width > 1) width >>= 1;
+		if (height > 1) height >>= 1;
+	}
+	if (!image->mipmaps) {
+		image->mipmaps = (Color*) allocImageMemory(mipmapDataSize(image));
+		if (!image->mipmaps) {
+			image->mipmapLevels = 1;
+			return;
+		}
+	}
+
+	const Color* source = image->data;
+	Color* destination = image->mipmaps;
+	int width = image->textureWidth;
+	int height = image->textureHeight;
+	for (int level = 1; level < levels; level++) {
+		// offsets of the right and lower texels, 0 if the level above has only one
+		int stepX = width > 1 ? 1 : 0;
+		int stepY = height > 1 ? width : 0;
+		if (width > 1) width >>= 1;
+		if (height > 1) height >>= 1;
+		for (int y = 0; y < height; y++) {
+			const Color* row = source + 2 * y * stepY;
+			for (int x = 0; x < width; x++) {
+				const Color* texel = row + 2 * x * stepX;
+				Color result = 0;
+				for (int shift = 0; shift < 32; shift += 8) {
+					int sum = ((texel[0] >> shift) & 0xff) + ((texel[stepX] >> shift) & 0xff)
+						+ ((texel[stepY] >> shift) & 0xff) + ((texel[stepX + stepY] >> shift) & 0xff);
+					result |= (Color) ((sum + 2) >> 2) << shift;
+				}
+				*destination++ = result;
+			}
+		}
+		source = destination - width * height;
+	}
+	image->mipmapLevels = levels;
+	sceKernelDcacheWritebackInvalidateAll();
+}
+
+void setTextureImage(Image* image)
+{
+	if (image->mipmapLevels == 0) generateMipmaps(image);
+	sceGuTexMode(GU_PSM_8888, image->mipmapLevels - 1, 0, 0);
+	sceGuTexImage(0, image->textureWidth, image->textureHeight, image->textureWidth, image->data);
+	const Color* level = image->mipmaps;
+	int width = image->textureWidth;
+	int height = image->textureHeight;
+	for (int i = 1; i < image->mipmapLevels; i++) {
+		if (width > 1) width >>= 1;
+		if (height > 1) height >>= 1;
+		sceGuTexImage(i, width, height, width, level);
+		level += width * height;
+	}
+}
+
 void clearImage(Color color, Image* image)
 {
+	if (image->parent) {
+		fillImageRect(color, 0, 0, image->imageWidth, image->imageHeight, image);
+		return;
+	}
 	int i;
 	int size = image->textureWidth * image->textureHeight;
 	Color* data = image->data;
+	imageChanged(image);
 	for (i = 0; i < size; i++, data++) *data = color;
 }
 
@@ -619,6 +1248,7 @@ void fillImageRect(Color color, int x0, int y0, int width, int height, Image* im
 	int skipX = image->textureWidth - width;
 	int x, y;
 	Color* data = image->data + x0 + y0 * image->textureWidth;
+	imageChanged(image);
 	for (y = 0; y < height; y++, data += skipX) {
 		for (x = 0; x < width; x++, data++) *data = color;
 	}
@@ -633,17 +1263,20 @@ void fillScreenRect(Color color, int x0, int y0, int width, int height)
 	for (y = 0; y < height; y++, data += skipX) {
 		for (x = 0; x < width; x++, data++) *data = color;
 	}
+	markDrawBufferDirty(x0, y0, width, height);
 }
 
 void putPixelScreen(Color color, int x, int y)
 {
 	Color* vram = getVramDrawBuffer();
 	vram[LINE_SIZE * y + x] = color;
+	markDrawBufferDirty(x, y, 1, 1);
 }
 
 void putPixelImage(Color color, int x, int y, Image* image)
 {
 	image->data[x + y * image->textureWidth] = color;
+	imageChanged(image);
 }
 
 Color getPixelScreen(int x, int y)
@@ -657,12 +1290,47 @@ Color getPixelImage(int x, int y, Image* image)
 	return image->data[x + y * image->textureWidth];
 }
 
+void readPixelsScreen(int x, int y, int width, int height, Color* pixels)
+{
+	Color* vram = getVramDrawBuffer() + LINE_SIZE * y + x;
+	for (int row = 0; row < height; row++, vram += LINE_SIZE, pixels += width) {
+		memcpy(pixels, vram, width * sizeof(Color));
+	}
+}
+
+void readPixelsImage(int x, int y, int width, int height, Color* pixels, Image* image)
+{
+	Color* data = image->data + image->textureWidth * y + x;
+	for (int row = 0; row < height; row++, data += image->textureWidth, pixels += width) {
+		memcpy(pixels, data, width * sizeof(Color));
+	}
+}
+
+void writePixelsScreen(const Color* pixels, int x, int y, int width, int height)
+{
+	Color* vram = getVramDrawBuffer() + LINE_SIZE * y + x;
+	for (int row = 0; row < height; row++, vram += LINE_SIZE, pixels += width) {
+		memcpy(vram, pixels, width * sizeof(Color));
+	}
+	markDrawBufferDirty(x, y, width, height);
+}
+
+void writePixelsImage(const Color* pixels, int x, int y, int width, int height, Image* image)
+{
+	Color* data = image->data + image->textureWidth * y + x;
+	for (int row = 0; row < height; row++, data += image->textureWidth, pixels += width) {
+		memcpy(data, pixels, width * sizeof(Color));
+	}
+	imageChanged(image);
+}
+
 void printTextScreen(int x, int y, const char* text, u32 color)
 {
 	int i, j, l;
 	u8 *font;
 	Color *vram_ptr;
 	Color *vram;
+	int x0 = x;
 
 	if (!initialized) return;
 
@@ -682,6 +1350,7 @@ void printTextScreen(int x, int y, const char* text, u32 color)
 		}
 		x += 8;
 	}
+	markDrawBufferDirty(x0, y, x - x0, 8);
 }
 
 void printTextImage(int x, int y, const char* text, u32 color, Image* image)
@@ -693,6 +1362,7 @@ void printTextImage(int x, int y, const char* text, u32 color, Image* image)
 
 	if (!initialized) return;
 
+	imageChanged(image);
 	for (size_t c = 0; c < strlen(text); c++) {
 		if (x < 0 || x + 8 > image->imageWidth || y < 0 || y + 8 > image->imageHeight) break;
 		char ch = text[c];
@@ -750,11 +1420,13 @@ static void fontPrintTextImpl(FT_Bitmap* bitmap, int xofs, int yofs, Color color
 void fontPrintTextImage(FT_Bitmap* bitmap, int x, int y, Color color, Image* image)
 {
 	fontPrintTextImpl(bitmap, x, y, color, image->data, image->imageWidth, image->imageHeight, image->textureWidth);
+	imageChanged(image);
 }
 
 void fontPrintTextScreen(FT_Bitmap* bitmap, int x, int y, Color color)
 {
 	fontPrintTextImpl(bitmap, x, y, color, getVramDrawBuffer(), SCREEN_WIDTH, SCREEN_HEIGHT, LINE_SIZE);
+	markDrawBufferDirty(x, y, bitmap->width, bitmap->rows);
 }
 
 void saveImage(const char* filename, Color* data, int width, int height, int lineSize, int saveAlpha)
@@ -891,11 +1563,13 @@ static void drawLine(int x0, int y0, int x1, int y1, int color, Color* destinati
 void drawLineScreen(int x0, int y0, int x1, int y1, Color color)
 {
 	drawLine(x0, y0, x1, y1, color, getVramDrawBuffer(), LINE_SIZE);
+	markDrawBufferDirty(x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, abs(x1 - x0) + 1, abs(y1 - y0) + 1);
 }
 
 void drawLineImage(int x0, int y0, int x1, int y1, Color color, Image* image)
 {
 	drawLine(x0, y0, x1, y1, color, image->data, image->textureWidth);
+	imageChanged(image);
 }
 
 #define BUF_WIDTH (512)
@@ -908,6 +1582,7 @@ void drawLineImage(int x0, int y0, int x1, int y1, Color color, Image* image)
 void initGraphics()
 {
 	dispBufferNumber = 0;
+	initBlendKernels();
 
 	sceGuInit();
 
@@ -17,15 +17,27 @@
 #define G(color) COLOR_G(color)
 #define R(color) COLOR_R(color)
 
-typedef struct
+struct Skyline;
+
+typedef struct Image
 {
 	int textureWidth;  // the real width of data, 2^n with n>=0
 	int textureHeight;  // the real height of data, 2^n with n>=0
 	int imageWidth;  // the image width
 	int imageHeight;
 	Color* data;
+	Color* mipmaps;  // levels 1 to mipmapLevels - 1 of the texture, one after another
+	int mipmapLevels;  // 0, if the mipmaps have to be generated
+	struct Image* parent;  // the atlas, whose data a view shares, or NULL
+	int references;  // the image and its views, the image is freed at 0
+	struct Skyline* skyline;  // the free space of an atlas, or NULL
+	unsigned int changes;  // counts the writes to the image and, for an atlas, to its views
+	AlphaRuns* alphaRuns;  // built by the first alpha blit after a change, or NULL
 } Image;
 
+// the maximum number of texture levels, including the image
+#define MAX_MIPMAP_LEVELS 8
+
 /**
  * Load a PNG or JPEG image (depends on the filename suffix).
  *
@@ -137,6 +149,75 @@ extern void blitAlphaImageToImage(int sx, int sy, int width, int height, Image*
  */
 extern void blitAlphaImageToScreen(int sx, int sy, int width, int height, Image* source, int dx, int dy);
 
+/**
+ * A rectangle to blit with blitBatchToImage or blitBatchToScreen.
+ */
+typedef struct
+{
+	int dx, dy;  // target position
+	int sx, sy;  // position in the source image
+	int width, height;
+} BlitSpan;
+
+/**
+ * Blit many rectangles of an image to another image. Every span is
+ * clipped to the source and the destination image.
+ *
+ * @pre spans != NULL && source != NULL && destination != NULL
+ * @param spans - the rectangles
+ * @param count - number of spans
+ * @param source - pointer to Image struct of the source image
+ * @param destination - pointer to Image struct of the destination image
+ * @param alpha - if not 0, blend with the alpha of the source image like blitAlphaImageToImage
+ */
+extern void blitBatchToImage(const BlitSpan* spans, int count, Image* source, Image* destination, int alpha);
+
+/**
+ * Blit many rectangles of an image to screen, in one display list. Every
+ * span is clipped to the source image and the screen.
+ *
+ * @pre spans != NULL && source != NULL
+ * @param spans - the rectangles
+ * @param count - number of spans
+ * @param source - pointer to Image struct of the source image
+ * @param alpha - if not 0, skip transparent pixels like blitAlphaImageToScreen
+ */
+extern void blitBatchToScreen(const BlitSpan* spans, int count, Image* source, int alpha);
+
+/**
+ * A scale, rotation and translation for blitTransformedImageToImage and
+ * blitTransformedImageToScreen. The pivot is scaled, then rotated around.
+ */
+typedef struct
+{
+	float x, y;  // destination position of the pivot
+	float angle;  // clockwise rotation in radians
+	float scaleX, scaleY;  // negative values mirror the image
+	float pivotX, pivotY;  // position in the source image
+	int linear;  // 1 for bilinear filtering, 0 for the nearest pixel
+} ImageTransform;
+
+/**
+ * Draw a transformed image to another image, blended with the alpha of the
+ * source like blitAlphaImageToImage. The pixels are clipped to the
+ * destination.
+ *
+ * @pre source != NULL && transform != NULL && destination != NULL
+ * @param source - pointer to Image struct of the source image
+ * @param transform - the transformation
+ * @param destination - pointer to Image struct of the destination image
+ */
+extern void blitTransformedImageToImage(Image* source, const ImageTransform* transform, Image* destination);
+
+/**
+ * Draw a transformed image to screen, blended with the alpha of the source.
+ *
+ * @pre source != NULL && transform != NULL
+ * @param source - pointer to Image struct of the source image
+ * @param transform - the transformation
+ */
+extern void blitTransformedImageToScreen(Image* source, const ImageTransform* transform);
+
 /**
  * Create an empty image.
  *
@@ -148,13 +229,55 @@ extern void blitAlphaImageToScreen(int sx, int sy, int width, int height, Image*
 extern Image* createImage(int width, int height);
 
 /**
- * Frees an allocated image.
+ * Frees an allocated image. The data of an atlas is freed with its last view.
  *
  * @pre image != null
  * @param image a pointer to an image struct
  */
 extern void freeImage(Image* image);
 
+/**
+ * The bytes of the pixels which an image owns. A view of an atlas owns none,
+ * its pixels belong to the atlas.
+ *
+ * @pre image != null
+ * @param image a pointer to an image struct
+ * @return size of the pixel data in bytes
+ */
+extern int getImageMemorySize(const Image* image);
+
+/**
+ * Create an empty atlas, an image which packs other images with addToAtlas.
+ *
+ * @pre width > 0 && height > 0 && width <= 512 && height <= 512
+ * @param width - width of the new atlas
+ * @param height - height of the new atlas
+ * @return pointer to a new allocated Image struct, all pixels initialized to color 0, or NULL on failure
+ */
+extern Image* createAtlas(int width, int height);
+
+/**
+ * Copy an image into free space of an atlas. The free space is tracked as a
+ * skyline, the image is placed where its bottom edge is lowest. The rows of
+ * the views start at multiples of 16 bytes, like textures require.
+ *
+ * @pre atlas != NULL && atlas->skyline != NULL && image != NULL
+ * @param atlas - the atlas
+ * @param image - the image to copy
+ * @return a view, which shares the data of the atlas, or NULL, if the atlas is full
+ */
+extern Image* addToAtlas(Image* atlas, Image* image);
+
+/**
+ * Set an image as the texture of the GU, with its mipmaps. The mipmaps are
+ * generated when the image is bound the first time after it has been
+ * created or changed. Must be called between sceGuStart and sceGuFinish.
+ *
+ * @pre image != NULL
+ * @param image - the texture
+ */
+extern void setTextureImage(Image* image);
+
 /**
  * Initialize all pixels of an image with a color.
  *
@@ -236,6 +359,56 @@ extern Color getPixelScreen(int x, int y);
  */
 extern Color getPixelImage(int x, int y, Image* image);
 
+/**
+ * Copy a rectangle of the screen to packed pixels, row by row.
+ *
+ * @pre x >= 0 && y >= 0 && x + width <= SCREEN_WIDTH && y + height <= SCREEN_HEIGHT
+ * @param x - left position of the rectangle
+ * @param y - top position of the rectangle
+ * @param width - width of the rectangle
+ * @param height - height of the rectangle
+ * @param pixels - destination for width * height colors
+ */
+extern void readPixelsScreen(int x, int y, int width, int height, Color* pixels);
+
+/**
+ * Copy a rectangle of an image to packed pixels, row by row.
+ *
+ * @pre x >= 0 && y >= 0 && x + width <= image->imageWidth && y + height <= image->imageHeight && image != NULL
+ * @param x - left position of the rectangle
+ * @param y - top position of the rectangle
+ * @param width - width of the rectangle
+ * @param height - height of the rectangle
+ * @param pixels - destination for width * height colors
+ * @param image - the image to read
+ */
+extern void readPixelsImage(int x, int y, int width, int height, Color* pixels, Image* image);
+
+/**
+ * Copy packed pixels, row by row, to a rectangle of the screen.
+ *
+ * @pre x >= 0 && y >= 0 && x + width <= SCREEN_WIDTH && y + height <= SCREEN_HEIGHT
+ * @param pixels - width * height colors
+ * @param x - left position of the rectangle
+ * @param y - top position of the rectangle
+ * @param width - width of the rectangle
+ * @param height - height of the rectangle
+ */
+extern void writePixelsScreen(const Color* pixels, int x, int y, int width, int height);
+
+/**
+ * Copy packed pixels, row by row, to a rectangle of an image.
+ *
+ * @pre x >= 0 && y >= 0 && x + width <= image->imageWidth && y + height <= image->imageHeight && image != NULL
+ * @param pixels - width * height colors
+ * @param x - left position of the rectangle
+ * @param y - top position of the rectangle
+ * @param width - width of the rectangle
+ * @param height - height of the rectangle
+ * @param image - the image to change
+ */
+extern void writePixelsImage(const Color* pixels, int x, int y, int width, int height, Image* image);
+
 /**
  * Print a text (pixels out of the screen or image are clipped).
  *
@@ -316,6 +489,17 @@ extern void savePngImage(const char* filename, Color* data, int width, int heigh
  */
 extern void saveJpegImage(const char* filename, Color* data, int width, int height, int lineSize);
 
+/**
+ * Convert a set of dirty tiles to rectangles in screen coordinates. Runs of
+ * tiles in a row are joined and consecutive rows with the same runs are
+ * merged.
+ *
+ * @param tiles - PLATFORM_TILES_Y tile rows, like from getDrawBufferDirtyTiles
+ * @param rects - space for PLATFORM_MAX_DIRTY_RECTS rectangles
+ * @return the number of rectangles
+ */
+extern int dirtyTilesToRects(const u32* tiles, DirtyRect* rects);
+
 /**
  * Exchange display buffer and drawing buffer.
  */
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "imagepool.h"
+
+// worker threads create and free images too
+#ifdef PLATFORM_LINUX
+#include <pthread.h>
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_POOL() pthread_mutex_lock(&poolMutex)
+#define UNLOCK_POOL() pthread_mutex_unlock(&poolMutex)
+#else
+#define LOCK_POOL()
+#define UNLOCK_POOL()
+#endif
+
+#define MIN_CLASS_SIZE 64
+#define DEFAULT_BUDGET (2 * 1024 * 1024)
+
+// a free buffer stores the link to the next one of its class
+typedef struct FreeBuffer
+{
+	struct FreeBuffer* next;
+} FreeBuffer;
+
+static FreeBuffer* freeBuffers[IMAGE_POOL_CLASSES];
+static ImageMemoryStats stats = { 0, 0, 0, DEFAULT_BUDGET };
+
+// the index of the smallest class with at least size bytes, or -1 for larger buffers, which aren't pooled
+static int sizeClass(int size)
+{
+	int index = 0;
+	for (int classSize = MIN_CLASS_SIZE; classSize < size; classSize <<= 1) index++;
+	return index < IMAGE_POOL_CLASSES ? index : -1;
+}
+
+void* allocImageMemory(int size)
+{
+	int index = sizeClass(size);
+	if (index < 0) {
+		void* memory = memalign(64, size);
+		LOCK_POOL();
+		stats.allocations++;
+		if (memory) {
+			stats.used += size;
+			if (stats.used > stats.peak) stats.peak = stats.used;
+		}
+		UNLOCK_POOL();
+		return memory;
+	}
+	int classSize = MIN_CLASS_SIZE << index;
+
+	LOCK_POOL();
+	stats.allocations++;
+	void* memory = freeBuffers[index];
+	if (memory) {
+		freeBuffers[index] = freeBuffers[index]->next;
+		stats.pooled -= classSize;
+		stats.classPooled[index]--;
+		stats.reused++;
+	} else {
+		memory = memalign(64, classSize);
+		if (!memory) {
+			UNLOCK_POOL();
+			return NULL;
+		}
+	}
+	stats.used += classSize;
+	stats.classUsed[index]++;
+	if (stats.used > stats.peak) stats.peak = stats.used;
+	UNLOCK_POOL();
+	return memory;
+}
+
+void freeImageMemory(void* memory, int size)
+{
+	if (!memory) return;
+	int index = sizeClass(size);
+	if (index < 0) {
+		free(memory);
+		LOCK_POOL();
+		stats.used -= size;
+		UNLOCK_POOL();
+		return;
+	}
+	int classSize = MIN_CLASS_SIZE << index;
+	LOCK_POOL();
+	stats.used -= classSize;
+	stats.classUsed[index]--;
+	if (stats.pooled + classSize > stats.budget) {
+		UNLOCK_POOL();
+		free(memory);
+		return;
+	}
+	FreeBuffer* buffer = (FreeBuffer*) memory;
+	buffer->next = freeBuffers[index];
+	freeBuffers[index] = buffer;
+	stats.pooled += classSize;
+	stats.classPooled[index]++;
+	UNLOCK_POOL();
+}
+
+void setImageMemoryBudget(int bytes)
+{
+	LOCK_POOL();
+	stats.budget = bytes > 0 ? bytes : 0;
+	// the largest buffers go first, they are the least likely to be reused
+	for (int index = IMAGE_POOL_CLASSES - 1; index >= 0 && stats.pooled > stats.budget; index--) {
+		while (freeBuffers[index] && stats.pooled > stats.budget) {
+			FreeBuffer* buffer = freeBuffers[index];
+			freeBuffers[index] = buffer->next;
+			free(buffer);
+			stats.pooled -= MIN_CLASS_SIZE << index;
+			stats.classPooled[index]--;
+		}
+	}
+	UNLOCK_POOL();
+}
+
+void getImageMemoryStats(ImageMemoryStats* result)
+{
+	LOCK_POOL();
+	*result = stats;
+	UNLOCK_POOL();
+}
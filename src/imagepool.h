@@ -0,0 +1,56 @@
+#ifndef IMAGEPOOL_H
+#define IMAGEPOOL_H
+
+#include "platform/platform.h"
+
+// buffers of 64 bytes to 1 MB, enough for a 512x512 image
+#define IMAGE_POOL_CLASSES 15
+
+typedef struct
+{
+	int used;  // bytes of the buffers in use, rounded up to their size class
+	int pooled;  // bytes of the free buffers kept for reuse
+	int peak;  // the maximum of used
+	int budget;  // the maximum of pooled
+	int allocations;  // number of allocImageMemory calls
+	int reused;  // allocations served from the pool
+	int classUsed[IMAGE_POOL_CLASSES];  // buffers in use of 64 << n bytes
+	int classPooled[IMAGE_POOL_CLASSES];  // free buffers of 64 << n bytes
+} ImageMemoryStats;
+
+/**
+ * Allocate memory for pixels. The size is rounded up to a power of two and
+ * freed buffers of the same size are reused, as long as the free buffers
+ * fit into the budget. Buffers larger than 1 MB are not pooled.
+ *
+ * @pre size > 0
+ * @param size - size in bytes
+ * @return memory aligned to 64 bytes, or NULL on failure
+ */
+extern void* allocImageMemory(int size);
+
+/**
+ * Give memory from allocImageMemory back to the pool, or to the system, if
+ * the pool would exceed its budget.
+ *
+ * @param memory - the memory, or NULL
+ * @param size - the size passed to allocImageMemory
+ */
+extern void freeImageMemory(void* memory, int size);
+
+/**
+ * Set the maximum number of bytes of the free buffers in the pool. Free
+ * buffers above the new budget are released.
+ *
+ * @param bytes - the budget, 0 disables the pool
+ */
+extern void setImageMemoryBudget(int bytes);
+
+/**
+ * Get the statistics of the pool.
+ *
+ * @param stats - receives the current statistics
+ */
+extern void getImageMemoryStats(ImageMemoryStats* stats);
+
+#endif
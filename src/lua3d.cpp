@@ -2,16 +2,17 @@
 #include "luaplayer.h"
 
 #include "graphics.h"
+#include "platform/vertexformat.h"
 
 PspGeContext __attribute__((aligned(16))) geContext;
 
-extern Color* toColor(lua_State *L, int arg);
-extern Image** toImage(lua_State *L, int arg);
+extern Color checkColor(lua_State *L, int arg);
+extern Image* checkImage(lua_State *L, int arg);
 
 static int lua_sceGuClearColor(lua_State *L) {
 	int argc = lua_gettop(L); 
 	if (argc != 1) return luaL_error(L, "wrong number of arguments"); 
-	sceGuClearColor(*toColor(L, 1));
+	sceGuClearColor(checkColor(L, 1));
 	return 0;
 }
 
@@ -71,11 +72,106 @@ static int lua_sceGumRotateXYZ(lua_State *L) {
 	return 0;
 }
 
+static int lua_sceGumScale(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 3) return luaL_error(L, "wrong number of arguments");
+	ScePspFVector3 v;
+	v.x = luaL_checknumber(L, 1);
+	v.y = luaL_checknumber(L, 2);
+	v.z = luaL_checknumber(L, 3);
+	sceGumScale(&v);
+	return 0;
+}
+
+static int lua_sceGumOrtho(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 6) return luaL_error(L, "wrong number of arguments");
+	sceGumOrtho(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
+		luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6));
+	return 0;
+}
+
+static int lua_sceGumLookAt(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 9) return luaL_error(L, "wrong number of arguments");
+	ScePspFVector3 eye, center, up;
+	eye.x = luaL_checknumber(L, 1);
+	eye.y = luaL_checknumber(L, 2);
+	eye.z = luaL_checknumber(L, 3);
+	center.x = luaL_checknumber(L, 4);
+	center.y = luaL_checknumber(L, 5);
+	center.z = luaL_checknumber(L, 6);
+	up.x = luaL_checknumber(L, 7);
+	up.y = luaL_checknumber(L, 8);
+	up.z = luaL_checknumber(L, 9);
+	sceGumLookAt(&eye, &center, &up);
+	return 0;
+}
+
+static int lua_sceGumPushMatrix(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 0) return luaL_error(L, "wrong number of arguments");
+	sceGumPushMatrix();
+	return 0;
+}
+
+static int lua_sceGumPopMatrix(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 0) return luaL_error(L, "wrong number of arguments");
+	sceGumPopMatrix();
+	return 0;
+}
+
+// reads a table of 16 numbers, column by column
+static void toMatrix(lua_State *L, int arg, ScePspFMatrix4* matrix) {
+	if (lua_type(L, arg) != LUA_TTABLE || lua_rawlen(L, arg) != 16) {
+		luaL_error(L, "matrix must be a table with 16 numbers");
+	}
+	float* m = (float*) matrix;
+	for (int i = 0; i < 16; i++) {
+		lua_rawgeti(L, arg, i + 1);
+		m[i] = luaL_checknumber(L, -1);
+		lua_pop(L, 1);
+	}
+}
+
+static int lua_sceGumLoadMatrix(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 1) return luaL_error(L, "wrong number of arguments");
+	ScePspFMatrix4 matrix;
+	toMatrix(L, 1, &matrix);
+	sceGumLoadMatrix(&matrix);
+	return 0;
+}
+
+static int lua_sceGumMultMatrix(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 1) return luaL_error(L, "wrong number of arguments");
+	ScePspFMatrix4 matrix;
+	toMatrix(L, 1, &matrix);
+	sceGumMultMatrix(&matrix);
+	return 0;
+}
+
+// The display list between Gu.start3d and Gu.end3d keeps pointers to the
+// pixels of textures and to the data of buffers, so their userdata are kept
+// in this registry table until the list has been executed
+#define LIST_REFERENCES "Gu.listReferences"
+
+static void keepUntilEnd3d(lua_State *L, int arg) {
+	if (lua_getfield(L, LUA_REGISTRYINDEX, LIST_REFERENCES) == LUA_TTABLE) {
+		lua_pushvalue(L, arg);
+		lua_pushboolean(L, 1);
+		lua_rawset(L, -3);
+	}
+	lua_pop(L, 1);
+}
+
 static int lua_sceGuTexImage(lua_State *L) {
 	int argc = lua_gettop(L); 
 	if (argc != 1) return luaL_error(L, "wrong number of arguments"); 
-	Image* image = *toImage(L, 1);
-	sceGuTexImage(0, image->textureWidth, image->textureHeight, image->textureWidth, image->data);
+	setTextureImage(checkImage(L, 1));
+	keepUntilEnd3d(L, 1);
 
 	return 0;
 }
@@ -90,7 +186,7 @@ static int lua_sceGuTexFunc(lua_State *L) {
 static int lua_sceGuTexEnvColor(lua_State *L) {
 	int argc = lua_gettop(L); 
 	if (argc != 1) return luaL_error(L, "wrong number of arguments"); 
-	sceGuTexEnvColor(*toColor(L, 1));
+	sceGuTexEnvColor(checkColor(L, 1));
 	return 0;
 }
 
@@ -118,14 +214,14 @@ static int lua_sceGuTexOffset(lua_State *L) {
 static int lua_sceGuAmbientColor(lua_State *L) {
 	int argc = lua_gettop(L); 
 	if (argc != 1) return luaL_error(L, "wrong number of arguments"); 
-	sceGuAmbientColor(*toColor(L, 1));
+	sceGuAmbientColor(checkColor(L, 1));
 	return 0;
 }
 
 static int lua_sceGuAmbient(lua_State *L) {
 	int argc = lua_gettop(L); 
 	if (argc != 1) return luaL_error(L, "wrong number of arguments"); 
-	sceGuAmbient(*toColor(L, 1));
+	sceGuAmbient(checkColor(L, 1));
 	return 0;
 }
 
@@ -171,7 +267,7 @@ static int lua_sceGuLightAtt(lua_State *L) {
 static int lua_sceGuLightColor(lua_State *L) {
 	int argc = lua_gettop(L);
 	if (argc != 3) return luaL_error(L, "wrong number of arguments");
-	sceGuLightColor((int)luaL_checknumber(L, 1), (int)luaL_checknumber(L, 2), *toColor(L, 3));
+	sceGuLightColor((int)luaL_checknumber(L, 1), (int)luaL_checknumber(L, 2), checkColor(L, 3));
 	return 0;
 }
 
@@ -193,55 +289,327 @@ static int lua_sceGuLightSpot(lua_State *L) {
 	return 0;
 }
 
+// vertices packed in the layout of a vtype, see getVertexFormat
+typedef struct
+{
+	int vtype;
+	VertexFormat format;
+	int count;
+	void* data;
+} VertexBuffer;
+
+UserdataStubs(VertexBuffer, VertexBuffer*)
+
+// the bits of a vtype, which change the layout of the vertices
+#define VERTEX_LAYOUT_BITS (GU_WEIGHT_BITS | GU_WEIGHTS_BITS | GU_TEXTURE_BITS | GU_COLOR_BITS | GU_NORMAL_BITS | GU_VERTEX_BITS)
+
+static int vertexComponentCount(const VertexFormat* format)
+{
+	return format->weightCount + (format->textureSize ? 2 : 0) + (format->colorFormat ? 1 : 0)
+		+ (format->normalSize ? 3 : 0) + (format->positionSize ? 3 : 0);
+}
+
+// stores the numbers at the top of the stack in components of the given size
+static void packNumbers(lua_State *L, u8* destination, int size, int count, int* luaIndex)
+{
+	for (int i = 0; i < count; i++) {
+		lua_rawgeti(L, -1, (*luaIndex)++);
+		float value = luaL_checknumber(L, -1);
+		lua_pop(L, 1);
+		switch (size) {
+			case 1: destination[i] = (u8)(int)value; break;
+			case 2: ((u16*)destination)[i] = (u16)(int)value; break;
+			default: ((float*)destination)[i] = value; break;
+		}
+	}
+}
+
+static void packColor(Color color, int colorFormat, u8* destination)
+{
+	int r = COLOR_R(color), g = COLOR_G(color), b = COLOR_B(color), a = COLOR_A(color);
+	switch (colorFormat) {
+		case GU_COLOR_5650: *(u16*)destination = (r >> 3) | ((g >> 2) << 5) | ((b >> 3) << 11); break;
+		case GU_COLOR_5551: *(u16*)destination = (r >> 3) | ((g >> 3) << 5) | ((b >> 3) << 10) | ((a >> 7) << 15); break;
+		case GU_COLOR_4444: *(u16*)destination = (r >> 4) | ((g >> 4) << 4) | ((b >> 4) << 8) | ((a >> 4) << 12); break;
+		default: *(Color*)destination = color; break;
+	}
+}
+
+// packs a table of vertex tables, each with the weights, texture coordinates,
+// color, normal and position as declared by the format
+static void packVertices(lua_State *L, int arg, const VertexFormat* format, u8* destination, int count)
+{
+	int components = vertexComponentCount(format);
+	for (int i = 1; i <= count; ++i, destination += format->size) {
+		lua_rawgeti(L, arg, i);
+		if (lua_type(L, -1) != LUA_TTABLE || (int)lua_rawlen(L, -1) != components) {
+			luaL_error(L, "wrong number of vertex components");
+		}
+		int luaIndex = 1;
+		packNumbers(L, destination + format->weightOffset, format->weightSize, format->weightCount, &luaIndex);
+		if (format->textureSize) packNumbers(L, destination + format->textureOffset, format->textureSize, 2, &luaIndex);
+		if (format->colorFormat) {
+			lua_rawgeti(L, -1, luaIndex++);
+			packColor(checkColor(L, -1), format->colorFormat, destination + format->colorOffset);
+			lua_pop(L, 1);
+		}
+		if (format->normalSize) packNumbers(L, destination + format->normalOffset, format->normalSize, 3, &luaIndex);
+		if (format->positionSize) packNumbers(L, destination + format->positionOffset, format->positionSize, 3, &luaIndex);
+		lua_pop(L, 1);
+	}
+}
+
+static int VertexBuffer_new(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc != 2) return luaL_error(L, "Argument error: VertexBuffer.new(vtype, count or vertices) takes two arguments.");
+	int vtype = (int)luaL_checknumber(L, 1);
+	int count;
+	if (lua_type(L, 2) == LUA_TTABLE) {
+		count = (int)lua_rawlen(L, 2);
+	} else {
+		count = (int)luaL_checknumber(L, 2);
+	}
+	if (count <= 0) return luaL_error(L, "a vertex buffer needs at least one vertex");
+
+	VertexFormat format;
+	getVertexFormat(vtype, &format);
+	if (format.positionSize == 0) return luaL_error(L, "the vtype has no vertex position");
+	void* data = memalign(16, count * format.size);
+	if (!data) return luaL_error(L, "not enough memory for the vertex buffer");
+	memset(data, 0, count * format.size);
+
+	VertexBuffer** luaBuffer = pushVertexBuffer(L);
+	VertexBuffer* buffer = (VertexBuffer*) malloc(sizeof(VertexBuffer));
+	buffer->vtype = vtype;
+	buffer->format = format;
+	buffer->count = count;
+	buffer->data = data;
+	*luaBuffer = buffer;
+
+	if (lua_type(L, 2) == LUA_TTABLE) {
+		packVertices(L, 2, &format, (u8*) data, count);
+		sceKernelDcacheWritebackInvalidateAll();
+	}
+	return 1;
+}
+
+// overwrites the vertices first, first + 1, ... with a table of vertex tables
+static int VertexBuffer_set(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc != 3) return luaL_error(L, "Argument error: vertexBuffer:set(first, vertices) takes two arguments.");
+	VertexBuffer* buffer = *toVertexBuffer(L, 1);
+	int first = (int)luaL_checknumber(L, 2);
+	if (lua_type(L, 3) != LUA_TTABLE) return luaL_error(L, "vertices table missing");
+	int count = (int)lua_rawlen(L, 3);
+	if (first < 1 || first - 1 + count > buffer->count) return luaL_error(L, "vertices out of the range of the vertex buffer");
+	packVertices(L, 3, &buffer->format, (u8*) buffer->data + (first - 1) * buffer->format.size, count);
+	sceKernelDcacheWritebackInvalidateAll();
+	return 0;
+}
+
+static int VertexBuffer_count(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: vertexBuffer:count() takes no arguments.");
+	lua_pushnumber(L, (*toVertexBuffer(L, 1))->count);
+	return 1;
+}
+
+static int VertexBuffer_free(lua_State *L)
+{
+	VertexBuffer* buffer = *toVertexBuffer(L, 1);
+	free(buffer->data);
+	free(buffer);
+	return 0;
+}
+
+static int VertexBuffer_tostring(lua_State *L)
+{
+	lua_pushfstring(L, "VertexBuffer (%d vertices)", (*toVertexBuffer(L, 1))->count);
+	return 1;
+}
+
+static const luaL_Reg VertexBuffer_methods[] = {
+	{"new", VertexBuffer_new},
+	{"set", VertexBuffer_set},
+	{"count", VertexBuffer_count},
+	{0,0}
+};
+
+static const luaL_Reg VertexBuffer_meta[] = {
+	{"__gc", VertexBuffer_free},
+	{"__tostring", VertexBuffer_tostring},
+	{0,0}
+};
+
+UserdataRegister(VertexBuffer, VertexBuffer_methods, VertexBuffer_meta)
+
+// 8 or 16 bit vertex indices for indexed drawing
+typedef struct
+{
+	int indexType;  // GU_INDEX_8BIT or GU_INDEX_16BIT
+	int count;
+	int maxIndex;   // largest index, for the range check against the vertex buffer
+	void* data;
+} IndexBuffer;
+
+UserdataStubs(IndexBuffer, IndexBuffer*)
+
+static int indexAt(const IndexBuffer* buffer, int i)
+{
+	return buffer->indexType == GU_INDEX_8BIT ? ((u8*) buffer->data)[i] : ((u16*) buffer->data)[i];
+}
+
+static void packIndices(lua_State *L, int arg, IndexBuffer* buffer, int first, int count)
+{
+	int limit = buffer->indexType == GU_INDEX_8BIT ? 0xff : 0xffff;
+	for (int i = 0; i < count; i++) {
+		lua_rawgeti(L, arg, i + 1);
+		int index = (int)luaL_checknumber(L, -1);
+		lua_pop(L, 1);
+		if (index < 0 || index > limit) luaL_error(L, "index %d out of range", index);
+		if (buffer->indexType == GU_INDEX_8BIT) {
+			((u8*) buffer->data)[first + i] = index;
+		} else {
+			((u16*) buffer->data)[first + i] = index;
+		}
+	}
+	buffer->maxIndex = 0;
+	for (int i = 0; i < buffer->count; i++) {
+		int index = indexAt(buffer, i);
+		if (index > buffer->maxIndex) buffer->maxIndex = index;
+	}
+	sceKernelDcacheWritebackInvalidateAll();
+}
+
+static int IndexBuffer_new(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc != 2) return luaL_error(L, "Argument error: IndexBuffer.new(indexType, count or indices) takes two arguments.");
+	int indexType = (int)luaL_checknumber(L, 1);
+	if (indexType != GU_INDEX_8BIT && indexType != GU_INDEX_16BIT) return luaL_error(L, "the index type must be Gu.INDEX_8BIT or Gu.INDEX_16BIT");
+	int count = lua_type(L, 2) == LUA_TTABLE ? (int)lua_rawlen(L, 2) : (int)luaL_checknumber(L, 2);
+	if (count <= 0) return luaL_error(L, "an index buffer needs at least one index");
+	int size = indexType == GU_INDEX_8BIT ? 1 : 2;
+	void* data = memalign(16, count * size);
+	if (!data) return luaL_error(L, "not enough memory for the index buffer");
+	memset(data, 0, count * size);
+
+	IndexBuffer** luaBuffer = pushIndexBuffer(L);
+	IndexBuffer* buffer = (IndexBuffer*) malloc(sizeof(IndexBuffer));
+	buffer->indexType = indexType;
+	buffer->count = count;
+	buffer->maxIndex = 0;
+	buffer->data = data;
+	*luaBuffer = buffer;
+
+	if (lua_type(L, 2) == LUA_TTABLE) packIndices(L, 2, buffer, 0, count);
+	return 1;
+}
+
+// overwrites the indices first, first + 1, ... with a table of indices
+static int IndexBuffer_set(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc != 3) return luaL_error(L, "Argument error: indexBuffer:set(first, indices) takes two arguments.");
+	IndexBuffer* buffer = *toIndexBuffer(L, 1);
+	int first = (int)luaL_checknumber(L, 2);
+	if (lua_type(L, 3) != LUA_TTABLE) return luaL_error(L, "indices table missing");
+	int count = (int)lua_rawlen(L, 3);
+	if (first < 1 || first - 1 + count > buffer->count) return luaL_error(L, "indices out of the range of the index buffer");
+	packIndices(L, 3, buffer, first - 1, count);
+	return 0;
+}
+
+static int IndexBuffer_count(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: indexBuffer:count() takes no arguments.");
+	lua_pushnumber(L, (*toIndexBuffer(L, 1))->count);
+	return 1;
+}
+
+static int IndexBuffer_free(lua_State *L)
+{
+	IndexBuffer* buffer = *toIndexBuffer(L, 1);
+	free(buffer->data);
+	free(buffer);
+	return 0;
+}
+
+static int IndexBuffer_tostring(lua_State *L)
+{
+	lua_pushfstring(L, "IndexBuffer (%d indices)", (*toIndexBuffer(L, 1))->count);
+	return 1;
+}
+
+static const luaL_Reg IndexBuffer_methods[] = {
+	{"new", IndexBuffer_new},
+	{"set", IndexBuffer_set},
+	{"count", IndexBuffer_count},
+	{0,0}
+};
+
+static const luaL_Reg IndexBuffer_meta[] = {
+	{"__gc", IndexBuffer_free},
+	{"__tostring", IndexBuffer_tostring},
+	{0,0}
+};
+
+UserdataRegister(IndexBuffer, IndexBuffer_methods, IndexBuffer_meta)
+
+// Gum.drawArray(prim, vtype, vertices) with a table of vertex tables,
+// Gum.drawArray(prim, vtype, vertexBuffer [, first, count]) or
+// Gum.drawArray(prim, vtype, vertexBuffer, indexBuffer [, first, count]),
+// where first and count select indices
 static int lua_sceGumDrawArray(lua_State *L) {
 	int argc = lua_gettop(L);
-	if (argc != 3) return luaL_error(L, "wrong number of arguments");
+	if (argc < 3 || argc > 6) return luaL_error(L, "wrong number of arguments");
 
 	int prim = (int)luaL_checknumber(L, 1);
 	int vtype = (int)luaL_checknumber(L, 2);
-	if (lua_type(L, 3) != LUA_TTABLE) return luaL_error(L, "vertices table missing");
-	int n = (int)lua_rawlen(L, 3);
 
-	int quads = 0;
-	int colorLuaIndex = -1;
-	if (vtype & GU_TEXTURE_32BITF) quads += 2;
-	if (vtype & GU_COLOR_8888) {
-		quads++;
-		colorLuaIndex = quads;
-	}
-	if (vtype & GU_NORMAL_32BITF) quads += 3;
-	if (vtype & GU_VERTEX_32BITF) quads += 3;
-
-	void* vertices = memalign(16, n * quads*4);
-	float* vertex = (float*) vertices;
-	int i;
-	for (i = 1; i <= n; ++i) {
-		// get vertice table
-		lua_rawgeti(L, 3, i);
-		int n2 = (int)lua_rawlen(L, -1);
-		if (n2 != quads) {
-			free(vertices);
-			return luaL_error(L, "wrong number of vertex components");
+	if (lua_type(L, 3) == LUA_TUSERDATA) {
+		VertexBuffer* buffer = *(VertexBuffer**)luaL_checkudata(L, 3, "VertexBuffer");
+		if ((buffer->vtype & VERTEX_LAYOUT_BITS) != (vtype & VERTEX_LAYOUT_BITS)) {
+			return luaL_error(L, "the vertex buffer was created for another vtype");
 		}
-		int j;
-		for (j = 1; j <= n2; ++j) {
-			lua_rawgeti(L, -1, j);
-			if (j != colorLuaIndex) {
-				*vertex = luaL_checknumber(L, -1);
-			} else {
-				*((Color*) vertex) = *toColor(L, -1);
-			}
-			lua_pop(L, 1);  // removes 'value'
-			vertex++;
+		IndexBuffer** indexBuffer = (IndexBuffer**)luaL_testudata(L, 4, "IndexBuffer");
+		int rangeArg = indexBuffer ? 5 : 4;
+		if (argc > rangeArg + 1) return luaL_error(L, "wrong number of arguments");
+		int total = indexBuffer ? (*indexBuffer)->count : buffer->count;
+		int first = argc >= rangeArg ? (int)luaL_checknumber(L, rangeArg) : 1;
+		int count = argc >= rangeArg + 1 ? (int)luaL_checknumber(L, rangeArg + 1) : total - first + 1;
+		if (first < 1 || count < 0 || first - 1 + count > total) {
+			return luaL_error(L, indexBuffer ? "indices out of the range of the index buffer" : "vertices out of the range of the vertex buffer");
 		}
-
-		// remove vertice table
-		lua_pop(L, 1);
+		if (indexBuffer) {
+			IndexBuffer* indices = *indexBuffer;
+			if ((vtype & GU_INDEX_BITS) != indices->indexType) return luaL_error(L, "the vtype has another index type than the index buffer");
+			if (indices->maxIndex >= buffer->count) return luaL_error(L, "index %d out of the range of the vertex buffer", indices->maxIndex);
+			int indexSize = indices->indexType == GU_INDEX_8BIT ? 1 : 2;
+			sceGumDrawArray(prim, vtype, count, (u8*) indices->data + (first - 1) * indexSize, buffer->data);
+			keepUntilEnd3d(L, 4);
+		} else {
+			if (vtype & GU_INDEX_BITS) return luaL_error(L, "index buffer missing");
+			sceGumDrawArray(prim, vtype, count, NULL, (u8*) buffer->data + (first - 1) * buffer->format.size);
+		}
+		keepUntilEnd3d(L, 3);
+		return 0;
 	}
-	
+
+	if (argc != 3) return luaL_error(L, "wrong number of arguments");
+	if (lua_type(L, 3) != LUA_TTABLE) return luaL_error(L, "vertices table missing");
+	int n = (int)lua_rawlen(L, 3);
+
+	// in the display list, the GE reads the vertices when the list is executed
+	VertexFormat format;
+	getVertexFormat(vtype, &format);
+	void* vertices = sceGuGetMemory(n * format.size);
+	packVertices(L, 3, &format, (u8*) vertices, n);
+
 	sceKernelDcacheWritebackInvalidateAll();
 	sceGumDrawArray(prim, vtype, n, NULL, vertices);
-	free(vertices);
 	return 0;
 }
 
@@ -250,6 +618,8 @@ static int lua_start3d(lua_State *L) {
 	if (argc != 0) return luaL_error(L, "wrong number of arguments"); 
 	sceGeSaveContext(&geContext);
 	guStart();
+	lua_newtable(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, LIST_REFERENCES);
 	return 0;
 }
 
@@ -258,10 +628,23 @@ static int lua_end3d(lua_State *L) {
 	if (argc != 0) return luaL_error(L, "wrong number of arguments"); 
 	sceGuFinish();
 	sceGuSync(0, 0);
+	lua_pushnil(L);
+	lua_setfield(L, LUA_REGISTRYINDEX, LIST_REFERENCES);
 	sceGeRestoreContext(&geContext);
 	return 0;
 }
 
+#ifdef PLATFORM_LINUX
+// sets the number of rasteriser threads, 0 for one per thread of the job system, and returns the number in use
+static int lua_rasterThreads(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc > 1) return luaL_error(L, "Gu.rasterThreads([count]) takes zero or one argument");
+	if (argc == 1) setRasterThreads((int)luaL_checknumber(L, 1));
+	lua_pushnumber(L, getRasterThreads());
+	return 1;
+}
+#endif
+
 static const luaL_Reg Gu_functions[] = {
 	{"clearColor", lua_sceGuClearColor},
 	{"clearDepth", lua_sceGuClearDepth},
@@ -284,6 +667,9 @@ static const luaL_Reg Gu_functions[] = {
 	{"lightSpot", lua_sceGuLightSpot},
 	{"start3d", lua_start3d},
 	{"end3d", lua_end3d},
+#ifdef PLATFORM_LINUX
+	{"rasterThreads", lua_rasterThreads},
+#endif
   {0, 0}
 };
 
@@ -293,11 +679,20 @@ static const luaL_Reg Gum_functions[] = {
 	{"perspective", lua_sceGumPerspective},
 	{"translate", lua_sceGumTranslate},
 	{"rotateXYZ", lua_sceGumRotateXYZ},
+	{"scale", lua_sceGumScale},
+	{"ortho", lua_sceGumOrtho},
+	{"lookAt", lua_sceGumLookAt},
+	{"pushMatrix", lua_sceGumPushMatrix},
+	{"popMatrix", lua_sceGumPopMatrix},
+	{"loadMatrix", lua_sceGumLoadMatrix},
+	{"multMatrix", lua_sceGumMultMatrix},
 	{"drawArray", lua_sceGumDrawArray},
   {0, 0}
 };
 
 void lua3D_init(lua_State *L) {
+	VertexBuffer_register(L);
+	IndexBuffer_register(L);
 	luaL_newlib(L, Gu_functions);
 	lua_setglobal(L, "Gu");
 	luaL_newlib(L, Gum_functions);
@@ -1,9 +1,11 @@
 #include <stdlib.h>
 #include <malloc.h>
 #include <string.h>
+#include <math.h>
 #include "luaplayer.h"
 
 #include "graphics.h"
+#include "parallel.h"
 #include "vera.cpp"
 #include "veraMono.cpp"
 
@@ -12,6 +14,31 @@ static Image theScreenImage;
 
 UserdataStubs(Color, Color)
 
+// after Color.integerMode(true) new colors are integers in ABGR layout instead of userdata.
+// Every state has its own mode, stored in its registry under the address of this key
+static const char integerColorsKey = 0;
+
+static bool integerColors(lua_State *L)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &integerColorsKey);
+	bool enabled = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+	return enabled;
+}
+
+// a Color userdata or an integer in ABGR layout
+Color checkColor(lua_State *L, int arg)
+{
+	if (lua_isinteger(L, arg)) return (Color) lua_tointeger(L, arg);
+	return *toColor(L, arg);
+}
+
+static void pushColorValue(lua_State *L, Color color)
+{
+	if (integerColors(L)) lua_pushinteger(L, color);
+	else *pushColor(L) = color;
+}
+
 FT_Library  ft_library;
 
 struct Font {
@@ -43,6 +70,47 @@ static int lua_flipScreen(lua_State *L)
 	return 0;
 }
 
+#ifdef PLATFORM_LINUX
+// returns the histogram of the vblank wait errors, optionally resetting it
+static int lua_pacingHistogram(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc > 1) return luaL_error(L, "screen.pacingHistogram([reset]) takes zero or one argument");
+	int limits[PLATFORM_PACING_BUCKETS];
+	u32 counts[PLATFORM_PACING_BUCKETS];
+	getPacingHistogram(limits, counts, argc == 1 && lua_toboolean(L, 1));
+	lua_newtable(L);
+	for (int i = 0; i < PLATFORM_PACING_BUCKETS; i++) {
+		lua_pushnumber(L, i + 1);
+		lua_newtable(L);
+		lua_pushstring(L, "upTo"); lua_pushnumber(L, limits[i] < 0 ? HUGE_VAL : limits[i]); lua_settable(L, -3);
+		lua_pushstring(L, "count"); lua_pushnumber(L, counts[i]); lua_settable(L, -3);
+		lua_settable(L, -3);
+	}
+	return 1;
+}
+#endif
+
+// returns the regions of the screen drawn since the last flip, in tiles
+static int lua_dirtyRegions(lua_State *L)
+{
+	u32 tiles[PLATFORM_TILES_Y];
+	DirtyRect rects[PLATFORM_MAX_DIRTY_RECTS];
+	getDrawBufferDirtyTiles(tiles);
+	int count = dirtyTilesToRects(tiles, rects);
+	lua_newtable(L);
+	for (int i = 0; i < count; i++) {
+		lua_pushnumber(L, i + 1);
+		lua_newtable(L);
+		lua_pushstring(L, "x"); lua_pushnumber(L, rects[i].x); lua_settable(L, -3);
+		lua_pushstring(L, "y"); lua_pushnumber(L, rects[i].y); lua_settable(L, -3);
+		lua_pushstring(L, "width"); lua_pushnumber(L, rects[i].width); lua_settable(L, -3);
+		lua_pushstring(L, "height"); lua_pushnumber(L, rects[i].height); lua_settable(L, -3);
+		lua_settable(L, -3);
+	}
+	return 1;
+}
+
 /// Utility
 /// ====================
 
@@ -87,7 +155,6 @@ static int adjustBlitRectangle(
 UserdataStubs(Font, Font*) //==========================
 static int Font_load(lua_State *L) {
 	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: Font.load(filename) takes one argument.");
-	lua_gc(L, LUA_GCCOLLECT, 0);
 	Font* font = (Font*) malloc(sizeof(Font));
 	const char* filename = luaL_checkstring(L, 1);
 	
@@ -97,6 +164,11 @@ static int Font_load(lua_State *L) {
 	fseek(fontFile, 0, SEEK_END);
 	int filesize = ftell(fontFile);
 	u8* fontData = (u8*) malloc(filesize);
+	if (!fontData) {
+		// the memory may be held by unreachable objects
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		fontData = (u8*) malloc(filesize);
+	}
 	if (!fontData) {
 		fclose(fontFile);
 		return luaL_error(L, "Font.load: not enough memory to cache font file.");
@@ -114,12 +186,12 @@ static int Font_load(lua_State *L) {
 	font->name = strdup(filename);
 	Font** luaFont = pushFont(L);
 	*luaFont = font;
+	addExternalMemory(L, -1, filesize);
 	return 1;
 }
 
 static int Font_createMonoSpaced(lua_State *L) {
 	if (lua_gettop(L) != 0) return luaL_error(L, "Argument error: Font.createMonoSpaced() takes no arguments.");
-	lua_gc(L, LUA_GCCOLLECT, 0);
 	Font* font = (Font*) malloc(sizeof(Font));
 	const char* filename = "Vera mono spaced";
 
@@ -137,7 +209,6 @@ static int Font_createMonoSpaced(lua_State *L) {
 
 static int Font_createProportional(lua_State *L) {
 	if (lua_gettop(L) != 0) return luaL_error(L, "Argument error: Font.createProportional() takes no arguments.");
-	lua_gc(L, LUA_GCCOLLECT, 0);
 	Font* font = (Font*) malloc(sizeof(Font));
 	const char* filename = "Vera proportional";
 
@@ -207,6 +278,7 @@ static int Font_getTextSize(lua_State *L) {
 
 static int Font_free(lua_State *L) {
 	Font* font = *toFont(L, 1);
+	releaseExternalMemory(L, 1);
 	FT_Done_Face(font->face);
 	free(font->name);
 	if (font->data)	free(font->data);
@@ -237,41 +309,510 @@ UserdataRegister(Font, Font_methods, Font_meta)
 
 
 
+typedef struct
+{
+	int count;
+	BlitSpan* spans;
+} SpanArray;
+
+UserdataStubs(SpanArray, SpanArray*) //==========================
+// SpanArray.new(count) or SpanArray.new({dx, dy, sx, sy, width, height, dx, dy, ...})
+static int SpanArray_new(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: SpanArray.new(count or spans) takes one argument.");
+	int count;
+	bool table = lua_type(L, 1) == LUA_TTABLE;
+	if (table) {
+		int n = (int)lua_rawlen(L, 1);
+		if (n % 6 != 0) return luaL_error(L, "the spans table needs 6 numbers per span");
+		count = n / 6;
+	} else {
+		count = (int)luaL_checknumber(L, 1);
+	}
+	if (count <= 0) return luaL_error(L, "a span array needs at least one span");
+
+	BlitSpan* spans = (BlitSpan*) calloc(count, sizeof(BlitSpan));
+	if (!spans) return luaL_error(L, "not enough memory for the span array");
+	SpanArray** luaArray = pushSpanArray(L);
+	SpanArray* array = (SpanArray*) malloc(sizeof(SpanArray));
+	array->count = count;
+	array->spans = spans;
+	*luaArray = array;
+
+	if (table) {
+		int* values = (int*) spans;
+		for (int i = 0; i < count * 6; i++) {
+			lua_rawgeti(L, 1, i + 1);
+			values[i] = (int)luaL_checknumber(L, -1);
+			lua_pop(L, 1);
+		}
+	}
+	return 1;
+}
+
+// spans:set(index, dx, dy, sx, sy, width, height), the first span has index 1
+static int SpanArray_set(lua_State *L)
+{
+	if (lua_gettop(L) != 8) return luaL_error(L, "Argument error: spans:set(index, dx, dy, sx, sy, width, height) takes seven arguments.");
+	SpanArray* array = *toSpanArray(L, 1);
+	int index = (int)luaL_checknumber(L, 2);
+	if (index < 1 || index > array->count) return luaL_error(L, "index out of the range of the span array");
+	BlitSpan* span = &array->spans[index - 1];
+	span->dx = (int)luaL_checknumber(L, 3);
+	span->dy = (int)luaL_checknumber(L, 4);
+	span->sx = (int)luaL_checknumber(L, 5);
+	span->sy = (int)luaL_checknumber(L, 6);
+	span->width = (int)luaL_checknumber(L, 7);
+	span->height = (int)luaL_checknumber(L, 8);
+	return 0;
+}
+
+// returns dx, dy, sx, sy, width, height of a span
+static int SpanArray_get(lua_State *L)
+{
+	if (lua_gettop(L) != 2) return luaL_error(L, "Argument error: spans:get(index) takes one argument.");
+	SpanArray* array = *toSpanArray(L, 1);
+	int index = (int)luaL_checknumber(L, 2);
+	if (index < 1 || index > array->count) return luaL_error(L, "index out of the range of the span array");
+	const BlitSpan* span = &array->spans[index - 1];
+	lua_pushnumber(L, span->dx);
+	lua_pushnumber(L, span->dy);
+	lua_pushnumber(L, span->sx);
+	lua_pushnumber(L, span->sy);
+	lua_pushnumber(L, span->width);
+	lua_pushnumber(L, span->height);
+	return 6;
+}
+
+static int SpanArray_count(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: spans:count() takes no arguments.");
+	lua_pushnumber(L, (*toSpanArray(L, 1))->count);
+	return 1;
+}
+
+static int SpanArray_free(lua_State *L)
+{
+	SpanArray* array = *toSpanArray(L, 1);
+	free(array->spans);
+	free(array);
+	return 0;
+}
+
+static int SpanArray_tostring(lua_State *L)
+{
+	lua_pushfstring(L, "SpanArray (%d spans)", (*toSpanArray(L, 1))->count);
+	return 1;
+}
+
+static const luaL_Reg SpanArray_methods[] = {
+	{"new", SpanArray_new},
+	{"set", SpanArray_set},
+	{"get", SpanArray_get},
+	{"count", SpanArray_count},
+	{0,0}
+};
+
+static const luaL_Reg SpanArray_meta[] = {
+	{"__gc", SpanArray_free},
+	{"__tostring", SpanArray_tostring},
+	{0,0}
+};
+
+UserdataRegister(SpanArray, SpanArray_methods, SpanArray_meta)
+
+
+
+
+// width * height colors, stored in the userdata after this header
+typedef struct
+{
+	int width;
+	int height;
+} PixelBuffer;
+
+#define PIXELS(buffer) ((Color*) ((buffer) + 1))
+
+static PixelBuffer* toPixelBuffer(lua_State *L, int arg)
+{
+	return (PixelBuffer*) luaL_checkudata(L, arg, "PixelBuffer");
+}
+
+static PixelBuffer* pushPixelBuffer(lua_State *L, int width, int height)
+{
+	PixelBuffer* buffer = (PixelBuffer*) lua_newuserdatauv(L, sizeof(PixelBuffer) + (size_t) width * height * sizeof(Color), 0);
+	luaL_setmetatable(L, "PixelBuffer");
+	buffer->width = width;
+	buffer->height = height;
+	return buffer;
+}
+
+// PixelBuffer.new(w, h), all pixels are 0
+static int PixelBuffer_new(lua_State *L)
+{
+	if (lua_gettop(L) != 2) return luaL_error(L, "Argument error: PixelBuffer.new(w, h) takes two arguments.");
+	int width = (int)luaL_checknumber(L, 1);
+	int height = (int)luaL_checknumber(L, 2);
+	if (width <= 0 || height <= 0 || width > 512 || height > 512) return luaL_error(L, "invalid size");
+	PixelBuffer* buffer = pushPixelBuffer(L, width, height);
+	memset(PIXELS(buffer), 0, width * height * sizeof(Color));
+	return 1;
+}
+
+static int PixelBuffer_width(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "buffer:width() takes no arguments, and must be called with a colon.");
+	lua_pushinteger(L, toPixelBuffer(L, 1)->width);
+	return 1;
+}
+
+static int PixelBuffer_height(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "buffer:height() takes no arguments, and must be called with a colon.");
+	lua_pushinteger(L, toPixelBuffer(L, 1)->height);
+	return 1;
+}
+
+// buffer[i] is the color of pixel i, counted from 1 row by row, as an integer
+static int PixelBuffer_index(lua_State *L)
+{
+	PixelBuffer* buffer = toPixelBuffer(L, 1);
+	if (lua_isinteger(L, 2)) {
+		lua_Integer i = lua_tointeger(L, 2);
+		if (i < 1 || i > (lua_Integer) buffer->width * buffer->height) return luaL_error(L, "pixel index %d out of range", (int) i);
+		lua_pushinteger(L, PIXELS(buffer)[i - 1]);
+		return 1;
+	}
+	lua_getglobal(L, "PixelBuffer");
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+	return 1;
+}
+
+static int PixelBuffer_newindex(lua_State *L)
+{
+	PixelBuffer* buffer = toPixelBuffer(L, 1);
+	lua_Integer i = luaL_checkinteger(L, 2);
+	if (i < 1 || i > (lua_Integer) buffer->width * buffer->height) return luaL_error(L, "pixel index %d out of range", (int) i);
+	PIXELS(buffer)[i - 1] = checkColor(L, 3);
+	return 0;
+}
+
+static int PixelBuffer_len(lua_State *L)
+{
+	PixelBuffer* buffer = toPixelBuffer(L, 1);
+	lua_pushinteger(L, buffer->width * buffer->height);
+	return 1;
+}
+
+static int PixelBuffer_tostring(lua_State *L)
+{
+	PixelBuffer* buffer = toPixelBuffer(L, 1);
+	lua_pushfstring(L, "PixelBuffer [%d, %d]", buffer->width, buffer->height);
+	return 1;
+}
+
+static const luaL_Reg PixelBuffer_methods[] = {
+	{"new", PixelBuffer_new},
+	{"width", PixelBuffer_width},
+	{"height", PixelBuffer_height},
+	{0,0}
+};
+static const luaL_Reg PixelBuffer_meta[] = {
+	{"__index", PixelBuffer_index},
+	{"__newindex", PixelBuffer_newindex},
+	{"__len", PixelBuffer_len},
+	{"__tostring", PixelBuffer_tostring},
+	{0,0}
+};
+UserdataRegister(PixelBuffer, PixelBuffer_methods, PixelBuffer_meta)
+
+
+
+
 UserdataStubs(Image, Image*) //==========================
+// the image of the userdata at arg, which is NULL after the image was sent to another thread
+Image* checkImage(lua_State *L, int arg)
+{
+	Image* image = *toImage(L, arg);
+	if (!image) luaL_error(L, "the image was sent to another thread");
+	return image;
+}
+
+// the image at arg if takeImage can detach it
+Image* checkSendableImage(lua_State *L, int arg)
+{
+	Image* image = checkImage(L, arg);
+	if (image->parent || image->references > 1) luaL_error(L, "atlases with views and views can't be sent to another thread");
+	return image;
+}
+
+// detaches the image of the userdata at arg, which has to be given back or pushed in another state
+Image* takeImage(lua_State *L, int arg)
+{
+	Image** handle = (Image**) luaL_checkudata(L, arg, "Image");
+	Image* image = checkSendableImage(L, arg);
+	releaseExternalMemory(L, arg);
+	*handle = NULL;
+	return image;
+}
+
+// gives the image back to the userdata at arg, from which it was taken
+void returnImage(lua_State *L, int arg, Image* image)
+{
+	*(Image**) lua_touserdata(L, arg) = image;
+	addExternalMemory(L, arg, getImageMemorySize(image));
+}
+
+// pushes a new userdata for a taken image
+void pushTakenImage(lua_State *L, Image* image)
+{
+	Image** luaImage = pushImage(L);
+	*luaImage = image;
+	addExternalMemory(L, -1, getImageMemorySize(image));
+}
+
 static int Image_createEmpty(lua_State *L)
 {
 	if (lua_gettop(L) != 2) return luaL_error(L, "Argument error: Image.createEmpty(w, h) takes two arguments.");
 	int w = (int)luaL_checknumber(L, 1);
 	int h = (int)luaL_checknumber(L, 2);
 	if (w <= 0 || h <= 0 || w > 512 || h > 512) return luaL_error(L, "invalid size");
-	lua_gc(L, LUA_GCCOLLECT, 0);
 	Image* image = createImage(w, h);
+	if (!image) {
+		// the memory may be held by unreachable images
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		image = createImage(w, h);
+	}
 	if (!image) return luaL_error(L, "can't create image");
 	Image** luaImage = pushImage(L);
 	*luaImage = image;
+	addExternalMemory(L, -1, getImageMemorySize(image));
 	return 1;
 }
+static int Image_createAtlas(lua_State *L)
+{
+	if (lua_gettop(L) != 2) return luaL_error(L, "Argument error: Image.createAtlas(w, h) takes two arguments.");
+	int w = (int)luaL_checknumber(L, 1);
+	int h = (int)luaL_checknumber(L, 2);
+	if (w <= 0 || h <= 0 || w > 512 || h > 512) return luaL_error(L, "invalid size");
+	Image* atlas = createAtlas(w, h);
+	if (!atlas) {
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		atlas = createAtlas(w, h);
+	}
+	if (!atlas) return luaL_error(L, "can't create atlas");
+	Image** luaImage = pushImage(L);
+	*luaImage = atlas;
+	addExternalMemory(L, -1, getImageMemorySize(atlas));
+	return 1;
+}
+
+// atlas:add(image) copies image into the atlas and returns an image which shares its pixels,
+// or nil if the atlas is full
+static int Image_add(lua_State *L)
+{
+	if (lua_gettop(L) != 2) return luaL_error(L, "Argument error: atlas:add(image) takes one argument, and MUST be called with a colon.");
+	if (lua_type(L, 1) != LUA_TUSERDATA || checkImage(L, 1)->skyline == NULL) return luaL_error(L, "atlas:add needs an atlas from Image.createAtlas");
+	if (lua_topointer(L, 2) == theScreen) return luaL_error(L, "the screen can't be added to an atlas");
+	Image* view = addToAtlas(checkImage(L, 1), checkImage(L, 2));
+	if (!view) {
+		lua_pushnil(L);
+		return 1;
+	}
+	Image** luaImage = pushImage(L);
+	*luaImage = view;
+	return 1;
+}
+
 static int Image_load (lua_State *L) {
 	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: Image.load(filename) takes one argument.");
-	lua_gc(L, LUA_GCCOLLECT, 0);
-	Image* image = loadImage(luaL_checkstring(L, 1));
+	const char* filename = luaL_checkstring(L, 1);
+	Image* image = loadImage(filename);
+	if (!image) {
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		image = loadImage(filename);
+	}
 	if(!image) return luaL_error(L, "Image.load: Error loading image.");
 	Image** luaImage = pushImage(L);
 	*luaImage = image;
+	addExternalMemory(L, -1, getImageMemorySize(image));
 	return 1;
 }
 static int Image_loadFromMemory (lua_State *L) {
 	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: Image.load(data) takes one argument.");
-	lua_gc(L, LUA_GCCOLLECT, 0);
 	size_t size;
 	const unsigned char *string = (const unsigned char *) luaL_checklstring(L, 1, &size);
 	Image* image = loadImageFromMemory(string, size);
+	if (!image) {
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		image = loadImageFromMemory(string, size);
+	}
 	if(!image) return luaL_error(L, "Image.load: Error loading image.");
 	Image** luaImage = pushImage(L);
 	*luaImage = image;
+	addExternalMemory(L, -1, getImageMemorySize(image));
+	return 1;
+}
+
+// an image file, which is decoded on the job system (Linux) or right away (PSP)
+typedef struct
+{
+	char* filename;
+	Image* image;  // NULL, if it failed or was taken by get
+	Job* job;      // NULL after it was waited for
+	int retried;   // a failed load was retried on the Lua thread
+} ImageLoad;
+
+UserdataStubs(ImageLoad, ImageLoad*) //==========================
+static void loadImageJob(void* data)
+{
+	ImageLoad* load = (ImageLoad*) data;
+	load->image = loadImage(load->filename);
+}
+
+static ImageLoad* checkImageLoad(lua_State *L, int arg)
+{
+	return *(ImageLoad**) luaL_checkudata(L, arg, "ImageLoad");
+}
+
+static void startImageLoad(lua_State *L, const char* filename)
+{
+	ImageLoad* load = (ImageLoad*) malloc(sizeof(ImageLoad));
+	if (!load) luaL_error(L, "not enough memory for the image load");
+	load->filename = strdup(filename);
+	load->image = NULL;
+	load->job = NULL;
+	load->retried = 0;
+	*pushImageLoad(L) = load;
+#ifdef PLATFORM_LINUX
+	load->job = createJob(loadImageJob, load);
+	submitJob(load->job);
+#else
+	loadImageJob(load);
+#endif
+}
+
+static void waitForImageLoad(ImageLoad* load)
+{
+#ifdef PLATFORM_LINUX
+	if (load->job) {
+		waitForJob(load->job);
+		load->job = NULL;
+	}
+#endif
+}
+
+// waits for the ImageLoad at arg and, if the decoder failed, loads the image once more
+// on this thread, after a full collection, like Image.load. Returns whether there is an image
+static bool finishImageLoad(lua_State *L, int arg, ImageLoad* load)
+{
+	waitForImageLoad(load);
+	if (load->image) return true;
+	bool taken = lua_getiuservalue(L, arg, 1) != LUA_TNIL;
+	lua_pop(L, 1);
+	if (taken) return true;
+	if (!load->retried) {
+		// the decoder may have run out of memory, which a collection may free
+		load->retried = 1;
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		load->image = loadImage(load->filename);
+	}
+	return load->image != NULL;
+}
+
+// Image.loadAsync(filename) starts decoding the image and returns an ImageLoad
+static int Image_loadAsync(lua_State *L) {
+	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: Image.loadAsync(filename) takes one argument.");
+	startImageLoad(L, luaL_checkstring(L, 1));
+	return 1;
+}
+
+// Image.loadMany({filename, ...}) starts decoding all images and returns a table of ImageLoads
+static int Image_loadMany(lua_State *L) {
+	if (lua_gettop(L) != 1) return luaL_error(L, "Argument error: Image.loadMany(filenames) takes one argument.");
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int count = (int)lua_rawlen(L, 1);
+	for (int i = 1; i <= count; i++) {
+		lua_rawgeti(L, 1, i);
+		if (lua_type(L, -1) != LUA_TSTRING) return luaL_error(L, "Image.loadMany: filename %d is not a string", i);
+		lua_pop(L, 1);
+	}
+	lua_createtable(L, count, 0);
+	for (int i = 1; i <= count; i++) {
+		lua_rawgeti(L, 1, i);
+		startImageLoad(L, lua_tostring(L, -1));
+		lua_rawseti(L, -3, i);
+		lua_pop(L, 1);
+	}
+	return 1;
+}
+
+// load:ready() tells without waiting whether the image is decoded
+static int ImageLoad_ready(lua_State *L) {
+	if (lua_gettop(L) != 1) return luaL_error(L, "ImageLoad:ready() takes no arguments, and must be called with a colon.");
+	ImageLoad* load = checkImageLoad(L, 1);
+#ifdef PLATFORM_LINUX
+	lua_pushboolean(L, !load->job || jobFinished(load->job));
+#else
+	lua_pushboolean(L, 1);
+#endif
+	return 1;
+}
+
+// load:wait() waits until the image is decoded and returns whether it could be loaded,
+// which get() then returns
+static int ImageLoad_wait(lua_State *L) {
+	if (lua_gettop(L) != 1) return luaL_error(L, "ImageLoad:wait() takes no arguments, and must be called with a colon.");
+	lua_pushboolean(L, finishImageLoad(L, 1, checkImageLoad(L, 1)));
+	return 1;
+}
+
+// load:get() waits until the image is decoded and returns it, every call the same image.
+// The pixels are handed over without copying
+static int ImageLoad_get(lua_State *L) {
+	if (lua_gettop(L) != 1) return luaL_error(L, "ImageLoad:get() takes no arguments, and must be called with a colon.");
+	ImageLoad* load = checkImageLoad(L, 1);
+	if (lua_getiuservalue(L, 1, 1) != LUA_TNIL) return 1;
+	lua_pop(L, 1);
+	finishImageLoad(L, 1, load);
+	Image* image = load->image;
+	if (!image) return luaL_error(L, "Image.loadAsync: Error loading image %s.", load->filename);
+	load->image = NULL;
+	Image** luaImage = pushImage(L);
+	*luaImage = image;
+	addExternalMemory(L, -1, getImageMemorySize(image));
+	lua_pushvalue(L, -1);
+	lua_setiuservalue(L, 1, 1);
+	return 1;
+}
+
+static int ImageLoad_free(lua_State *L) {
+	ImageLoad* load = *toImageLoad(L, 1);
+	waitForImageLoad(load);
+	if (load->image) freeImage(load->image);
+	free(load->filename);
+	free(load);
+	return 0;
+}
+
+static int ImageLoad_tostring(lua_State *L) {
+	lua_pushfstring(L, "ImageLoad [%s]", checkImageLoad(L, 1)->filename);
 	return 1;
 }
 
+static const luaL_Reg ImageLoad_methods[] = {
+	{"ready", ImageLoad_ready},
+	{"wait", ImageLoad_wait},
+	{"get", ImageLoad_get},
+	{0,0}
+};
+static const luaL_Reg ImageLoad_meta[] = {
+	{"__gc", ImageLoad_free},
+	{"__tostring", ImageLoad_tostring},
+	{0,0}
+};
+UserdataRegister(ImageLoad, ImageLoad_methods, ImageLoad_meta)
 
 
 #define SETDEST \
@@ -280,7 +821,7 @@ static int Image_loadFromMemory (lua_State *L) {
 		int type = lua_type(L, 1); \
 		if (type == LUA_TTABLE) lua_remove(L, 1); \
 		else if (type == LUA_TUSERDATA) { \
-			dest = *toImage(L, 1); \
+			dest = checkImage(L, 1); \
 			lua_remove(L, 1); \
 		} else return luaL_error(L, "Method must be called with a colon!"); \
 	}
@@ -303,7 +844,7 @@ static int Image_blit (lua_State *L) {
 		theScreenImage.data = getVramDrawBuffer();
 		source = &theScreenImage;
 	} else {
-		source = *toImage(L, 3);
+		source = checkImage(L, 3);
 	}
 
 	bool rect = (argc ==8 || argc == 9) ;
@@ -325,10 +866,77 @@ static int Image_blit (lua_State *L) {
 	}
 	return 0;
 }
+
+// image:blitTransformed(source, x, y, angle, scaleX, scaleY, [{pivotX, pivotY}], [Gu.NEAREST or Gu.LINEAR])
+// draws source rotated clockwise by angle (radians) around its pivot, which
+// defaults to the center, with the pivot at x, y
+static int Image_blitTransformed (lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc < 7 || argc > 9) return luaL_error(L, "Argument error: image:blitTransformed(source, x, y, angle, scaleX, scaleY, [pivot], [filter]) takes 6, 7 or 8 arguments, and MUST be called with a colon.");
+
+	SETDEST
+
+	if (lua_topointer(L, 1) == theScreen) return luaL_error(L, "the source of blitTransformed must be an image");
+	Image* source = checkImage(L, 1);
+	ImageTransform transform;
+	transform.x = luaL_checknumber(L, 2);
+	transform.y = luaL_checknumber(L, 3);
+	transform.angle = luaL_checknumber(L, 4);
+	transform.scaleX = luaL_checknumber(L, 5);
+	transform.scaleY = luaL_checknumber(L, 6);
+	if (lua_isnoneornil(L, 7)) {
+		transform.pivotX = source->imageWidth * 0.5f;
+		transform.pivotY = source->imageHeight * 0.5f;
+	} else {
+		luaL_checktype(L, 7, LUA_TTABLE);
+		lua_rawgeti(L, 7, 1);
+		lua_rawgeti(L, 7, 2);
+		transform.pivotX = luaL_checknumber(L, -2);
+		transform.pivotY = luaL_checknumber(L, -1);
+		lua_pop(L, 2);
+	}
+	int filter = (int)luaL_optnumber(L, 8, GU_NEAREST);
+	if (filter != GU_NEAREST && filter != GU_LINEAR) return luaL_error(L, "the filter must be Gu.NEAREST or Gu.LINEAR");
+	transform.linear = filter == GU_LINEAR;
+
+	if (!dest) {
+		blitTransformedImageToScreen(source, &transform);
+	} else {
+		blitTransformedImageToImage(source, &transform, dest);
+	}
+	return 0;
+}
+
+// image:blitBatch(source, spans, [count], [alpha]) blits the first count spans of a SpanArray
+static int Image_blitBatch (lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc < 3 || argc > 5) return luaL_error(L, "Argument error: image:blitBatch(source, spans, [count], [alpha]) takes 2, 3 or 4 arguments, and MUST be called with a colon.");
+
+	bool alpha = true;
+	if (argc > 3 && lua_type(L, argc) == LUA_TBOOLEAN) {
+		alpha = lua_toboolean(L, argc);
+		lua_pop(L, 1);
+	}
+
+	SETDEST
+
+	if (lua_topointer(L, 1) == theScreen) return luaL_error(L, "the source of blitBatch must be an image");
+	Image* source = checkImage(L, 1);
+	SpanArray* array = *(SpanArray**)luaL_checkudata(L, 2, "SpanArray");
+	int count = lua_gettop(L) >= 3 ? (int)luaL_checknumber(L, 3) : array->count;
+	if (count < 0 || count > array->count) return luaL_error(L, "count out of the range of the span array");
+
+	if (!dest) {
+		blitBatchToScreen(array->spans, count, source, alpha);
+	} else {
+		blitBatchToImage(array->spans, count, source, dest, alpha);
+	}
+	return 0;
+}
 static int Image_clear (lua_State *L) {
 	int argc = lua_gettop(L);
 	if(argc != 1 && argc != 2) return luaL_error(L, "Argument error: Image:clear([color]) zero or one argument.");
-	Color color = (argc==2)?*toColor(L, 2):0;
+	Color color = (argc==2)?checkColor(L, 2):0;
 
 	SETDEST
 	if(dest)
@@ -346,7 +954,7 @@ static int Image_fillRect (lua_State *L) {
 	int y0 = (int)luaL_checknumber(L, 2);
 	int width = (int)luaL_checknumber(L, 3);
 	int height = (int)luaL_checknumber(L, 4);
-	Color color = (argc==6)?*toColor(L, 5):0;
+	Color color = (argc==6)?checkColor(L, 5):0;
 	
 	if (width <= 0 || height <= 0) return 0;
 	if (x0 < 0) {
@@ -394,7 +1002,7 @@ static int Image_drawLine (lua_State *L) {
 	int y0 = (int)luaL_checknumber(L, 2);
 	int x1 = (int)luaL_checknumber(L, 3);
 	int y1 = (int)luaL_checknumber(L, 4); 
-	Color color = (argc==6) ? *toColor(L, 5) : 0;
+	Color color = (argc==6) ? checkColor(L, 5) : 0;
 	
 	// TODO: better clipping
 	if (x0 < 0) x0 = 0;
@@ -423,11 +1031,11 @@ static int Image_pixel (lua_State *L) {
 	SETDEST
 	int x = (int)luaL_checknumber(L, 1);
 	int y = (int)luaL_checknumber(L, 2);
-	Color color = (argc == 4)?*toColor(L, 3):0;
+	Color color = (argc == 4)?checkColor(L, 3):0;
 	if(dest) {
 		if (x >= 0 && y >= 0 && x < dest->imageWidth && y < dest->imageHeight) {
 			if(argc==3) {
-				*pushColor(L) = getPixelImage(x, y, dest);
+				pushColorValue(L, getPixelImage(x, y, dest));
 				return 1;
 			} else {
 				putPixelImage(color, x, y, dest);
@@ -437,7 +1045,7 @@ static int Image_pixel (lua_State *L) {
 	} else {
 		if (x >= 0 && y >= 0 && x < SCREEN_WIDTH && y < SCREEN_HEIGHT) {
 			if(argc==3) {
-				*pushColor(L) = getPixelScreen(x, y);
+				pushColorValue(L, getPixelScreen(x, y));
 				return 1;
 			} else {
 				putPixelScreen(color, x, y);
@@ -448,6 +1056,91 @@ static int Image_pixel (lua_State *L) {
 
 	return luaL_error(L, "An argument was incorrect.");
 }
+
+// checks that the rectangle at the 4 arguments from arg is inside of dest, or the screen if NULL
+static void checkRect(lua_State *L, int arg, Image* dest, int* x, int* y, int* width, int* height)
+{
+	*x = (int)luaL_checknumber(L, arg);
+	*y = (int)luaL_checknumber(L, arg + 1);
+	*width = (int)luaL_checknumber(L, arg + 2);
+	*height = (int)luaL_checknumber(L, arg + 3);
+	int maxWidth = dest ? dest->imageWidth : SCREEN_WIDTH;
+	int maxHeight = dest ? dest->imageHeight : SCREEN_HEIGHT;
+	if (*width <= 0 || *height <= 0 || *x < 0 || *y < 0 || *x + *width > maxWidth || *y + *height > maxHeight) {
+		luaL_error(L, "rectangle is not inside of the image");
+	}
+}
+
+// image:readRect(x, y, w, h, [buffer]) returns the pixels as a string of w * h packed colors,
+// or copies them to a PixelBuffer of w x h pixels and returns it
+static int Image_readRect(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 5 && argc != 6) return luaL_error(L, "Image:readRect(x, y, w, h, [buffer]) takes four or five arguments, and must be called with a colon.");
+	SETDEST
+	int x, y, width, height;
+	checkRect(L, 1, dest, &x, &y, &width, &height);
+	Color* pixels;
+	luaL_Buffer string;
+	if (argc == 6) {
+		PixelBuffer* buffer = toPixelBuffer(L, 5);
+		if (buffer->width != width || buffer->height != height) return luaL_error(L, "the buffer must have the size of the rectangle");
+		pixels = PIXELS(buffer);
+		lua_settop(L, 5);
+	} else {
+		pixels = (Color*) luaL_buffinitsize(L, &string, width * height * sizeof(Color));
+	}
+	if (dest) readPixelsImage(x, y, width, height, pixels, dest);
+	else readPixelsScreen(x, y, width, height, pixels);
+	if (argc != 6) luaL_pushresultsize(&string, width * height * sizeof(Color));
+	return 1;
+}
+
+// image:writeRect(x, y, w, h, data) copies w * h packed colors from a string or PixelBuffer
+static int Image_writeRect(lua_State *L) {
+	if (lua_gettop(L) != 6) return luaL_error(L, "Image:writeRect(x, y, w, h, data) takes five arguments, and must be called with a colon.");
+	SETDEST
+	int x, y, width, height;
+	checkRect(L, 1, dest, &x, &y, &width, &height);
+	const Color* pixels;
+	if (lua_type(L, 5) == LUA_TSTRING) {
+		size_t size;
+		pixels = (const Color*) lua_tolstring(L, 5, &size);
+		if (size != width * height * sizeof(Color)) return luaL_error(L, "the data must have 4 bytes per pixel of the rectangle");
+	} else {
+		PixelBuffer* buffer = toPixelBuffer(L, 5);
+		if (buffer->width != width || buffer->height != height) return luaL_error(L, "the buffer must have the size of the rectangle");
+		pixels = PIXELS(buffer);
+	}
+	if (dest) writePixelsImage(pixels, x, y, width, height, dest);
+	else writePixelsScreen(pixels, x, y, width, height);
+	return 0;
+}
+
+// image:parallelGenerate(chunk, [x, y, w, h]) fills the rectangle, or the whole image, on one
+// Lua state per thread of the job system. The chunk returns a function(x, y), which returns an integer color
+static int Image_parallelGenerate(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc != 2 && argc != 6) return luaL_error(L, "Image:parallelGenerate(chunk, [x, y, w, h]) takes one or five arguments, and must be called with a colon.");
+	SETDEST
+	size_t size;
+	const char* chunk = luaL_checklstring(L, 1, &size);
+	int x = 0, y = 0;
+	int width = dest ? dest->imageWidth : SCREEN_WIDTH;
+	int height = dest ? dest->imageHeight : SCREEN_HEIGHT;
+	if (argc == 6) checkRect(L, 2, dest, &x, &y, &width, &height);
+	// the workers fill a buffer, which is copied like by writeRect
+	Color* pixels = (Color*) malloc(width * height * sizeof(Color));
+	if (!pixels) return luaL_error(L, "not enough memory");
+	char error[256];
+	int generated = parallelGenerate(chunk, size, pixels, width, width, height, error, sizeof(error));
+	if (generated) {
+		if (dest) writePixelsImage(pixels, x, y, width, height, dest);
+		else writePixelsScreen(pixels, x, y, width, height);
+	}
+	free(pixels);
+	if (!generated) return luaL_error(L, "Image:parallelGenerate: %s", error);
+	return 0;
+}
 static int Image_print (lua_State *L) {
 	int argc = lua_gettop(L);
 	if (argc != 4 && argc != 5) return luaL_error(L, "wrong number of arguments");
@@ -455,7 +1148,7 @@ static int Image_print (lua_State *L) {
 	int x = (int)luaL_checknumber(L, 1);
 	int y = (int)luaL_checknumber(L, 2);
 	const char* text = luaL_checkstring(L, 3);
-	Color color = (argc == 5)?*toColor(L, 4):0xFF000000;
+	Color color = (argc == 5)?checkColor(L, 4):0xFF000000;
 	if (!dest) {
 		printTextScreen(x, y, text, color);
 	} else {
@@ -472,7 +1165,7 @@ static int Image_fontPrint(lua_State *L) {
 	int x = (int)luaL_checknumber(L, 2);
 	int y = (int)luaL_checknumber(L, 3);
 	const char* text = luaL_checkstring(L, 4);
-	Color color = (argc == 6)?*toColor(L, 5):0xFF000000;
+	Color color = (argc == 6)?checkColor(L, 5):0xFF000000;
 
 	int num_chars = strlen(text);
 	FT_GlyphSlot slot = font->face->glyph;
@@ -523,7 +1216,9 @@ static int Image_save (lua_State *L) {
 }
 
 static int Image_free(lua_State *L) {
-	freeImage(*toImage(L, 1));
+	releaseExternalMemory(L, 1);
+	Image* image = *toImage(L, 1);
+	if (image) freeImage(image);
 	return 0;
 }
 
@@ -534,19 +1229,28 @@ static int Image_tostring (lua_State *L) {
 	int h = (int)luaL_checknumber(L, 2); lua_pop(L, 1);
 
 	char buff[32];
-	sprintf(buff, "%p", *toImage(L, 1));
+	sprintf(buff, "%p", checkImage(L, 1));
 	lua_pushfstring(L, "Image (%s) [%d, %d]", buff, w, h);
 	return 1;
 }
 static const luaL_Reg Image_methods[] = {
 	{"createEmpty", Image_createEmpty},
+	{"createAtlas", Image_createAtlas},
+	{"add", Image_add},
 	{"load", Image_load},
 	{"loadFromMemory", Image_loadFromMemory},
+	{"loadAsync", Image_loadAsync},
+	{"loadMany", Image_loadMany},
 	{"blit", Image_blit},
+	{"blitBatch", Image_blitBatch},
+	{"blitTransformed", Image_blitTransformed},
 	{"clear", Image_clear},
 	{"fillRect", Image_fillRect},
 	{"drawLine", Image_drawLine},
 	{"pixel", Image_pixel},
+	{"readRect", Image_readRect},
+	{"writeRect", Image_writeRect},
+	{"parallelGenerate", Image_parallelGenerate},
 	{"print", Image_print},
 	{"fontPrint", Image_fontPrint},
 	{"width", Image_width},
@@ -568,8 +1272,6 @@ static int Color_new (lua_State *L) {
 	int argc = lua_gettop(L);
 	if (argc != 3 && argc != 4) return luaL_error(L, "Argument error: Color.new(r, g, b, [a]) takes either three color arguments or three color arguments and an alpha value.");
 
-	Color *color = pushColor(L);
-
 	unsigned r = CLAMP((int)luaL_checknumber(L, 1), 0, 255);
 	unsigned g = CLAMP((int)luaL_checknumber(L, 2), 0, 255);
 	unsigned b = CLAMP((int)luaL_checknumber(L, 3), 0, 255);
@@ -581,14 +1283,14 @@ static int Color_new (lua_State *L) {
 	}
 
 	//*color = ((b>>3)<<10) | ((g>>3)<<5) | (r>>3) | (a == 255 ? 0x8000 : 0);
-	*color = a << 24 | b << 16 | g << 8 | r;
+	pushColorValue(L, a << 24 | b << 16 | g << 8 | r);
 	
 	return 1;
 }
 static int Color_colors (lua_State *L) {
 	int argc = lua_gettop(L);
 	if(argc != 1) return luaL_error(L, "Argument error: color:colors() takes no arguments, and it must be called from an instance with a colon.");
-	Color color = *toColor(L, 1);
+	Color color = checkColor(L, 1);
 	int r = R(color); 
 	int g = G(color);
 	int b = B(color);
@@ -614,15 +1316,47 @@ static int Color_tostring (lua_State *L) {
 	return 1;
 }
 
+// Color.equal(a, b) compares two colors by value, each an integer or a Color userdata.
+// == can't do that for mixed types, Lua only calls __eq for two userdata
 static int Color_equal(lua_State *L) {
-	Color a = *toColor(L, 1);
-	Color b = *toColor(L, 2);
+	Color a = checkColor(L, 1);
+	Color b = checkColor(L, 2);
 	lua_pushboolean(L, a == b);
 	return 1;
 }
+// Color.integerMode([enabled]) sets and returns whether Color.new and image:pixel return integers
+static int Color_integerMode(lua_State *L) {
+	int argc = lua_gettop(L);
+	if (argc > 1) return luaL_error(L, "Argument error: Color.integerMode([enabled]) takes zero or one argument.");
+	if (argc == 1) {
+		bool enabled = lua_toboolean(L, 1);
+		bool wasEnabled = integerColors(L);
+		lua_pushboolean(L, enabled);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &integerColorsKey);
+		if (enabled && !wasEnabled) {
+			// color:colors() for integer colors. The metatable is the one of all numbers
+			lua_pushinteger(L, 0);
+			lua_newtable(L);
+			lua_getglobal(L, "Color");
+			lua_setfield(L, -2, "__index");
+			lua_setmetatable(L, -2);
+			lua_pop(L, 1);
+		} else if (!enabled && wasEnabled) {
+			lua_pushinteger(L, 0);
+			lua_pushnil(L);
+			lua_setmetatable(L, -2);
+			lua_pop(L, 1);
+		}
+	}
+	lua_pushboolean(L, integerColors(L));
+	return 1;
+}
+
 static const luaL_Reg Color_methods[] = {
 	{"new", Color_new},
 	{"colors", Color_colors},
+	{"equal", Color_equal},
+	{"integerMode", Color_integerMode},
 	{0,0}
 };
 static const luaL_Reg Color_meta[] = {
@@ -638,9 +1372,22 @@ UserdataRegister(Color, Color_methods, Color_meta)
 static const luaL_Reg Screen_functions[] = {
 	{"flip", lua_flipScreen},
 	{"waitVblankStart", lua_waitVblankStart},
+	{"dirtyRegions", lua_dirtyRegions},
+#ifdef PLATFORM_LINUX
+	{"pacingHistogram", lua_pacingHistogram},
+#endif
 	{0,0}
 };
 
+// the types which need neither the screen nor FreeType, for the states of worker threads
+void luaGraphics_initWorker(lua_State *L) {
+	Image_register(L);
+	SpanArray_register(L);
+	PixelBuffer_register(L);
+	ImageLoad_register(L);
+	Color_register(L);
+}
+
 void luaGraphics_init(lua_State *L) {
 	static bool ftInitialized = false;
 	
@@ -649,8 +1396,7 @@ void luaGraphics_init(lua_State *L) {
 		ftInitialized = true;
 	}
 
-	Image_register(L);
-	Color_register(L);
+	luaGraphics_initWorker(L);
 	Font_register(L);
 	
 	luaL_newlib(L, Screen_functions);
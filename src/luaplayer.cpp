@@ -7,16 +7,57 @@
 
 static lua_State *L;
 
+void addExternalMemory(lua_State *L, int index, size_t bytes)
+{
+	index = lua_absindex(L, index);
+	lua_getiuservalue(L, index, 1);
+	lua_Integer total = lua_tointeger(L, -1) + (lua_Integer) bytes;
+	lua_pop(L, 1);
+	lua_pushinteger(L, total);
+	lua_setiuservalue(L, index, 1);
 
-const char * runScript(const char* script, bool isStringBuffer )
+	// one incremental step with a debt of the new bytes, instead of a full collection
+	lua_gc(L, LUA_GCSTEP, (int) ((bytes + 1023) / 1024));
+}
+
+void releaseExternalMemory(lua_State *L, int index)
+{
+	index = lua_absindex(L, index);
+	lua_getiuservalue(L, index, 1);
+	size_t bytes = (size_t) lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	if (bytes == 0) return;
+	lua_pushinteger(L, 0);
+	lua_setiuservalue(L, index, 1);
+}
+
+
+static lua_State* newState(void)
 {
-	L = luaL_newstate();
+	lua_State* state = luaL_newstate();
 
 	// Standard libraries
-	luaL_openlibs(L);
+	luaL_openlibs(state);
 
 	// Add table.getn for Lua 5.0 compatibility (removed in 5.1+)
-	luaL_dostring(L, "table.getn = function(t) return #t end");
+	luaL_dostring(state, "table.getn = function(t) return #t end");
+	return state;
+}
+
+lua_State* createWorkerState(void)
+{
+	lua_State* state = newState();
+	luaGraphics_initWorker(state);
+	luaTimer_init(state);
+#ifdef PLATFORM_LINUX
+	luaThread_init(state);
+#endif
+	return state;
+}
+
+const char * runScript(const char* script, bool isStringBuffer )
+{
+	L = newState();
 
 	// luasystem.cpp defines our loadlib.
 	// luaopen_loadlib(L);
@@ -29,6 +70,9 @@ const char * runScript(const char* script, bool isStringBuffer )
 	luaTimer_init(L);
 	luaSystem_init(L);
 	luaWlan_init(L);
+#ifdef PLATFORM_LINUX
+	luaThread_init(L);
+#endif
 	
 	int s = 0;
 	const char * errMsg = NULL;
@@ -46,6 +90,10 @@ const char * runScript(const char* script, bool isStringBuffer )
 		printf("error: %s\n", lua_tostring(L, -1));
 		lua_pop(L, 1); // remove error message
 	}
+#ifdef PLATFORM_LINUX
+	// the threads may use images and channels of the script
+	stopThreads();
+#endif
 	lua_close(L);
 	
 	return errMsg;
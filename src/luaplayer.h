@@ -60,9 +60,44 @@ extern void lua3D_init(lua_State *L);
 extern void luaTimer_init(lua_State *L);
 extern void luaSystem_init(lua_State *L);
 extern void luaWlan_init(lua_State *L);
+extern void luaGraphics_initWorker(lua_State *L);
+#ifdef PLATFORM_LINUX
+extern void luaThread_init(lua_State *L);
+
+/**
+ * Stop all threads of Thread.spawn and wait for them, called before the state of the script is closed.
+ */
+extern void stopThreads(void);
+#endif
+
+/**
+ * Create a state for a worker thread, with the standard libraries and the
+ * modules which don't use the screen, controls or sound.
+ *
+ * @return the new state
+ */
+extern lua_State* createWorkerState(void);
 
 extern void stackDump (lua_State *L);
 
+/**
+ * Tell the garbage collector about native memory which the userdata at index
+ * keeps alive, so that big images and sounds are collected as early as the
+ * Lua heap would need it. The bytes are stored in the first user value of the
+ * userdata and given back by releaseExternalMemory.
+ *
+ * @param index - stack index of the userdata
+ * @param bytes - size of the native memory
+ */
+extern void addExternalMemory(lua_State *L, int index, size_t bytes);
+
+/**
+ * Give back the native memory of a userdata, called by its __gc metamethod.
+ *
+ * @param index - stack index of the userdata
+ */
+extern void releaseExternalMemory(lua_State *L, int index);
+
 
 #endif
 
@@ -35,7 +35,6 @@ static int Music_loadAndPlay(lua_State *L)
 	if (!soundFile) return luaL_error(L, "can't open sound file %s.", fullpath);
 	fclose(soundFile);
 	
-	lua_gc(L, LUA_GCCOLLECT, 0);
 	loadAndPlayMusicFile(fullpath, loop);
 	
 	return 0;
@@ -170,11 +169,16 @@ static int Sound_load(lua_State *L) {
 	fclose(soundFile);
 
 	// Create the user object
-	lua_gc(L, LUA_GCCOLLECT, 0);
 	Sound newsound = loadSound(fullpath);
+	if (!newsound) {
+		// the memory may be held by unreachable sounds
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		newsound = loadSound(fullpath);
+	}
 	if (!newsound) return luaL_error(L, "error loading sound");
 	Sound* luaNewsound = pushSound(L);
 	*luaNewsound = newsound;
+	addExternalMemory(L, -1, getSoundMemorySize(newsound));
 	if (doloop) setSoundLooping(newsound, 1, 0, 0);
 	
 	// Note: a userdata object has already been pushed.
@@ -184,6 +188,7 @@ static int Sound_load(lua_State *L) {
 static int Sound_gc(lua_State *L) // garbage collect
 {
 	Sound* handle = toSound(L, 1);
+	releaseExternalMemory(L, 1);
 	unloadSound(*handle);
 	return 0;
 }
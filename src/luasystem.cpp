@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include "luaplayer.h"
+#include "imagepool.h"
 
 static int usbActivated = 0;
 static SceUID sio_fd = -1;
@@ -419,6 +420,72 @@ static int lua_getFreeMemory(lua_State *L)
 	return 1;
 }
 
+static void setField(lua_State *L, const char* name, int value)
+{
+	lua_pushnumber(L, value);
+	lua_setfield(L, -2, name);
+}
+
+// returns a table with the statistics of the pixel memory pool, sizes in bytes
+static int lua_imageMemoryStats(lua_State *L)
+{
+	if (lua_gettop(L) != 0) return luaL_error(L, "no arguments expected.");
+	ImageMemoryStats stats;
+	getImageMemoryStats(&stats);
+	lua_newtable(L);
+	setField(L, "used", stats.used);
+	setField(L, "pooled", stats.pooled);
+	setField(L, "peak", stats.peak);
+	setField(L, "budget", stats.budget);
+	setField(L, "allocations", stats.allocations);
+	setField(L, "reused", stats.reused);
+	// one {size, used, pooled} table per size class
+	lua_newtable(L);
+	for (int i = 0; i < IMAGE_POOL_CLASSES; i++) {
+		lua_newtable(L);
+		setField(L, "size", 64 << i);
+		setField(L, "used", stats.classUsed[i]);
+		setField(L, "pooled", stats.classPooled[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "classes");
+	return 1;
+}
+
+#ifdef PLATFORM_LINUX
+// System.jobStats([reset]) returns one {busy, jobs, steals} table per thread of the job system,
+// busy in milliseconds. With reset true the counters start again at 0
+static int lua_jobStats(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc > 1) return luaL_error(L, "System.jobStats([reset]) takes zero or one argument.");
+	JobWorkerStats stats[JOB_MAX_THREADS];
+	int count = getJobStats(stats, lua_toboolean(L, 1));
+	lua_newtable(L);
+	for (int i = 0; i < count; i++) {
+		lua_newtable(L);
+		lua_pushnumber(L, stats[i].busyMicroseconds / 1000.0);
+		lua_setfield(L, -2, "busy");
+		setField(L, "jobs", stats[i].jobs);
+		setField(L, "steals", stats[i].steals);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+#endif
+
+// System.imageMemoryBudget([bytes]) sets and returns the maximum size of the free buffers in the pool
+static int lua_imageMemoryBudget(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc > 1) return luaL_error(L, "System.imageMemoryBudget([bytes]) takes zero or one argument.");
+	if (argc == 1) setImageMemoryBudget((int)luaL_checknumber(L, 1));
+	ImageMemoryStats stats;
+	getImageMemoryStats(&stats);
+	lua_pushnumber(L, stats.budget);
+	return 1;
+}
+
 static const luaL_Reg System_functions[] = {
   {"currentDirectory",              lua_curdir},
   {"listDirectory",           	    lua_dir},
@@ -447,6 +514,11 @@ static const luaL_Reg System_functions[] = {
   {"irdaWrite",                     lua_irdaWrite},
   {"sleep",                         lua_sleep},
   {"getFreeMemory",                 lua_getFreeMemory},
+  {"imageMemoryStats",              lua_imageMemoryStats},
+  {"imageMemoryBudget",             lua_imageMemoryBudget},
+#ifdef PLATFORM_LINUX
+  {"jobStats",                      lua_jobStats},
+#endif
   {0, 0}
 };
 void luaSystem_init(lua_State *L) {
@@ -0,0 +1,644 @@
+/*
+ * Worker threads and channels (Linux only)
+ *
+ * Thread.spawn runs a file or chunk in a new Lua state on its own thread.
+ * The states share nothing, they exchange values over channels: bounded
+ * lock-free queues, which any number of threads can push to and pop from.
+ * Strings and PixelBuffers are copied, images are moved: the sender's
+ * userdata loses its image and the receiver gets the pixels without a copy.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "luaplayer.h"
+#include "graphics.h"
+
+extern Image* checkSendableImage(lua_State *L, int arg);
+extern Image* takeImage(lua_State *L, int arg);
+extern void returnImage(lua_State *L, int arg, Image* image);
+extern void pushTakenImage(lua_State *L, Image* image);
+
+#define DEFAULT_CAPACITY 64
+#define MAX_CAPACITY 65536
+
+// instructions between the checks whether a thread has to stop
+#define STOP_CHECK_INSTRUCTIONS 1000
+
+enum {
+	MESSAGE_NIL,
+	MESSAGE_BOOLEAN,
+	MESSAGE_INTEGER,
+	MESSAGE_NUMBER,
+	MESSAGE_STRING,
+	MESSAGE_BUFFER,
+	MESSAGE_IMAGE,
+	MESSAGE_CHANNEL
+};
+
+struct Channel;
+
+typedef struct
+{
+	int type;
+	union {
+		int boolean;
+		lua_Integer integer;
+		lua_Number number;
+		struct {
+			char* data;
+			size_t size;
+		} bytes;  // MESSAGE_STRING and MESSAGE_BUFFER, the whole PixelBuffer userdata
+		Image* image;
+		struct Channel* channel;
+	};
+} Message;
+
+typedef struct
+{
+	// the position of the last push which may use the cell, plus one if it holds a message
+	std::atomic<unsigned int> sequence;
+	Message message;
+} Cell;
+
+typedef struct Channel
+{
+	std::atomic<int> references;
+	unsigned int mask;
+	Cell* cells;
+	// on separate cache lines, pushing and popping threads don't slow each other down
+	char pushPadding[64];
+	std::atomic<unsigned int> pushPosition;
+	char popPadding[64];
+	std::atomic<unsigned int> popPosition;
+} Channel;
+
+typedef struct ThreadInfo
+{
+	pthread_t thread;
+	std::atomic<int> references;  // the handle and the list of threads
+	std::atomic<int> finished;
+	std::atomic<int> stop;
+	int joined;
+	pthread_mutex_t joinMutex;
+	char* source;
+	size_t size;
+	int isFile;
+	Message* arguments;
+	int argumentCount;
+	char* error;  // the error of a failed thread, NULL otherwise
+	struct ThreadInfo* next;
+} ThreadInfo;
+
+// all threads which are not joined by stopThreads yet
+static ThreadInfo* threads = NULL;
+static pthread_mutex_t threadsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// the thread of the calling state, NULL for the main thread
+static thread_local ThreadInfo* currentThread = NULL;
+
+static void freeMessage(Message* message)
+{
+	switch (message->type) {
+	case MESSAGE_STRING:
+	case MESSAGE_BUFFER:
+		free(message->bytes.data);
+		break;
+	case MESSAGE_IMAGE:
+		freeImage(message->image);
+		break;
+	case MESSAGE_CHANNEL:
+		if (--message->channel->references == 0) {
+			// no state refers to the channel, free the messages left in it
+			Channel* channel = message->channel;
+			for (unsigned int i = channel->popPosition; i != channel->pushPosition; i++) {
+				freeMessage(&channel->cells[i & channel->mask].message);
+			}
+			delete[] channel->cells;
+			delete channel;
+		}
+		break;
+	}
+	message->type = MESSAGE_NIL;
+}
+
+static void releaseChannel(Channel* channel)
+{
+	Message message;
+	message.type = MESSAGE_CHANNEL;
+	message.channel = channel;
+	freeMessage(&message);
+}
+
+static void releaseThread(ThreadInfo* info)
+{
+	if (--info->references > 0) return;
+	free(info->source);
+	for (int i = 0; i < info->argumentCount; i++) freeMessage(&info->arguments[i]);
+	free(info->arguments);
+	free(info->error);
+	pthread_mutex_destroy(&info->joinMutex);
+	delete info;
+}
+
+static Channel** toChannel(lua_State *L, int arg)
+{
+	return (Channel**) luaL_checkudata(L, arg, "Channel");
+}
+
+static void pushChannel(lua_State *L, Channel* channel)
+{
+	Channel** handle = (Channel**) lua_newuserdatauv(L, sizeof(Channel*), 0);
+	luaL_setmetatable(L, "Channel");
+	*handle = channel;
+}
+
+// raises the error of toMessage if the value at arg can't be sent
+static void checkMessage(lua_State *L, int arg)
+{
+	switch (lua_type(L, arg)) {
+	case LUA_TNIL:
+	case LUA_TBOOLEAN:
+	case LUA_TNUMBER:
+	case LUA_TSTRING:
+		return;
+	case LUA_TUSERDATA:
+		if (luaL_testudata(L, arg, "PixelBuffer") || luaL_testudata(L, arg, "Channel")) return;
+		if (luaL_testudata(L, arg, "Image")) {
+			checkSendableImage(L, arg);
+			return;
+		}
+		break;
+	}
+	luaL_error(L, "only nil, booleans, numbers, strings, PixelBuffers, images and channels can be sent, not %s", luaL_typename(L, arg));
+}
+
+// converts the value at arg, an image is taken from its userdata
+static void toMessage(lua_State *L, int arg, Message* message)
+{
+	switch (lua_type(L, arg)) {
+	case LUA_TNIL:
+		message->type = MESSAGE_NIL;
+		return;
+	case LUA_TBOOLEAN:
+		message->type = MESSAGE_BOOLEAN;
+		message->boolean = lua_toboolean(L, arg);
+		return;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, arg)) {
+			message->type = MESSAGE_INTEGER;
+			message->integer = lua_tointeger(L, arg);
+		} else {
+			message->type = MESSAGE_NUMBER;
+			message->number = lua_tonumber(L, arg);
+		}
+		return;
+	case LUA_TSTRING: {
+		size_t size;
+		const char* string = lua_tolstring(L, arg, &size);
+		message->bytes.data = (char*) malloc(size ? size : 1);
+		if (!message->bytes.data) luaL_error(L, "not enough memory");
+		memcpy(message->bytes.data, string, size);
+		message->bytes.size = size;
+		message->type = MESSAGE_STRING;
+		return;
+	}
+	case LUA_TUSERDATA:
+		if (luaL_testudata(L, arg, "PixelBuffer")) {
+			size_t size = lua_rawlen(L, arg);
+			message->bytes.data = (char*) malloc(size);
+			if (!message->bytes.data) luaL_error(L, "not enough memory");
+			memcpy(message->bytes.data, lua_touserdata(L, arg), size);
+			message->bytes.size = size;
+			message->type = MESSAGE_BUFFER;
+			return;
+		}
+		if (luaL_testudata(L, arg, "Channel")) {
+			message->channel = *toChannel(L, arg);
+			message->channel->references++;
+			message->type = MESSAGE_CHANNEL;
+			return;
+		}
+		if (luaL_testudata(L, arg, "Image")) {
+			message->image = takeImage(L, arg);
+			message->type = MESSAGE_IMAGE;
+			return;
+		}
+		break;
+	}
+	checkMessage(L, arg);
+}
+
+// pushes the value of a message and frees it
+static void pushMessage(lua_State *L, Message* message)
+{
+	switch (message->type) {
+	case MESSAGE_NIL: lua_pushnil(L); break;
+	case MESSAGE_BOOLEAN: lua_pushboolean(L, message->boolean); break;
+	case MESSAGE_INTEGER: lua_pushinteger(L, message->integer); break;
+	case MESSAGE_NUMBER: lua_pushnumber(L, message->number); break;
+	case MESSAGE_STRING: lua_pushlstring(L, message->bytes.data, message->bytes.size); break;
+	case MESSAGE_BUFFER:
+		memcpy(lua_newuserdatauv(L, message->bytes.size, 0), message->bytes.data, message->bytes.size);
+		luaL_setmetatable(L, "PixelBuffer");
+		break;
+	case MESSAGE_IMAGE:
+		pushTakenImage(L, message->image);
+		message->type = MESSAGE_NIL;
+		return;
+	case MESSAGE_CHANNEL:
+		pushChannel(L, message->channel);
+		message->type = MESSAGE_NIL;
+		return;
+	}
+	freeMessage(message);
+}
+
+static Channel* createChannel(unsigned int capacity)
+{
+	unsigned int size = 2;
+	while (size < capacity) size <<= 1;
+	Channel* channel = new Channel;
+	channel->references = 1;
+	channel->mask = size - 1;
+	channel->cells = new Cell[size];
+	for (unsigned int i = 0; i < size; i++) channel->cells[i].sequence.store(i, std::memory_order_relaxed);
+	channel->pushPosition.store(0, std::memory_order_relaxed);
+	channel->popPosition.store(0, std::memory_order_relaxed);
+	return channel;
+}
+
+// moves the message into the channel, returns 0 if the channel is full
+static int pushToChannel(Channel* channel, Message* message)
+{
+	unsigned int position = channel->pushPosition.load(std::memory_order_relaxed);
+	for (;;) {
+		Cell* cell = &channel->cells[position & channel->mask];
+		unsigned int sequence = cell->sequence.load(std::memory_order_acquire);
+		int difference = (int) (sequence - position);
+		if (difference == 0) {
+			if (channel->pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				cell->message = *message;
+				cell->sequence.store(position + 1, std::memory_order_release);
+				return 1;
+			}
+		} else if (difference < 0) {
+			return 0;
+		} else {
+			position = channel->pushPosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+// moves the oldest message out of the channel, returns 0 if the channel is empty
+static int popFromChannel(Channel* channel, Message* message)
+{
+	unsigned int position = channel->popPosition.load(std::memory_order_relaxed);
+	for (;;) {
+		Cell* cell = &channel->cells[position & channel->mask];
+		unsigned int sequence = cell->sequence.load(std::memory_order_acquire);
+		int difference = (int) (sequence - (position + 1));
+		if (difference == 0) {
+			if (channel->popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				*message = cell->message;
+				cell->sequence.store(position + channel->mask + 1, std::memory_order_release);
+				return 1;
+			}
+		} else if (difference < 0) {
+			return 0;
+		} else {
+			position = channel->popPosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+static clock_t getMilliseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return clock_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+// whether the thread of the calling state has to stop, because the script ends
+static int stopping(void)
+{
+	return currentThread && currentThread->stop;
+}
+
+// sleeps a bit while waiting, returns 0 when the time is up or the thread has to stop
+static int waitMore(clock_t deadline, int forever)
+{
+	if (stopping()) return 0;
+	if (!forever && getMilliseconds() >= deadline) return 0;
+	usleep(100);
+	return 1;
+}
+
+// Channel.new([capacity]), the capacity is rounded up to a power of two
+static int Channel_new(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc > 1) return luaL_error(L, "Argument error: Channel.new([capacity]) takes zero or one argument.");
+	int capacity = argc == 1 ? (int)luaL_checknumber(L, 1) : DEFAULT_CAPACITY;
+	if (capacity < 1 || capacity > MAX_CAPACITY) return luaL_error(L, "invalid capacity");
+	pushChannel(L, createChannel(capacity));
+	return 1;
+}
+
+// channel:push(value, [timeout]) returns false if the channel is full for timeout ms, -1 waits forever
+static int Channel_push(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc != 2 && argc != 3) return luaL_error(L, "channel:push(value, [timeout]) takes one or two arguments, and must be called with a colon.");
+	Channel* channel = *toChannel(L, 1);
+	int timeout = argc == 3 ? (int)luaL_checknumber(L, 3) : 0;
+	clock_t deadline = getMilliseconds() + (timeout > 0 ? timeout : 0);
+	Message message;
+	toMessage(L, 2, &message);
+	int pushed = pushToChannel(channel, &message);
+	while (!pushed && waitMore(deadline, timeout < 0)) pushed = pushToChannel(channel, &message);
+	if (!pushed) {
+		// the image wasn't sent, it goes back to its userdata
+		if (message.type == MESSAGE_IMAGE) {
+			returnImage(L, 2, message.image);
+			message.type = MESSAGE_NIL;
+		}
+		freeMessage(&message);
+		if (stopping()) return luaL_error(L, "thread stopped");
+	}
+	lua_pushboolean(L, pushed);
+	return 1;
+}
+
+// channel:pop([timeout]) returns true and the oldest value, or false if the channel is empty for timeout ms
+static int Channel_pop(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc != 1 && argc != 2) return luaL_error(L, "channel:pop([timeout]) takes zero or one argument, and must be called with a colon.");
+	Channel* channel = *toChannel(L, 1);
+	int timeout = argc == 2 ? (int)luaL_checknumber(L, 2) : 0;
+	clock_t deadline = getMilliseconds() + (timeout > 0 ? timeout : 0);
+	Message message;
+	while (!popFromChannel(channel, &message)) {
+		if (!waitMore(deadline, timeout < 0)) {
+			if (stopping()) return luaL_error(L, "thread stopped");
+			lua_pushboolean(L, 0);
+			return 1;
+		}
+	}
+	lua_pushboolean(L, 1);
+	pushMessage(L, &message);
+	return 2;
+}
+
+// channel:count() returns the number of values in the channel, which other threads may change
+static int Channel_count(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "channel:count() takes no arguments, and must be called with a colon.");
+	Channel* channel = *toChannel(L, 1);
+	lua_pushinteger(L, (int) (channel->pushPosition.load() - channel->popPosition.load()));
+	return 1;
+}
+
+static int Channel_free(lua_State *L)
+{
+	releaseChannel(*toChannel(L, 1));
+	return 0;
+}
+
+static int Channel_tostring(lua_State *L)
+{
+	lua_pushfstring(L, "Channel (%p)", *toChannel(L, 1));
+	return 1;
+}
+
+static const luaL_Reg Channel_methods[] = {
+	{"new", Channel_new},
+	{"push", Channel_push},
+	{"pop", Channel_pop},
+	{"count", Channel_count},
+	{0,0}
+};
+static const luaL_Reg Channel_meta[] = {
+	{"__gc", Channel_free},
+	{"__tostring", Channel_tostring},
+	{0,0}
+};
+
+static int Channel_register(lua_State *L)
+{
+	luaL_newmetatable(L, "Channel");
+	luaL_setfuncs(L, Channel_meta, 0);
+	luaL_newlib(L, Channel_methods);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -3, "__index");
+	lua_setglobal(L, "Channel");
+	lua_pop(L, 1);
+	return 1;
+}
+
+
+
+static void stopHook(lua_State *L, lua_Debug *ar)
+{
+	if (stopping()) luaL_error(L, "thread stopped");
+}
+
+static void* runThread(void* arg)
+{
+	ThreadInfo* info = (ThreadInfo*) arg;
+	currentThread = info;
+	lua_State* L = createWorkerState();
+	lua_sethook(L, stopHook, LUA_MASKCOUNT, STOP_CHECK_INSTRUCTIONS);
+
+	int error;
+	if (info->isFile) error = luaL_loadfile(L, info->source);
+	else error = luaL_loadbuffer(L, info->source, info->size, "=Thread.spawn");
+	if (!error) {
+		for (int i = 0; i < info->argumentCount; i++) pushMessage(L, &info->arguments[i]);
+		error = lua_pcall(L, info->argumentCount, 0, 0);
+	}
+	if (error) {
+		const char* message = lua_tostring(L, -1);
+		info->error = strdup(message ? message : "unknown error");
+		printf("thread error: %s\n", info->error);
+	}
+	lua_close(L);
+	info->finished = 1;
+	return NULL;
+}
+
+static void joinThread(ThreadInfo* info)
+{
+	pthread_mutex_lock(&info->joinMutex);
+	if (!info->joined) {
+		pthread_join(info->thread, NULL);
+		info->joined = 1;
+	}
+	pthread_mutex_unlock(&info->joinMutex);
+}
+
+// removes the threads which are joined or finished from the list
+static void pruneThreads(void)
+{
+	pthread_mutex_lock(&threadsMutex);
+	ThreadInfo** link = &threads;
+	while (*link) {
+		ThreadInfo* info = *link;
+		if (info->finished) {
+			*link = info->next;
+			joinThread(info);
+			releaseThread(info);
+		} else {
+			link = &info->next;
+		}
+	}
+	pthread_mutex_unlock(&threadsMutex);
+}
+
+void stopThreads(void)
+{
+	pthread_mutex_lock(&threadsMutex);
+	ThreadInfo* list = threads;
+	threads = NULL;
+	for (ThreadInfo* info = list; info; info = info->next) info->stop = 1;
+	pthread_mutex_unlock(&threadsMutex);
+
+	while (list) {
+		ThreadInfo* info = list;
+		list = info->next;
+		joinThread(info);
+		releaseThread(info);
+	}
+}
+
+static ThreadInfo** toThread(lua_State *L, int arg)
+{
+	return (ThreadInfo**) luaL_checkudata(L, arg, "Thread");
+}
+
+// Thread.spawn(fileOrChunk, ...) runs a Lua file, or else a chunk, with the values as arguments
+static int Thread_spawn(lua_State *L)
+{
+	int argc = lua_gettop(L);
+	if (argc < 1) return luaL_error(L, "Argument error: Thread.spawn(fileOrChunk, ...) takes at least one argument.");
+	size_t size;
+	const char* source = luaL_checklstring(L, 1, &size);
+	pruneThreads();
+
+	ThreadInfo* info = new ThreadInfo;
+	info->references = 1;  // the handle frees the info if an argument can't be sent
+	info->finished = 0;
+	info->stop = 0;
+	info->joined = 0;
+	pthread_mutex_init(&info->joinMutex, NULL);
+	info->source = (char*) malloc(size + 1);
+	memcpy(info->source, source, size + 1);
+	info->size = size;
+	info->isFile = access(source, R_OK) == 0;
+	info->arguments = (Message*) calloc(argc, sizeof(Message));
+	info->argumentCount = 0;
+	info->error = NULL;
+	ThreadInfo** handle = (ThreadInfo**) lua_newuserdatauv(L, sizeof(ThreadInfo*), 0);
+	*handle = info;
+	luaL_setmetatable(L, "Thread");
+
+	// an error after an image was taken would free it with the handle, so all
+	// arguments are checked first and the images, which can't fail, are taken last
+	for (int i = 2; i <= argc; i++) checkMessage(L, i);
+	info->argumentCount = argc - 1;
+	for (int i = 2; i <= argc; i++) {
+		if (!luaL_testudata(L, i, "Image")) toMessage(L, i, &info->arguments[i - 2]);
+	}
+	for (int i = 2; i <= argc; i++) {
+		if (luaL_testudata(L, i, "Image")) toMessage(L, i, &info->arguments[i - 2]);
+	}
+
+	pthread_mutex_lock(&threadsMutex);
+	if (pthread_create(&info->thread, NULL, runThread, info) != 0) {
+		pthread_mutex_unlock(&threadsMutex);
+		// the images go back to their userdata
+		for (int i = 2; i <= argc; i++) {
+			Message* message = &info->arguments[i - 2];
+			if (message->type == MESSAGE_IMAGE) {
+				returnImage(L, i, message->image);
+				message->type = MESSAGE_NIL;
+			}
+		}
+		return luaL_error(L, "can't create thread");
+	}
+	info->references++;
+	info->next = threads;
+	threads = info;
+	pthread_mutex_unlock(&threadsMutex);
+	return 1;
+}
+
+// thread:join() waits for the thread and returns true, or false and the error message
+static int Thread_join(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "thread:join() takes no arguments, and must be called with a colon.");
+	ThreadInfo* info = *toThread(L, 1);
+	while (!info->finished && waitMore(0, 1)) {}
+	if (stopping()) return luaL_error(L, "thread stopped");
+	joinThread(info);
+	lua_pushboolean(L, info->error == NULL);
+	if (!info->error) return 1;
+	lua_pushstring(L, info->error);
+	return 2;
+}
+
+// thread:running() returns whether the thread is still running
+static int Thread_running(lua_State *L)
+{
+	if (lua_gettop(L) != 1) return luaL_error(L, "thread:running() takes no arguments, and must be called with a colon.");
+	lua_pushboolean(L, !(*toThread(L, 1))->finished);
+	return 1;
+}
+
+static int Thread_free(lua_State *L)
+{
+	releaseThread(*toThread(L, 1));
+	return 0;
+}
+
+static int Thread_tostring(lua_State *L)
+{
+	lua_pushfstring(L, "Thread (%p)", *toThread(L, 1));
+	return 1;
+}
+
+static const luaL_Reg Thread_methods[] = {
+	{"spawn", Thread_spawn},
+	{"join", Thread_join},
+	{"running", Thread_running},
+	{0,0}
+};
+static const luaL_Reg Thread_meta[] = {
+	{"__gc", Thread_free},
+	{"__tostring", Thread_tostring},
+	{0,0}
+};
+
+static int Thread_register(lua_State *L)
+{
+	luaL_newmetatable(L, "Thread");
+	luaL_setfuncs(L, Thread_meta, 0);
+	luaL_newlib(L, Thread_methods);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -3, "__index");
+	lua_setglobal(L, "Thread");
+	lua_pop(L, 1);
+	return 1;
+}
+
+void luaThread_init(lua_State *L)
+{
+	Channel_register(L);
+	Thread_register(L);
+}
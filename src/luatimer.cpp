@@ -20,7 +20,14 @@ UserdataStubs(Timer, Timer*)
 
 static clock_t getCurrentMilliseconds()
 {
+#ifdef PLATFORM_LINUX
+	// clock() counts the CPU time of all threads of the process on Linux
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return clock_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+#else
 	return clock() / clock_t(CLOCKS_PER_SEC / 1000);
+#endif
 }
 
 static int Timer_new(lua_State *L)
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef PLATFORM_LINUX
+#include <pthread.h>
+#include <atomic>
+#endif
+
+#include "luaplayer.h"
+#include "parallel.h"
+
+// rows a worker takes at once, small enough to balance uneven rows
+#define BAND_HEIGHT 4
+
+typedef struct
+{
+	lua_State* state;
+	int failed;
+	char error[256];
+} Worker;
+
+static Worker workers[PARALLEL_MAX_WORKERS];
+static int workerCount = 0;
+#ifdef PLATFORM_LINUX
+// threads of Thread.spawn may generate images too, one call runs at a time
+static pthread_mutex_t generateMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// the job of the current call
+static const char* jobChunk;
+static size_t jobSize;
+static Color* jobPixels;
+static int jobStride;
+static int jobWidth;
+static int jobHeight;
+#ifdef PLATFORM_LINUX
+static std::atomic<int> nextBand(0);
+static std::atomic<int> jobFailed(0);
+#else
+// the calling thread is the only worker
+static int nextBand = 0;
+static int jobFailed = 0;
+#endif
+
+// the first row of the next band
+static int takeBand(void)
+{
+#ifdef PLATFORM_LINUX
+	return nextBand.fetch_add(BAND_HEIGHT);
+#else
+	int y = nextBand;
+	nextBand += BAND_HEIGHT;
+	return y;
+#endif
+}
+
+int getParallelWorkers(void)
+{
+	if (workerCount == 0) {
+#ifdef PLATFORM_LINUX
+		workerCount = getJobThreads();
+#endif
+		if (workerCount < 1) workerCount = 1;
+		if (workerCount > PARALLEL_MAX_WORKERS) workerCount = PARALLEL_MAX_WORKERS;
+	}
+	return workerCount;
+}
+
+static void fail(Worker* worker, const char* message)
+{
+	snprintf(worker->error, sizeof(worker->error), "%s", message ? message : "unknown error");
+	worker->failed = 1;
+	jobFailed = 1;
+}
+
+// runs the chunk, then fills bands of rows until all are taken, or a worker failed
+static void* generateBands(void* arg)
+{
+	Worker* worker = (Worker*) arg;
+	if (!worker->state) {
+		worker->state = luaL_newstate();
+		luaL_openlibs(worker->state);
+	}
+	lua_State* L = worker->state;
+	lua_settop(L, 0);
+	if (luaL_loadbuffer(L, jobChunk, jobSize, "=parallelGenerate") || lua_pcall(L, 0, 1, 0)) {
+		fail(worker, lua_tostring(L, -1));
+		return NULL;
+	}
+	if (lua_type(L, 1) != LUA_TFUNCTION) {
+		fail(worker, "the chunk must return a function");
+		return NULL;
+	}
+
+	for (;;) {
+		int y0 = takeBand();
+		if (y0 >= jobHeight || jobFailed) break;
+		int y1 = y0 + BAND_HEIGHT < jobHeight ? y0 + BAND_HEIGHT : jobHeight;
+		for (int y = y0; y < y1; y++) {
+			Color* row = jobPixels + y * jobStride;
+			for (int x = 0; x < jobWidth; x++) {
+				lua_pushvalue(L, 1);
+				lua_pushinteger(L, x);
+				lua_pushinteger(L, y);
+				if (lua_pcall(L, 2, 1, 0)) {
+					fail(worker, lua_tostring(L, -1));
+					return NULL;
+				}
+				int isInteger;
+				lua_Integer color = lua_tointegerx(L, -1, &isInteger);
+				if (!isInteger) {
+					fail(worker, "the function must return an integer color");
+					return NULL;
+				}
+				row[x] = (Color) color;
+				lua_pop(L, 1);
+			}
+		}
+	}
+	return NULL;
+}
+
+#ifdef PLATFORM_LINUX
+// one job per worker state, so that no state runs on two threads
+static void generateJob(void* data, int begin, int end)
+{
+	for (int i = begin; i < end; i++) generateBands(&workers[i]);
+}
+#endif
+
+int parallelGenerate(const char* chunk, size_t size, Color* pixels, int stride, int width, int height, char* error, int errorSize)
+{
+#ifdef PLATFORM_LINUX
+	pthread_mutex_lock(&generateMutex);
+#endif
+	int count = getParallelWorkers();
+	jobChunk = chunk;
+	jobSize = size;
+	jobPixels = pixels;
+	jobStride = stride;
+	jobWidth = width;
+	jobHeight = height;
+	nextBand = 0;
+	jobFailed = 0;
+	for (int i = 0; i < count; i++) workers[i].failed = 0;
+
+#ifdef PLATFORM_LINUX
+	parallelFor(0, count, 1, generateJob, NULL);
+#else
+	generateBands(&workers[0]);
+#endif
+
+	int failed = 0;
+	for (int i = 0; i < count && !failed; i++) {
+		if (workers[i].failed) {
+			snprintf(error, errorSize, "%s", workers[i].error);
+			failed = 1;
+		}
+	}
+#ifdef PLATFORM_LINUX
+	pthread_mutex_unlock(&generateMutex);
+#endif
+	return !failed;
+}
@@ -0,0 +1,37 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include "platform/platform.h"
+
+// the most worker states of parallelGenerate
+#define PARALLEL_MAX_WORKERS 16
+
+/**
+ * Fill a rectangle of pixels with a Lua chunk on the threads of the job
+ * system. Every worker has its own Lua state, in which the chunk is run once. It
+ * has to return a function, which is called with the x and y coordinates of
+ * every pixel, relative to the rectangle, and returns its color as an
+ * integer in ABGR layout. The workers take bands of rows until all rows are
+ * done. The states are kept for the next call, so globals set by a chunk
+ * stay alive.
+ *
+ * @pre chunk != NULL && pixels != NULL && width > 0 && height > 0
+ * @param chunk - source or precompiled code of the chunk
+ * @param size - size of the chunk in bytes
+ * @param pixels - top left pixel of the rectangle
+ * @param stride - distance of the rows in pixels
+ * @param width - width of the rectangle
+ * @param height - height of the rectangle
+ * @param error - receives the message of the first error
+ * @param errorSize - size of error in bytes
+ * @return 1 on success, 0 on an error
+ */
+extern int parallelGenerate(const char* chunk, size_t size, Color* pixels, int stride, int width, int height, char* error, int errorSize);
+
+/**
+ * @return the number of worker states parallelGenerate uses, one per thread of the job system
+ */
+extern int getParallelWorkers(void);
+
+#endif
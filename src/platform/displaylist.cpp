@@ -0,0 +1,270 @@
+/*
+ * Display lists of the software GE
+ *
+ * Between sceGuStart and sceGuFinish the GU functions don't execute, they
+ * append commands to a list, which sceGuFinish replays in one batch. While
+ * recording, a state command is dropped if it sets the same values as the
+ * last recorded command for that state. At replay, sprites which continue
+ * each other, like the slices of blitAlphaImageToScreen, are merged into
+ * one sprite, so that the frame buffer is traversed only once.
+ *
+ * sceGuStart gets no size for the list, so the commands are recorded in a
+ * growing array instead of the list of the caller. sceGuGetMemory returns
+ * memory from blocks which are reused only by the next list.
+ */
+
+#include "softgu.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#define MEMORY_BLOCK_SIZE (64 * 1024)
+
+typedef struct MemoryBlock {
+    struct MemoryBlock* next;
+    int size;
+    int used;
+    u8* data;
+} MemoryBlock;
+
+static Command* g_commands = NULL;
+static int g_command_count = 0;
+static int g_command_capacity = 0;
+static Command g_new_command;
+static int g_recording = 0;
+static int g_replaying = 0;
+
+static MemoryBlock* g_first_block = NULL;
+static MemoryBlock* g_current_block = NULL;
+
+/*
+ * The last recorded command of every state. Commands for the same op with
+ * an index, like the light number, have one slot per index.
+ */
+static const int g_state_slots[CMD_COUNT] = {
+    1,                       /* CMD_CLEAR_COLOR */
+    1,                       /* CMD_CLEAR_DEPTH */
+    0,                       /* CMD_CLEAR */
+    1,                       /* CMD_OFFSET */
+    1,                       /* CMD_VIEWPORT */
+    1,                       /* CMD_DEPTH_RANGE */
+    1,                       /* CMD_SCISSOR */
+    32,                      /* CMD_ENABLE, per state */
+    1,                       /* CMD_ALPHA_FUNC */
+    1,                       /* CMD_DEPTH_FUNC */
+    1,                       /* CMD_FRONT_FACE */
+    1,                       /* CMD_SHADE_MODEL */
+    1,                       /* CMD_BLEND_FUNC */
+    1,                       /* CMD_TEX_MODE */
+    1,                       /* CMD_TEX_FUNC */
+    1,                       /* CMD_TEX_FILTER */
+    RASTER_TEXTURE_LEVELS,   /* CMD_TEX_IMAGE, per level */
+    1,                       /* CMD_TEX_SCALE */
+    1,                       /* CMD_TEX_OFFSET */
+    1,                       /* CMD_TEX_ENV_COLOR */
+    0,                       /* CMD_COPY_IMAGE */
+    0,                       /* CMD_DRAW_ARRAY */
+    0,                       /* CMD_MATRICES */
+    1,                       /* CMD_AMBIENT_COLOR */
+    1,                       /* CMD_AMBIENT */
+    4,                       /* CMD_LIGHT, per light */
+    4,                       /* CMD_LIGHT_ATT */
+    4,                       /* CMD_LIGHT_COLOR */
+    4,                       /* CMD_LIGHT_SPOT */
+    0,                       /* CMD_TEX_ALPHA_RUNS, reset by every sceGuFinish */
+};
+
+#define STATE_SLOT_COUNT 128
+
+static Command g_state[STATE_SLOT_COUNT];
+static int g_state_offset[CMD_COUNT];
+static int g_state_valid = 0;  /* g_state and g_state_offset are set up */
+
+static void invalidateStates(void)
+{
+    if (!g_state_valid) {
+        int offset = 0;
+        for (int op = 0; op < CMD_COUNT; op++) {
+            g_state_offset[op] = offset;
+            offset += g_state_slots[op];
+        }
+    }
+    /* op -1 matches no command */
+    for (int i = 0; i < STATE_SLOT_COUNT; i++) g_state[i].op = -1;
+    g_state_valid = 1;
+}
+
+Command* newCommand(int op)
+{
+    if (g_replaying) return NULL;
+    if (!g_recording) {
+        /* a state changed outside of a list, the recorded states may be wrong */
+        invalidateStates();
+        return NULL;
+    }
+    memset(&g_new_command, 0, sizeof(Command));
+    g_new_command.op = op;
+    return &g_new_command;
+}
+
+void recordCommand(Command* command)
+{
+    int slots = g_state_slots[command->op];
+    if (slots > 0) {
+        int index = slots > 1 ? command->args[0].i : 0;
+        if (index >= 0 && index < slots) {
+            Command* state = &g_state[g_state_offset[command->op] + index];
+            if (memcmp(state, command, sizeof(Command)) == 0) return;
+            *state = *command;
+        }
+    }
+    if (g_command_count == g_command_capacity) {
+        g_command_capacity = g_command_capacity ? g_command_capacity * 2 : 256;
+        g_commands = (Command*) realloc(g_commands, g_command_capacity * sizeof(Command));
+    }
+    g_commands[g_command_count++] = *command;
+}
+
+static void rewindMemory(void)
+{
+    for (MemoryBlock* block = g_first_block; block; block = block->next) block->used = 0;
+    g_current_block = g_first_block;
+}
+
+void* listMemory(int size)
+{
+    /* outside of a list the memory is used right away */
+    if (!g_recording) rewindMemory();
+    size = (size + 15) & ~15;
+    MemoryBlock** link = g_current_block ? &g_current_block : &g_first_block;
+    while (*link && (*link)->used + size > (*link)->size) link = &(*link)->next;
+    if (!*link) {
+        MemoryBlock* block = (MemoryBlock*) malloc(sizeof(MemoryBlock));
+        block->next = NULL;
+        block->size = size > MEMORY_BLOCK_SIZE ? size : MEMORY_BLOCK_SIZE;
+        block->used = 0;
+        block->data = (u8*) memalign(16, block->size);
+        *link = block;
+    }
+    g_current_block = *link;
+    void* memory = g_current_block->data + g_current_block->used;
+    g_current_block->used += size;
+    return memory;
+}
+
+/*
+ * Merge the sprite of commands[first] with the following sprites, which
+ * continue it to the right. Returns the index of the last merged command.
+ */
+static int mergeSprites(int first, SpriteVertex* merged)
+{
+    const CommandArgument* args = g_commands[first].args;
+    memcpy(merged, args[4].p, 2 * sizeof(SpriteVertex));
+    int last = first;
+    while (last + 1 < g_command_count) {
+        const Command* next = &g_commands[last + 1];
+        if (next->op != CMD_DRAW_ARRAY || next->args[0].i != GU_SPRITES || next->args[1].i != args[1].i ||
+            next->args[2].i != 2 || next->args[3].p != NULL) break;
+        const SpriteVertex* v = (const SpriteVertex*) next->args[4].p;
+        if (v[0].x != merged[1].x || v[0].u != merged[1].u || v[0].y != merged[0].y || v[0].v != merged[0].v ||
+            v[1].y != merged[1].y || v[1].v != merged[1].v) break;
+        merged[1].x = v[1].x;
+        merged[1].u = v[1].u;
+        last++;
+    }
+    return last;
+}
+
+static void executeCommand(const Command* command, int* index)
+{
+    const CommandArgument* a = command->args;
+    switch (command->op) {
+    case CMD_CLEAR_COLOR: sceGuClearColor(a[0].u); break;
+    case CMD_CLEAR_DEPTH: sceGuClearDepth(a[0].u); break;
+    case CMD_CLEAR: sceGuClear(a[0].i); break;
+    case CMD_OFFSET: sceGuOffset(a[0].u, a[1].u); break;
+    case CMD_VIEWPORT: sceGuViewport(a[0].i, a[1].i, a[2].i, a[3].i); break;
+    case CMD_DEPTH_RANGE: sceGuDepthRange(a[0].i, a[1].i); break;
+    case CMD_SCISSOR: sceGuScissor(a[0].i, a[1].i, a[2].i, a[3].i); break;
+    case CMD_ENABLE:
+        if (a[1].i) sceGuEnable(a[0].i);
+        else sceGuDisable(a[0].i);
+        break;
+    case CMD_ALPHA_FUNC: sceGuAlphaFunc(a[0].i, a[1].i, a[2].i); break;
+    case CMD_DEPTH_FUNC: sceGuDepthFunc(a[0].i); break;
+    case CMD_FRONT_FACE: sceGuFrontFace(a[0].i); break;
+    case CMD_SHADE_MODEL: sceGuShadeModel(a[0].i); break;
+    case CMD_BLEND_FUNC: sceGuBlendFunc(a[0].i, a[1].i, a[2].i, a[3].u, a[4].u); break;
+    case CMD_TEX_MODE: sceGuTexMode(a[0].i, a[1].i, a[2].i, a[3].i); break;
+    case CMD_TEX_FUNC: sceGuTexFunc(a[0].i, a[1].i); break;
+    case CMD_TEX_FILTER: sceGuTexFilter(a[0].i, a[1].i); break;
+    case CMD_TEX_IMAGE: sceGuTexImage(a[0].i, a[1].i, a[2].i, a[3].i, a[4].p); break;
+    case CMD_TEX_SCALE: sceGuTexScale(a[0].f, a[1].f); break;
+    case CMD_TEX_OFFSET: sceGuTexOffset(a[0].f, a[1].f); break;
+    case CMD_TEX_ENV_COLOR: sceGuTexEnvColor(a[0].u); break;
+    case CMD_COPY_IMAGE: {
+        const CommandArgument* c = (const CommandArgument*) a[0].p;
+        sceGuCopyImage(c[0].i, c[1].i, c[2].i, c[3].i, c[4].i, c[5].i, (void*) c[6].p,
+                       c[7].i, c[8].i, c[9].i, (void*) c[10].p);
+        break;
+    }
+    case CMD_DRAW_ARRAY:
+        if (a[0].i == GU_SPRITES && a[2].i == 2 && a[3].p == NULL) {
+            SpriteVertex merged[2];
+            *index = mergeSprites(*index, merged);
+            sceGuDrawArray(GU_SPRITES, a[1].i, 2, NULL, merged);
+        } else {
+            sceGuDrawArray(a[0].i, a[1].i, a[2].i, a[3].p, a[4].p);
+        }
+        break;
+    case CMD_MATRICES: {
+        const float* matrices = (const float*) a[0].p;
+        setDrawMatrices(matrices, matrices + 16);
+        break;
+    }
+    case CMD_AMBIENT_COLOR: sceGuAmbientColor(a[0].u); break;
+    case CMD_AMBIENT: sceGuAmbient(a[0].i); break;
+    case CMD_LIGHT: {
+        ScePspFVector3 position = { a[3].f, a[4].f, a[5].f };
+        sceGuLight(a[0].i, a[1].i, a[2].i, &position);
+        break;
+    }
+    case CMD_LIGHT_ATT: sceGuLightAtt(a[0].i, a[1].f, a[2].f, a[3].f); break;
+    case CMD_LIGHT_COLOR: sceGuLightColor(a[0].i, a[1].i, a[2].u); break;
+    case CMD_LIGHT_SPOT: {
+        ScePspFVector3 direction = { a[1].f, a[2].f, a[3].f };
+        sceGuLightSpot(a[0].i, &direction, a[4].f, a[5].f);
+        break;
+    }
+    case CMD_TEX_ALPHA_RUNS: setTextureAlphaRuns((const AlphaRuns*) a[0].p); break;
+    }
+}
+
+void startList(void)
+{
+    /* an unfinished list is executed, instead of being overwritten like on the PSP */
+    if (g_recording) executeList();
+    if (!g_state_valid) invalidateStates();
+    rewindMemory();
+    g_command_count = 0;
+    g_recording = 1;
+}
+
+void executeList(void)
+{
+    if (!g_recording) return;
+    g_recording = 0;
+    g_replaying = 1;
+    for (int i = 0; i < g_command_count; i++) executeCommand(&g_commands[i], &i);
+    g_replaying = 0;
+    g_command_count = 0;
+}
+
+void resetList(void)
+{
+    g_recording = 0;
+    g_command_count = 0;
+    rewindMemory();
+    invalidateStates();
+}
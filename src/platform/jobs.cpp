@@ -0,0 +1,378 @@
+/*
+ * Work-stealing job system
+ *
+ * Every worker thread has a deque of jobs. A worker pushes and pops its own
+ * jobs at the back, newest first, and when its deque is empty it steals the
+ * oldest job from the front of another deque. Threads outside of the pool,
+ * like the one of the script, share deque 0. A job is pushed when all jobs
+ * it depends on have finished.
+ *
+ * Every job belongs to a group: the jobs of one parallelFor, or a job and
+ * the jobs depending on it. A thread waiting for a job only runs queued
+ * jobs of the same group, so that the script thread doesn't decode an
+ * image in the middle of a raster flush. When there are none, it spins a
+ * short while and then sleeps until a job finishes.
+ */
+
+#include "platform.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+
+#define JOB_QUEUE_SIZE 1024
+
+/* parallelFor splits a range into at most this many jobs */
+#define MAX_RANGE_JOBS 256
+
+/* checks of a waiting thread, before it sleeps */
+#define WAIT_SPIN_COUNT 1000
+
+struct Job {
+    JobFunction function;
+    void* data;
+    unsigned int group;
+    int ownGroup;               /* 1 until the job joins the group of a dependency */
+    std::atomic<int> pending;   /* 1 until submitted, plus the unfinished dependencies */
+    std::atomic<int> finished;  /* set last, after which the job belongs to its waiter */
+    std::atomic_flag lock;      /* guards done and the dependents */
+    int done;
+    Job** dependents;
+    int dependentCount;
+};
+
+typedef struct {
+    pthread_mutex_t mutex;
+    Job* jobs[JOB_QUEUE_SIZE];
+    unsigned int front;  /* the oldest job, stolen first */
+    unsigned int back;   /* one after the newest job, popped first */
+} Deque;
+
+typedef struct {
+    std::atomic<u64> busyMicroseconds;
+    std::atomic<u32> jobs;
+    std::atomic<u32> steals;
+} WorkerCounters;
+
+static Deque g_deques[JOB_MAX_THREADS];
+static WorkerCounters g_counters[JOB_MAX_THREADS];
+static pthread_t g_workers[JOB_MAX_THREADS];
+static std::atomic<int> g_thread_count(0);  /* the deques in use, g_workers[0] is unused */
+static std::atomic<int> g_queued(0);        /* jobs in all deques */
+static int g_quit = 0;
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_done_cond = PTHREAD_COND_INITIALIZER;  /* a job finished */
+static std::atomic<int> g_waiters(0);      /* threads sleeping on g_done_cond */
+static std::atomic<unsigned int> g_next_group(0);
+static pthread_mutex_t g_setup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the deque of the calling thread, 0 outside of the pool */
+static thread_local int t_worker = 0;
+
+static u64 microseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void runJob(Job* job);
+
+static int pushJob(Job* job)
+{
+    Deque* deque = &g_deques[t_worker];
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->back - deque->front == JOB_QUEUE_SIZE) {
+        pthread_mutex_unlock(&deque->mutex);
+        return 0;
+    }
+    deque->jobs[deque->back++ % JOB_QUEUE_SIZE] = job;
+    pthread_mutex_unlock(&deque->mutex);
+
+    pthread_mutex_lock(&g_mutex);
+    g_queued++;
+    pthread_cond_signal(&g_work_cond);
+    pthread_mutex_unlock(&g_mutex);
+    return 1;
+}
+
+static void scheduleJob(Job* job)
+{
+    /* a full deque runs the job right away */
+    if (!pushJob(job)) runJob(job);
+}
+
+/* the newest job of the own deque, or else the oldest of another one */
+static Job* takeJob(void)
+{
+    int count = g_thread_count;
+    for (int i = 0; i < count; i++) {
+        int index = (t_worker + i) % count;
+        Deque* deque = &g_deques[index];
+        pthread_mutex_lock(&deque->mutex);
+        Job* job = NULL;
+        if (deque->back != deque->front) {
+            job = i == 0 ? deque->jobs[--deque->back % JOB_QUEUE_SIZE] : deque->jobs[deque->front++ % JOB_QUEUE_SIZE];
+        }
+        pthread_mutex_unlock(&deque->mutex);
+        if (job) {
+            g_queued--;
+            if (i > 0) g_counters[t_worker].steals++;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+/* a queued job of group, preferably of the own deque, removed if take is set */
+static Job* findGroupJob(unsigned int group, int take)
+{
+    int count = g_thread_count;
+    for (int i = 0; i < count; i++) {
+        Deque* deque = &g_deques[(t_worker + i) % count];
+        Job* job = NULL;
+        pthread_mutex_lock(&deque->mutex);
+        for (unsigned int j = deque->back; j != deque->front; j--) {
+            if (deque->jobs[(j - 1) % JOB_QUEUE_SIZE]->group != group) continue;
+            job = deque->jobs[(j - 1) % JOB_QUEUE_SIZE];
+            if (take) {
+                for (unsigned int k = j; k != deque->back; k++) {
+                    deque->jobs[(k - 1) % JOB_QUEUE_SIZE] = deque->jobs[k % JOB_QUEUE_SIZE];
+                }
+                deque->back--;
+            }
+            break;
+        }
+        pthread_mutex_unlock(&deque->mutex);
+        if (job) {
+            if (take) {
+                g_queued--;
+                if (i > 0) g_counters[t_worker].steals++;
+            }
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void runJob(Job* job)
+{
+    WorkerCounters* counters = &g_counters[t_worker];
+    u64 start = microseconds();
+    job->function(job->data);
+    counters->busyMicroseconds += microseconds() - start;
+    counters->jobs++;
+
+    while (job->lock.test_and_set(std::memory_order_acquire)) {}
+    job->done = 1;
+    Job** dependents = job->dependents;
+    int dependentCount = job->dependentCount;
+    job->dependents = NULL;
+    job->lock.clear(std::memory_order_release);
+
+    for (int i = 0; i < dependentCount; i++) {
+        if (--dependents[i]->pending == 0) scheduleJob(dependents[i]);
+    }
+    free(dependents);
+    job->finished.store(1);
+    if (g_waiters > 0) {
+        pthread_mutex_lock(&g_mutex);
+        pthread_cond_broadcast(&g_done_cond);
+        pthread_mutex_unlock(&g_mutex);
+    }
+}
+
+static void* workerThread(void* arg)
+{
+    t_worker = (int)(intptr_t) arg;
+    for (;;) {
+        Job* job = takeJob();
+        if (job) {
+            runJob(job);
+            continue;
+        }
+        pthread_mutex_lock(&g_mutex);
+        while (g_queued == 0 && !g_quit) pthread_cond_wait(&g_work_cond, &g_mutex);
+        int quit = g_quit;
+        pthread_mutex_unlock(&g_mutex);
+        if (quit) break;
+    }
+    return NULL;
+}
+
+static void stopWorkers(void)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_quit = 1;
+    pthread_cond_broadcast(&g_work_cond);
+    pthread_mutex_unlock(&g_mutex);
+    for (int i = 1; i < g_thread_count; i++) pthread_join(g_workers[i], NULL);
+    g_quit = 0;
+}
+
+static void startWorkers(int count)
+{
+    if (count <= 0) count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) count = 1;
+    if (count > JOB_MAX_THREADS) count = JOB_MAX_THREADS;
+    if (count == g_thread_count) return;
+
+    if (g_thread_count == 0) {
+        for (int i = 0; i < JOB_MAX_THREADS; i++) pthread_mutex_init(&g_deques[i].mutex, NULL);
+    }
+    /* the jobs left in the deques are run by the calling thread */
+    if (g_thread_count > 1) stopWorkers();
+    for (Job* job = takeJob(); job; job = takeJob()) runJob(job);
+
+    for (int i = 0; i < count; i++) {
+        g_counters[i].busyMicroseconds = 0;
+        g_counters[i].jobs = 0;
+        g_counters[i].steals = 0;
+    }
+    int started = 1;
+    g_thread_count = count;
+    for (; started < count; started++) {
+        if (pthread_create(&g_workers[started], NULL, workerThread, (void*)(intptr_t) started) != 0) break;
+    }
+    g_thread_count = started;
+}
+
+void setJobThreads(int count)
+{
+    pthread_mutex_lock(&g_setup_mutex);
+    startWorkers(count);
+    pthread_mutex_unlock(&g_setup_mutex);
+}
+
+int getJobThreads(void)
+{
+    if (g_thread_count == 0) {
+        pthread_mutex_lock(&g_setup_mutex);
+        if (g_thread_count == 0) startWorkers(0);
+        pthread_mutex_unlock(&g_setup_mutex);
+    }
+    return g_thread_count;
+}
+
+static Job* newJob(JobFunction function, void* data, unsigned int group)
+{
+    getJobThreads();
+    Job* job = new Job;
+    job->function = function;
+    job->data = data;
+    job->group = group;
+    job->ownGroup = 1;
+    job->pending = 1;
+    job->finished = 0;
+    job->lock.clear();
+    job->done = 0;
+    job->dependents = NULL;
+    job->dependentCount = 0;
+    return job;
+}
+
+Job* createJob(JobFunction function, void* data)
+{
+    return newJob(function, data, g_next_group++);
+}
+
+void addJobDependency(Job* job, Job* dependency)
+{
+    if (job->ownGroup) {
+        job->group = dependency->group;
+        job->ownGroup = 0;
+    }
+    while (dependency->lock.test_and_set(std::memory_order_acquire)) {}
+    if (!dependency->done) {
+        dependency->dependents = (Job**) realloc(dependency->dependents, (dependency->dependentCount + 1) * sizeof(Job*));
+        dependency->dependents[dependency->dependentCount++] = job;
+        job->pending++;
+    }
+    dependency->lock.clear(std::memory_order_release);
+}
+
+void submitJob(Job* job)
+{
+    if (--job->pending == 0) scheduleJob(job);
+}
+
+void waitForJob(Job* job)
+{
+    for (;;) {
+        for (Job* other = findGroupJob(job->group, 1); other; other = findGroupJob(job->group, 1)) runJob(other);
+        for (int i = 0; i < WAIT_SPIN_COUNT && !job->finished.load(std::memory_order_acquire); i++) {
+        }
+        if (job->finished.load(std::memory_order_acquire)) break;
+
+        /* a job of the group is queued before the job it depends on finishes */
+        pthread_mutex_lock(&g_mutex);
+        g_waiters++;
+        if (!job->finished && !findGroupJob(job->group, 0)) pthread_cond_wait(&g_done_cond, &g_mutex);
+        g_waiters--;
+        pthread_mutex_unlock(&g_mutex);
+    }
+    delete job;
+}
+
+int jobFinished(Job* job)
+{
+    return job->finished.load(std::memory_order_acquire);
+}
+
+typedef struct {
+    JobRangeFunction function;
+    void* data;
+    int begin;
+    int end;
+    Job* job;
+} RangeJob;
+
+static void runRange(void* data)
+{
+    RangeJob* range = (RangeJob*) data;
+    range->function(range->data, range->begin, range->end);
+}
+
+void parallelFor(int begin, int end, int grain, JobRangeFunction function, void* data)
+{
+    int count = end - begin;
+    if (count <= 0) return;
+    if (grain < 1) grain = 1;
+    if ((count + grain - 1) / grain > MAX_RANGE_JOBS) grain = (count + MAX_RANGE_JOBS - 1) / MAX_RANGE_JOBS;
+    int jobs = (count + grain - 1) / grain;
+    if (jobs == 1 || getJobThreads() == 1) {
+        function(data, begin, end);
+        return;
+    }
+
+    RangeJob ranges[MAX_RANGE_JOBS];
+    for (int i = 0; i < jobs; i++) {
+        ranges[i].function = function;
+        ranges[i].data = data;
+        ranges[i].begin = begin + i * grain;
+        ranges[i].end = i == jobs - 1 ? end : begin + (i + 1) * grain;
+    }
+    /* the calling thread takes the first range itself */
+    unsigned int group = g_next_group++;
+    for (int i = 1; i < jobs; i++) {
+        ranges[i].job = newJob(runRange, &ranges[i], group);
+        submitJob(ranges[i].job);
+    }
+    runRange(&ranges[0]);
+    for (int i = 1; i < jobs; i++) waitForJob(ranges[i].job);
+}
+
+int getJobStats(JobWorkerStats* stats, int reset)
+{
+    int count = getJobThreads();
+    for (int i = 0; i < count; i++) {
+        WorkerCounters* counters = &g_counters[i];
+        stats[i].busyMicroseconds = reset ? counters->busyMicroseconds.exchange(0) : counters->busyMicroseconds.load();
+        stats[i].jobs = reset ? counters->jobs.exchange(0) : counters->jobs.load();
+        stats[i].steals = reset ? counters->steals.exchange(0) : counters->steals.load();
+    }
+    return count;
+}
@@ -62,6 +62,20 @@ typedef int BOOL;
 #define PLATFORM_SCREEN_HEIGHT 272
 #define PLATFORM_LINE_SIZE     512
 
+/*
+ * Dirty region tiles: the screen is divided into tiles of PLATFORM_TILE_SIZE
+ * pixels, a tile set is stored as one u32 per tile row with bit n for tile
+ * column n
+ */
+#define PLATFORM_TILE_SIZE     16
+#define PLATFORM_TILES_X       ((PLATFORM_SCREEN_WIDTH + PLATFORM_TILE_SIZE - 1) / PLATFORM_TILE_SIZE)
+#define PLATFORM_TILES_Y       ((PLATFORM_SCREEN_HEIGHT + PLATFORM_TILE_SIZE - 1) / PLATFORM_TILE_SIZE)
+#define PLATFORM_MAX_DIRTY_RECTS (PLATFORM_TILES_Y * ((PLATFORM_TILES_X + 1) / 2))
+
+typedef struct {
+    int x, y, width, height;
+} DirtyRect;
+
 /*
  * Controller button masks (generic names, PSP-compatible values)
  */
@@ -120,8 +134,13 @@ typedef struct ScePspFVector3 {
     float x, y, z;
 } ScePspFVector3;
 
+typedef struct ScePspFVector4 {
+    float x, y, z, w;
+} ScePspFVector4;
+
+/* 4x4 matrix of four columns, like the float[16] of OpenGL */
 typedef struct ScePspFMatrix4 {
-    ScePspFVector3 x, y, z, w;
+    ScePspFVector4 x, y, z, w;
 } ScePspFMatrix4;
 
 /*
@@ -481,8 +500,15 @@ void sceGuLightSpot(int index, const ScePspFVector3* direction, float f12, float
  */
 void sceGumMatrixMode(int mode);
 void sceGumLoadIdentity(void);
+void sceGumLoadMatrix(const ScePspFMatrix4* m);
+void sceGumMultMatrix(const ScePspFMatrix4* m);
+void sceGumPushMatrix(void);
+void sceGumPopMatrix(void);
 void sceGumPerspective(float fovy, float aspect, float near, float far);
+void sceGumOrtho(float left, float right, float bottom, float top, float near, float far);
+void sceGumLookAt(ScePspFVector3* eye, ScePspFVector3* center, ScePspFVector3* up);
 void sceGumRotateXYZ(const ScePspFVector3* v);
+void sceGumScale(const ScePspFVector3* v);
 void sceGumTranslate(const ScePspFVector3* v);
 void sceGumDrawArray(int prim, int vtype, int count, const void* indices, const void* vertices);
 
@@ -524,6 +550,114 @@ extern u32* g_vram_base;
 Color* getVramDrawBuffer(void);
 Color* getVramDisplayBuffer(void);
 
+/*
+ * Dirty region tracking (provided by platform implementation). Every write
+ * to the draw buffer marks the tiles it touched, so that only those have to
+ * be presented. getDrawBufferDirtyTiles returns the tiles marked since the
+ * last flip, PLATFORM_TILES_Y rows.
+ */
+void markDrawBufferDirty(int x, int y, int width, int height);
+void getDrawBufferDirtyTiles(u32* tiles);
+
+/*
+ * Frame pacing statistics (Linux platform only). Every
+ * sceDisplayWaitVblankStart counts the difference between its scheduled and
+ * its actual return time in one of the buckets. limits[i] is the upper bound
+ * of bucket i in microseconds, -1 for the last one.
+ */
+#define PLATFORM_PACING_BUCKETS 9
+void getPacingHistogram(int* limits, u32* counts, int reset);
+
+/*
+ * Threads of the software rasteriser (Linux platform only), which run as
+ * jobs, so the threads of the job system limit them. The default and a
+ * count of 0 or less means one thread per job thread.
+ */
+void setRasterThreads(int count);
+int getRasterThreads(void);
+
+/*
+ * Work-stealing job system (Linux platform only). Every thread of the pool
+ * has a deque of jobs; it runs its newest job first and steals the oldest
+ * jobs of the other deques when its own is empty. Threads outside of the
+ * pool share one deque. A waiting thread runs only the queued jobs of the
+ * group it waits for, otherwise it sleeps: the jobs of one parallelFor form
+ * a group, and a job joins the group of the first job it depends on. A job
+ * runs after all jobs it depends on have finished, the dependencies are
+ * added between createJob and submitJob. Every job has to be waited for
+ * once, which frees it; jobFinished tells without waiting whether it has
+ * run. The thread count includes the waiting thread, the default and a
+ * count of 0 or less means one thread per CPU core.
+ */
+#define JOB_MAX_THREADS 64
+
+typedef struct Job Job;
+typedef void (*JobFunction)(void* data);
+typedef void (*JobRangeFunction)(void* data, int begin, int end);
+
+typedef struct {
+    u64 busyMicroseconds;  /* time spent running jobs */
+    u32 jobs;              /* jobs run */
+    u32 steals;            /* jobs taken from the deques of other threads */
+} JobWorkerStats;
+
+void setJobThreads(int count);
+int getJobThreads(void);
+Job* createJob(JobFunction function, void* data);
+void addJobDependency(Job* job, Job* dependency);
+void submitJob(Job* job);
+void waitForJob(Job* job);
+int jobFinished(Job* job);
+
+/*
+ * Call function for consecutive parts of [begin, end) of about grain
+ * elements on the threads of the job system, and wait for all of them.
+ */
+void parallelFor(int begin, int end, int grain, JobRangeFunction function, void* data);
+
+/*
+ * Copy the counters of every thread to stats, which has room for
+ * JOB_MAX_THREADS entries, and returns the number of threads. Entry 0 counts
+ * the threads outside of the pool.
+ */
+int getJobStats(JobWorkerStats* stats, int reset);
+
+/*
+ * Alpha runs of an image: every row is split into runs of transparent,
+ * opaque and mixed pixels, built by graphics.cpp for alpha blits. Runs
+ * shorter than a few pixels are mixed runs, which may contain pixels of
+ * every kind. rows has height + 1 entries, the runs of row y are
+ * runs[rows[y]] to runs[rows[y + 1] - 1].
+ */
+#define ALPHA_RUN_TRANSPARENT 0
+#define ALPHA_RUN_OPAQUE      1
+#define ALPHA_RUN_MIXED       2
+
+typedef struct {
+    u16 x;
+    u16 count;
+    u16 type;
+} AlphaRun;
+
+typedef struct {
+    const Color* data;  /* the first pixel of the image */
+    int stride;         /* pixels per row of data */
+    int width, height;
+    int* rows;
+    AlphaRun* runs;
+    int count;
+    int capacity;
+    unsigned int changes;  /* the change count of the image, when the runs were built */
+    int valid;
+} AlphaRuns;
+
+/*
+ * Alpha runs of the texture, which the sprites of the current list use to
+ * skip transparent pixels (Linux platform only). They are ignored, if they
+ * don't describe the texture, and are forgotten by sceGuFinish.
+ */
+void setTextureAlphaRuns(const AlphaRuns* runs);
+
 #ifdef __cplusplus
 }
 #endif
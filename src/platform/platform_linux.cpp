@@ -10,7 +10,9 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
 #include <pthread.h>
+#include <atomic>
 
 #include <SDL2/SDL.h>
 #include <mikmod.h>
@@ -18,13 +20,63 @@
 /* Display scale factor (default 2x) */
 static int g_scale = 2;
 
-/* Double buffer - Lua draws to back, flips to front */
-static Color g_framebuffer[2][PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT];
-static volatile int g_back_buffer = 0;
+/*
+ * Triple buffer - the Lua thread draws into one buffer, the render thread
+ * uploads another one and the third one waits in the ready slot. A flip
+ * exchanges the finished draw buffer with the ready slot, the render thread
+ * exchanges its buffer with the ready slot when a fresh frame is there.
+ * Buffers change owner by index only, no pixels are copied and no lock is
+ * taken.
+ */
+#define FRAMEBUFFER_COUNT 3
+#define READY_INDEX_MASK 0x3
+#define READY_FRESH 0x4  /* set in the ready slot until the render thread takes it */
+
+static Color g_framebuffer[FRAMEBUFFER_COUNT][PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT] __attribute__((aligned(64)));
+static std::atomic<int> g_ready_slot(1 | READY_FRESH);  /* the blank buffer 1 is shown first */
+static int g_draw_buffer = 0;      /* owned by the Lua thread */
+static int g_display_buffer = 1;   /* last flipped frame, read only for the Lua thread */
+static int g_present_buffer = 2;   /* owned by the render thread */
+
+/*
+ * Dirty tiles - g_stale_tiles[b] holds the tiles in which buffer b may differ
+ * from the texture. Drawing adds tiles to the draw buffer, uploading buffer b
+ * adds its tiles to the other buffers, because the texture changed there.
+ * Only the stale tiles of a buffer are uploaded.
+ */
+static std::atomic<u32> g_stale_tiles[FRAMEBUFFER_COUNT][PLATFORM_TILES_Y];
+static u32 g_frame_tiles[PLATFORM_TILES_Y];  /* drawn since the last flip, Lua thread only */
+
+/*
+ * Frame signalling - every flip increments the frame sequence number and
+ * wakes the render thread. Without a new frame the render thread sleeps,
+ * waking up only to pump window events and the MikMod player.
+ */
+#define RENDER_IDLE_TIMEOUT_NS (10 * 1000 * 1000)
 
-/* Render buffer - stable copy for SDL to display */
-static Color g_render_buffer[PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT];
-static pthread_mutex_t g_render_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_frame_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_frame_cond;
+static unsigned int g_frame_sequence = 0;      /* protected by g_frame_mutex */
+static unsigned int g_presented_sequence = 0;  /* owned by the render thread */
+static int g_redraw = 1;                       /* window needs a present, render thread only */
+static unsigned int g_completed_sequence = 0;  /* last presented frame, protected by g_frame_mutex */
+static pthread_cond_t g_present_cond;          /* signalled when a present completed */
+
+/*
+ * Vblank emulation - vblanks are on a grid of absolute deadlines, 60 per
+ * second. The Lua thread sleeps until shortly before the deadline and spins
+ * the rest of the time, because sleeps overshoot by the scheduler latency.
+ * If a flipped frame is not presented yet, it waits for the present first.
+ * The deadline is still kept, so that faster monitors or a window without
+ * vsync don't speed up the script; only a present after the deadline moves
+ * the grid to the time of the present.
+ */
+#define FRAME_PERIOD_NS 16666667LL
+#define SPIN_MARGIN_NS 1000000LL
+
+static long long g_last_vblank = 0;  /* Lua thread only */
+static const int g_pacing_limits[PLATFORM_PACING_BUCKETS] = { 50, 100, 250, 500, 1000, 2000, 4000, 8000, -1 };
+static u32 g_pacing_counts[PLATFORM_PACING_BUCKETS];
 
 /* SDL objects */
 static SDL_Window* g_window = NULL;
@@ -48,8 +100,9 @@ extern const char* runScript(const char* script, bool isStringBuffer);
 extern void initSound(void);
 extern void uninitSound(void);
 
-/* External function from graphics.cpp */
+/* External functions from graphics.cpp */
 extern void initGraphics(void);
+extern int dirtyTilesToRects(const u32* tiles, DirtyRect* rects);
 
 /* Key mappings - SDL scancode to button */
 typedef struct {
@@ -79,45 +132,148 @@ static KeyMapping g_key_mappings[] = {
  */
 Color* getVramDrawBuffer(void)
 {
-    return g_framebuffer[g_back_buffer];
+    return g_framebuffer[g_draw_buffer];
 }
 
 Color* getVramDisplayBuffer(void)
 {
-    return g_framebuffer[1 - g_back_buffer];
+    return g_framebuffer[g_display_buffer];
+}
+
+/*
+ * Dirty region tracking
+ */
+void markDrawBufferDirty(int x, int y, int width, int height)
+{
+    int x1 = x + width;
+    int y1 = y + height;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x1 > PLATFORM_SCREEN_WIDTH) x1 = PLATFORM_SCREEN_WIDTH;
+    if (y1 > PLATFORM_SCREEN_HEIGHT) y1 = PLATFORM_SCREEN_HEIGHT;
+    if (x >= x1 || y >= y1) return;
+
+    int tx0 = x / PLATFORM_TILE_SIZE;
+    int tx1 = (x1 - 1) / PLATFORM_TILE_SIZE;
+    u32 bits = ((2u << tx1) - 1) & ~((1u << tx0) - 1);
+    for (int ty = y / PLATFORM_TILE_SIZE; ty <= (y1 - 1) / PLATFORM_TILE_SIZE; ty++) {
+        /* tiles already drawn in this frame are already stale */
+        if ((g_frame_tiles[ty] & bits) != bits) {
+            g_frame_tiles[ty] |= bits;
+            g_stale_tiles[g_draw_buffer][ty].fetch_or(bits, std::memory_order_relaxed);
+        }
+    }
+}
+
+void getDrawBufferDirtyTiles(u32* tiles)
+{
+    memcpy(tiles, g_frame_tiles, sizeof(g_frame_tiles));
 }
 
 /*
- * Flip buffers - copy completed frame to render buffer, then swap
+ * Flip buffers - publish the completed frame in the ready slot and continue
+ * drawing into the buffer which was there. Like on the PSP, the new draw
+ * buffer contains an older frame, not a copy of the one just flipped.
  */
 void emuFlipBuffers(void)
 {
-    pthread_mutex_lock(&g_render_mutex);
-    memcpy(g_render_buffer, g_framebuffer[g_back_buffer],
-           PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT * sizeof(Color));
-    pthread_mutex_unlock(&g_render_mutex);
-    g_back_buffer = 1 - g_back_buffer;
+    int previous = g_ready_slot.exchange(g_draw_buffer | READY_FRESH, std::memory_order_acq_rel);
+    g_display_buffer = g_draw_buffer;
+    g_draw_buffer = previous & READY_INDEX_MASK;
+    memset(g_frame_tiles, 0, sizeof(g_frame_tiles));
+
+    pthread_mutex_lock(&g_frame_mutex);
+    g_frame_sequence++;
+    pthread_cond_signal(&g_frame_cond);
+    pthread_mutex_unlock(&g_frame_mutex);
 }
 
 /*
- * Wait for vsync - enforce 60Hz timing
+ * Wake the render thread without a new frame, e.g. to let it exit
  */
-void emuWaitVsync(void)
+static void wakeRenderThread(void)
+{
+    pthread_mutex_lock(&g_frame_mutex);
+    pthread_cond_signal(&g_frame_cond);
+    pthread_mutex_unlock(&g_frame_mutex);
+}
+
+static long long monotonicTime(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static struct timespec toTimespec(long long time)
+{
+    struct timespec result;
+    result.tv_sec = time / 1000000000LL;
+    result.tv_nsec = time % 1000000000LL;
+    return result;
+}
+
+static void recordPacingError(long long error)
+{
+    if (error < 0) error = -error;
+    int bucket = 0;
+    while (g_pacing_limits[bucket] >= 0 && error > g_pacing_limits[bucket] * 1000LL) bucket++;
+    g_pacing_counts[bucket]++;
+}
+
+void getPacingHistogram(int* limits, u32* counts, int reset)
 {
-    static Uint32 last_time = 0;
-    Uint32 now = SDL_GetTicks();
-    Uint32 frame_time = 1000 / 60;  /* ~16.67ms for 60Hz */
+    memcpy(limits, g_pacing_limits, sizeof(g_pacing_limits));
+    memcpy(counts, g_pacing_counts, sizeof(g_pacing_counts));
+    if (reset) memset(g_pacing_counts, 0, sizeof(g_pacing_counts));
+}
 
-    if (last_time == 0) {
-        last_time = now;
+/*
+ * Wait for the next vblank
+ */
+void emuWaitVsync(void)
+{
+    long long now = monotonicTime();
+    if (g_last_vblank == 0) {
+        g_last_vblank = now;
         return;
     }
 
-    Uint32 elapsed = now - last_time;
-    if (elapsed < frame_time) {
-        SDL_Delay(frame_time - elapsed);
+    /* the first deadline on the grid after now */
+    long long target = g_last_vblank + FRAME_PERIOD_NS;
+    if (target <= now) target += ((now - target) / FRAME_PERIOD_NS + 1) * FRAME_PERIOD_NS;
+
+    int presented = 0;
+    pthread_mutex_lock(&g_frame_mutex);
+    if (g_completed_sequence != g_frame_sequence) {
+        /* don't wait forever, if the window doesn't present */
+        struct timespec limit = toTimespec(target + FRAME_PERIOD_NS);
+        while (g_completed_sequence != g_frame_sequence && g_running) {
+            if (pthread_cond_timedwait(&g_present_cond, &g_frame_mutex, &limit) == ETIMEDOUT) break;
+        }
+        presented = g_completed_sequence == g_frame_sequence;
+    }
+    pthread_mutex_unlock(&g_frame_mutex);
+
+    if (presented) {
+        now = monotonicTime();
+        if (now > target) {
+            recordPacingError(now - target);
+            g_last_vblank = now;
+            return;
+        }
+    }
+
+    if (target - SPIN_MARGIN_NS > monotonicTime()) {
+        struct timespec wakeup = toTimespec(target - SPIN_MARGIN_NS);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL) == EINTR) {
+        }
     }
-    last_time = SDL_GetTicks();
+    do {
+        now = monotonicTime();
+    } while (now < target);
+    recordPacingError(now - target);
+    g_last_vblank = target;
 }
 
 /*
@@ -139,6 +295,12 @@ static void processEvents(void)
         case SDL_QUIT:
             g_running = 0;
             break;
+        case SDL_WINDOWEVENT:
+            if (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                g_redraw = 1;
+            }
+            break;
         case SDL_KEYDOWN:
             if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
                 g_running = 0;
@@ -164,21 +326,62 @@ static void processEvents(void)
 }
 
 /*
- * Render the framebuffer to screen
+ * Upload the stale tiles of a buffer to the texture
  */
-static void renderFrame(void)
+static void uploadFramebuffer(int buffer)
 {
-    void* pixels;
-    int pitch;
-    if (SDL_LockTexture(g_texture, NULL, &pixels, &pitch) == 0) {
-        pthread_mutex_lock(&g_render_mutex);
-        for (int y = 0; y < PLATFORM_SCREEN_HEIGHT; y++) {
-            memcpy((u8*)pixels + y * pitch,
-                   g_render_buffer + y * PLATFORM_LINE_SIZE,
-                   PLATFORM_SCREEN_WIDTH * sizeof(Color));
+    u32 tiles[PLATFORM_TILES_Y];
+    for (int ty = 0; ty < PLATFORM_TILES_Y; ty++) {
+        tiles[ty] = g_stale_tiles[buffer][ty].exchange(0, std::memory_order_relaxed);
+        if (!tiles[ty]) continue;
+        for (int other = 0; other < FRAMEBUFFER_COUNT; other++) {
+            if (other != buffer) g_stale_tiles[other][ty].fetch_or(tiles[ty], std::memory_order_relaxed);
         }
-        pthread_mutex_unlock(&g_render_mutex);
-        SDL_UnlockTexture(g_texture);
+    }
+
+    DirtyRect rects[PLATFORM_MAX_DIRTY_RECTS];
+    int count = dirtyTilesToRects(tiles, rects);
+    for (int i = 0; i < count; i++) {
+        SDL_Rect rect = { rects[i].x, rects[i].y, rects[i].width, rects[i].height };
+        SDL_UpdateTexture(g_texture, &rect,
+                          g_framebuffer[buffer] + rect.x + rect.y * PLATFORM_LINE_SIZE,
+                          PLATFORM_LINE_SIZE * sizeof(Color));
+    }
+}
+
+/*
+ * Wait until a frame newer than the presented one was flipped, or until the
+ * idle timeout. Returns the sequence number of the newest frame.
+ */
+static unsigned int waitForFrame(void)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += RENDER_IDLE_TIMEOUT_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&g_frame_mutex);
+    while (g_frame_sequence == g_presented_sequence && g_running) {
+        if (pthread_cond_timedwait(&g_frame_cond, &g_frame_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    unsigned int sequence = g_frame_sequence;
+    pthread_mutex_unlock(&g_frame_mutex);
+    return sequence;
+}
+
+/*
+ * Render the framebuffer to screen, taking the newest frame from the ready
+ * slot if there is one
+ */
+static void renderFrame(void)
+{
+    if (g_ready_slot.load(std::memory_order_relaxed) & READY_FRESH) {
+        int ready = g_ready_slot.exchange(g_present_buffer, std::memory_order_acq_rel);
+        g_present_buffer = ready & READY_INDEX_MASK;
+        uploadFramebuffer(g_present_buffer);
     }
 
     SDL_RenderCopy(g_renderer, g_texture, NULL, NULL);
@@ -192,6 +395,7 @@ static void* luaThread(void* arg)
     runScript(script, false);
     uninitSound();
     g_running = 0;
+    wakeRenderThread();
     return NULL;
 }
 
@@ -201,8 +405,9 @@ static void* luaThread(void* arg)
 int main(int argc, char** argv)
 {
     if (argc < 2) {
-        printf("usage: luaplayer [-scale N] script.lua\n");
+        printf("usage: luaplayer [-scale N] [-threads N] script.lua\n");
         printf("  -scale N  : Set display scale factor (default: 2)\n");
+        printf("  -threads N: Set job system threads (default: one per core)\n");
         return 1;
     }
 
@@ -214,6 +419,9 @@ int main(int argc, char** argv)
             if (g_scale < 1) g_scale = 1;
             if (g_scale > 8) g_scale = 8;
             arg_idx += 2;
+        } else if (strcmp(argv[arg_idx], "-threads") == 0 && arg_idx + 1 < argc) {
+            setJobThreads(atoi(argv[arg_idx + 1]));
+            arg_idx += 2;
         } else {
             fprintf(stderr, "Unknown option: %s\n", argv[arg_idx]);
             return 1;
@@ -227,6 +435,20 @@ int main(int argc, char** argv)
 
     g_script_path = argv[arg_idx];
     memset(g_framebuffer, 0, sizeof(g_framebuffer));
+    /* the texture content is undefined, so every buffer is stale everywhere */
+    for (int buffer = 0; buffer < FRAMEBUFFER_COUNT; buffer++) {
+        for (int ty = 0; ty < PLATFORM_TILES_Y; ty++) {
+            g_stale_tiles[buffer][ty].store((1u << PLATFORM_TILES_X) - 1);
+        }
+    }
+
+    /* Frame and present waits use deadlines on the monotonic clock */
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_frame_cond, &cond_attr);
+    pthread_cond_init(&g_present_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
 
     /* Initialize SDL */
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
@@ -281,11 +503,21 @@ int main(int argc, char** argv)
     pthread_t thread;
     pthread_create(&thread, NULL, luaThread, (void*)g_script_path);
 
-    /* Main loop - vsync handles timing */
+    /* Main loop - present only new frames or when the window needs it */
     while (g_running) {
         processEvents();
         MikMod_Update();
-        renderFrame();
+        unsigned int sequence = waitForFrame();
+        if (sequence != g_presented_sequence || g_redraw) {
+            g_presented_sequence = sequence;
+            g_redraw = 0;
+            renderFrame();
+
+            pthread_mutex_lock(&g_frame_mutex);
+            g_completed_sequence = sequence;
+            pthread_cond_broadcast(&g_present_cond);
+            pthread_mutex_unlock(&g_frame_mutex);
+        }
     }
 
     /* Signal thread to exit and wait */
@@ -30,12 +30,6 @@ void emuFlipBuffers(void);
 void emuWaitVsync(void);
 int emuIsRunning(void);
 
-/* Current texture for sceGuTexImage */
-static Color* currentTexture = NULL;
-static int currentTextureWidth = 0;
-static int currentTextureHeight = 0;
-static unsigned int clear_color = 0;
-
 /*
  * Kernel functions
  */
@@ -233,125 +227,6 @@ int sceIoDclose(SceUID fd)
     return -1;
 }
 
-/*
- * GU functions - mostly stubs, some with basic software implementations
- */
-
-void sceGuInit(void) {}
-int sceGuDisplay(int state) { (void)state; return 0; }
-void sceGuStart(int cid, void* list) { (void)cid; (void)list; }
-int sceGuFinish(void) { return 0; }
-int sceGuSync(int mode, int a1) { (void)mode; (void)a1; return 0; }
-
-void* sceGuSwapBuffers(void)
-{
-    emuFlipBuffers();
-    return NULL;
-}
-
-void sceGuClearColor(unsigned int color)
-{
-    clear_color = color;
-}
-
-void sceGuClear(int flags)
-{
-    (void)flags;
-    Color* dest = getVramDrawBuffer();
-    for (int n = 0; n < PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT; n++) {
-        dest[n] = clear_color;
-    }
-}
-
-void sceGuClearDepth(unsigned int depth) { (void)depth; }
-void sceGuDrawBuffer(int psm, void* fbp, int fbw) { (void)psm; (void)fbp; (void)fbw; }
-void sceGuDispBuffer(int width, int height, void* dispbp, int dispbw) { (void)width; (void)height; (void)dispbp; (void)dispbw; }
-void sceGuDepthBuffer(void* zbp, int zbw) { (void)zbp; (void)zbw; }
-void sceGuOffset(unsigned int x, unsigned int y) { (void)x; (void)y; }
-void sceGuViewport(int cx, int cy, int width, int height) { (void)cx; (void)cy; (void)width; (void)height; }
-void sceGuDepthRange(int near, int far) { (void)near; (void)far; }
-void sceGuScissor(int x, int y, int w, int h) { (void)x; (void)y; (void)w; (void)h; }
-void sceGuEnable(int state) { (void)state; }
-void sceGuDisable(int state) { (void)state; }
-void sceGuAlphaFunc(int func, int value, int mask) { (void)func; (void)value; (void)mask; }
-void sceGuDepthFunc(int function) { (void)function; }
-void sceGuFrontFace(int order) { (void)order; }
-void sceGuShadeModel(int mode) { (void)mode; }
-void sceGuBlendFunc(int op, int src, int dest, unsigned int srcfix, unsigned int destfix) { (void)op; (void)src; (void)dest; (void)srcfix; (void)destfix; }
-void sceGuTexMode(int tpsm, int maxmips, int a2, int swizzle) { (void)tpsm; (void)maxmips; (void)a2; (void)swizzle; }
-void sceGuTexFunc(int tfx, int tcc) { (void)tfx; (void)tcc; }
-void sceGuTexFilter(int min, int mag) { (void)min; (void)mag; }
-
-void sceGuTexImage(int mipmap, int width, int height, int tbw, const void* tbp)
-{
-    (void)mipmap; (void)tbw;
-    currentTexture = (Color*)tbp;
-    currentTextureWidth = width;
-    currentTextureHeight = height;
-}
-
-void sceGuTexScale(float u, float v) { (void)u; (void)v; }
-void sceGuTexOffset(float u, float v) { (void)u; (void)v; }
-void sceGuTexEnvColor(unsigned int color) { (void)color; }
-
-void sceGuCopyImage(int psm, int sx, int sy, int width, int height, int srcw, void* src, int dx, int dy, int destw, void* dest)
-{
-    (void)psm;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            ((Color*)dest)[x + dx + (y + dy) * destw] = ((Color*)src)[x + sx + (y + sy) * srcw];
-        }
-    }
-}
-
-typedef struct {
-    unsigned short u, v;
-    short x, y, z;
-} Vertex;
-
-void sceGuDrawArray(int prim, int vtype, int count, const void* indices, const void* vertices)
-{
-    (void)prim; (void)vtype; (void)count; (void)indices;
-    Vertex* v = (Vertex*)vertices;
-    int sx = v[0].u;
-    int sy = v[0].v;
-    int dx = v[0].x;
-    int dy = v[0].y;
-    int width = v[1].x - v[0].x;
-    int height = v[1].y - v[0].y;
-    Color* dest = getVramDrawBuffer();
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            Color color = currentTexture[x + sx + (y + sy) * currentTextureWidth];
-            if (color & 0xFF000000) {
-                dest[x + dx + (y + dy) * PLATFORM_LINE_SIZE] = color;
-            }
-        }
-    }
-}
-
-static char guMemory[1024];
-void* sceGuGetMemory(int size) { (void)size; return guMemory; }
-
-void sceGuAmbientColor(unsigned int color) { (void)color; }
-void sceGuAmbient(int color) { (void)color; }
-void sceGuLight(int light, int type, int components, const ScePspFVector3* position) { (void)light; (void)type; (void)components; (void)position; }
-void sceGuLightAtt(int light, float atten0, float atten1, float atten2) { (void)light; (void)atten0; (void)atten1; (void)atten2; }
-void sceGuLightColor(int light, int component, unsigned int color) { (void)light; (void)component; (void)color; }
-void sceGuLightMode(int mode) { (void)mode; }
-void sceGuLightSpot(int index, const ScePspFVector3* direction, float f12, float f13) { (void)index; (void)direction; (void)f12; (void)f13; }
-
-/*
- * GUM functions
- */
-
-void sceGumMatrixMode(int mode) { (void)mode; }
-void sceGumLoadIdentity(void) {}
-void sceGumPerspective(float fovy, float aspect, float near, float far) { (void)fovy; (void)aspect; (void)near; (void)far; }
-void sceGumRotateXYZ(const ScePspFVector3* v) { (void)v; }
-void sceGumTranslate(const ScePspFVector3* v) { (void)v; }
-void sceGumDrawArray(int prim, int vtype, int count, const void* indices, const void* vertices) { (void)prim; (void)vtype; (void)count; (void)indices; (void)vertices; }
-
 /*
  * GE functions
  */
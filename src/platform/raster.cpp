@@ -0,0 +1,487 @@
+/*
+ * Triangle rasteriser of the software GE
+ *
+ * Triangles are traversed in blocks of 8x8 pixels. The edge functions are
+ * evaluated in fixed point at the block corners first, to skip blocks
+ * outside of the triangle and to find the blocks inside of it. Within a
+ * block, coverage, depth test and the perspective correct interpolation are
+ * computed for 4 pixels at once with SSE2. Texturing, alpha test and
+ * blending are done for every covered pixel.
+ *
+ * The texture sampler filters with nearest or bilinear filtering and
+ * between mipmap levels. The level of detail is computed per pixel from the
+ * derivatives of the texture coordinates. Bilinear filtering weights the 4
+ * texels with 8 bit fractions, with SSE2 all 4 texels are blended at once.
+ */
+
+#include "softgu.h"
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define BLOCK_SIZE 8
+#define LANES 4
+
+u16 g_depth_buffer[PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT] __attribute__((aligned(64)));
+
+static inline int fastFloor(float value)
+{
+    int i = (int)value;
+    return i - (value < i);
+}
+
+static inline int clampColor(float value)
+{
+    if (value <= 0.0f) return 0;
+    if (value >= 255.0f) return 255;
+    return (int)(value + 0.5f);
+}
+
+/* a * b / 255, exact for 0 and 255 */
+static inline int mul255(int a, int b)
+{
+    return (a * b + 255) >> 8;
+}
+
+static inline int div255(int value)
+{
+    return ((value + 128) * 257) >> 16;
+}
+
+int setupTriangle(RasterTriangle* triangle, const ScreenVertex* vertices[3], int cull, const RasterState* state)
+{
+    const ScreenVertex* v[3] = { vertices[0], vertices[1], vertices[2] };
+    int x[3], y[3];
+    for (int i = 0; i < 3; i++) {
+        x[i] = (int)lrintf(v[i]->x * RASTER_SUBPIXELS);
+        y[i] = (int)lrintf(v[i]->y * RASTER_SUBPIXELS);
+    }
+
+    /* positive for clockwise triangles, because y points down */
+    long long area = (long long)(x[1] - x[0]) * (y[2] - y[0]) - (long long)(y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0) return 0;
+    if (area > 0 && cull == RASTER_CULL_CW) return 0;
+    if (area < 0 && cull == RASTER_CULL_CCW) return 0;
+    if (area < 0) {
+        const ScreenVertex* vertex = v[1]; v[1] = v[2]; v[2] = vertex;
+        int swap = x[1]; x[1] = x[2]; x[2] = swap;
+        swap = y[1]; y[1] = y[2]; y[2] = swap;
+    }
+
+    /* pixels are sampled at their centers */
+    int half = RASTER_SUBPIXELS / 2;
+    int minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+    for (int i = 1; i < 3; i++) {
+        if (x[i] < minX) minX = x[i];
+        if (x[i] > maxX) maxX = x[i];
+        if (y[i] < minY) minY = y[i];
+        if (y[i] > maxY) maxY = y[i];
+    }
+    triangle->minX = (minX - half + RASTER_SUBPIXELS - 1) >> RASTER_SUBPIXEL_BITS;
+    triangle->minY = (minY - half + RASTER_SUBPIXELS - 1) >> RASTER_SUBPIXEL_BITS;
+    triangle->maxX = ((maxX - half) >> RASTER_SUBPIXEL_BITS) + 1;
+    triangle->maxY = ((maxY - half) >> RASTER_SUBPIXEL_BITS) + 1;
+    if (triangle->minX < state->scissorX0) triangle->minX = state->scissorX0;
+    if (triangle->minY < state->scissorY0) triangle->minY = state->scissorY0;
+    if (triangle->maxX > state->scissorX1) triangle->maxX = state->scissorX1;
+    if (triangle->maxY > state->scissorY1) triangle->maxY = state->scissorY1;
+    if (triangle->minX >= triangle->maxX || triangle->minY >= triangle->maxY) return 0;
+
+    for (int i = 0; i < 3; i++) {
+        triangle->x[i] = x[i];
+        triangle->y[i] = y[i];
+    }
+    triangle->state = state;
+
+    /* planes relative to the center of pixel (0, 0), from the snapped positions */
+    float fx[3], fy[3];
+    for (int i = 0; i < 3; i++) {
+        fx[i] = x[i] * (1.0f / RASTER_SUBPIXELS) - 0.5f;
+        fy[i] = y[i] * (1.0f / RASTER_SUBPIXELS) - 0.5f;
+    }
+    float dx1 = fx[1] - fx[0], dy1 = fy[1] - fy[0];
+    float dx2 = fx[2] - fx[0], dy2 = fy[2] - fy[0];
+    float invArea = 1.0f / (dx1 * dy2 - dy1 * dx2);
+
+    float values[PLANE_COUNT][3];
+    for (int i = 0; i < 3; i++) {
+        float invW = v[i]->invW;
+        values[PLANE_Z][i] = v[i]->z;
+        values[PLANE_INV_W][i] = invW;
+        values[PLANE_U][i] = v[i]->u * invW;
+        values[PLANE_V][i] = v[i]->v * invW;
+        values[PLANE_R][i] = v[i]->r * invW;
+        values[PLANE_G][i] = v[i]->g * invW;
+        values[PLANE_B][i] = v[i]->b * invW;
+        values[PLANE_A][i] = v[i]->a * invW;
+    }
+    for (int p = 0; p < PLANE_COUNT; p++) {
+        float da1 = values[p][1] - values[p][0];
+        float da2 = values[p][2] - values[p][0];
+        float dadx = (da1 * dy2 - da2 * dy1) * invArea;
+        float dady = (da2 * dx1 - da1 * dx2) * invArea;
+        triangle->plane[p][0] = values[p][0] - dadx * fx[0] - dady * fy[0];
+        triangle->plane[p][1] = dadx;
+        triangle->plane[p][2] = dady;
+    }
+    return 1;
+}
+
+static inline int depthPasses(int function, int depth, int buffer)
+{
+    switch (function) {
+    case GU_NEVER: return 0;
+    case GU_ALWAYS: return 1;
+    case GU_EQUAL: return depth == buffer;
+    case GU_NOTEQUAL: return depth != buffer;
+    case GU_LESS: return depth < buffer;
+    case GU_LEQUAL: return depth <= buffer;
+    case GU_GREATER: return depth > buffer;
+    default: return depth >= buffer;
+    }
+}
+
+#if defined(__SSE2__)
+static inline __m128i depthPasses4(int function, __m128i depth, __m128i buffer)
+{
+    const __m128i ones = _mm_set1_epi32(-1);
+    switch (function) {
+    case GU_NEVER: return _mm_setzero_si128();
+    case GU_ALWAYS: return ones;
+    case GU_EQUAL: return _mm_cmpeq_epi32(depth, buffer);
+    case GU_NOTEQUAL: return _mm_xor_si128(_mm_cmpeq_epi32(depth, buffer), ones);
+    case GU_LESS: return _mm_cmplt_epi32(depth, buffer);
+    case GU_LEQUAL: return _mm_xor_si128(_mm_cmpgt_epi32(depth, buffer), ones);
+    case GU_GREATER: return _mm_cmpgt_epi32(depth, buffer);
+    default: return _mm_xor_si128(_mm_cmplt_epi32(depth, buffer), ones);
+    }
+}
+#endif
+
+static inline int blendFactor(int factor, int source, int destination, int sourceAlpha, int destinationAlpha, int fix)
+{
+    switch (factor) {
+    case GU_SRC_COLOR: return source;
+    case GU_ONE_MINUS_SRC_COLOR: return 255 - source;
+    case GU_SRC_ALPHA: return sourceAlpha;
+    case GU_ONE_MINUS_SRC_ALPHA: return 255 - sourceAlpha;
+    case GU_DST_ALPHA: return destinationAlpha;
+    case GU_ONE_MINUS_DST_ALPHA: return 255 - destinationAlpha;
+    case GU_DST_COLOR: return destination;
+    case GU_ONE_MINUS_DST_COLOR: return 255 - destination;
+    default: return fix;
+    }
+}
+
+static inline int blendChannel(const RasterState* state, int shift, int source, int destination, int sourceAlpha, int destinationAlpha)
+{
+    int sourceFactor = blendFactor(state->blendSrc, source, destination, sourceAlpha, destinationAlpha, (state->blendFixSrc >> shift) & 0xff);
+    int destinationFactor = blendFactor(state->blendDst, destination, source, sourceAlpha, destinationAlpha, (state->blendFixDst >> shift) & 0xff);
+    int result;
+    switch (state->blendOp) {
+    case GU_SUBTRACT: result = div255(source * sourceFactor) - div255(destination * destinationFactor); break;
+    case GU_REVERSE_SUBTRACT: result = div255(destination * destinationFactor) - div255(source * sourceFactor); break;
+    case GU_MIN: result = source < destination ? source : destination; break;
+    case GU_MAX: result = source > destination ? source : destination; break;
+    case GU_ABS: result = source > destination ? source - destination : destination - source; break;
+    default: result = div255(source * sourceFactor + destination * destinationFactor); break;
+    }
+    if (result < 0) return 0;
+    if (result > 255) return 255;
+    return result;
+}
+
+/* a + (b - a) * weight / 256 for all channels, weight 0 - 256 */
+static inline Color lerpTexels(Color a, Color b, int weight)
+{
+    Color result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int ca = (a >> shift) & 0xff, cb = (b >> shift) & 0xff;
+        result |= (Color)((ca * (256 - weight) + cb * weight + 128) >> 8) << shift;
+    }
+    return result;
+}
+
+/* the 2x2 texels c00, c10, c01 and c11 weighted with the fractions wx and wy, 0 - 256 */
+static inline Color bilinearTexels(Color c00, Color c10, Color c01, Color c11, int wx, int wy)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    __m128i texels = _mm_set_epi32((int)c11, (int)c01, (int)c10, (int)c00);
+    __m128i top = _mm_unpacklo_epi8(texels, zero);
+    __m128i bottom = _mm_unpackhi_epi8(texels, zero);
+    __m128i weightX = _mm_set_epi16(wx, wx, wx, wx, 256 - wx, 256 - wx, 256 - wx, 256 - wx);
+    __m128i weightY = _mm_set_epi16(wy, wy, wy, wy, 256 - wy, 256 - wy, 256 - wy, 256 - wy);
+    /* the products are at most 255 * 256 and are used as unsigned numbers */
+    top = _mm_mullo_epi16(top, weightX);
+    bottom = _mm_mullo_epi16(bottom, weightX);
+    top = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(top, _mm_srli_si128(top, 8)), round), 8);
+    bottom = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(bottom, _mm_srli_si128(bottom, 8)), round), 8);
+    __m128i rows = _mm_mullo_epi16(_mm_unpacklo_epi64(top, bottom), weightY);
+    rows = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(rows, _mm_srli_si128(rows, 8)), round), 8);
+    return (Color)_mm_cvtsi128_si32(_mm_packus_epi16(rows, zero));
+#else
+    return lerpTexels(lerpTexels(c00, c10, wx), lerpTexels(c01, c11, wx), wy);
+#endif
+}
+
+/* u and v are in texels of level 0 */
+static inline Color sampleLevel(const TextureLevel* level, int linear, float u, float v)
+{
+    u *= level->scaleU;
+    v *= level->scaleV;
+    int maskX = level->width - 1, maskY = level->height - 1;
+    if (!linear) {
+        return level->data[(fastFloor(u) & maskX) + (fastFloor(v) & maskY) * level->stride];
+    }
+    /* texel centers are at .5 */
+    u -= 0.5f;
+    v -= 0.5f;
+    int x0 = fastFloor(u), y0 = fastFloor(v);
+    int wx = (int)((u - x0) * 256.0f), wy = (int)((v - y0) * 256.0f);
+    int x1 = (x0 + 1) & maskX, y1 = (y0 + 1) & maskY;
+    x0 &= maskX;
+    y0 &= maskY;
+    const Color* row0 = level->data + y0 * level->stride;
+    const Color* row1 = level->data + y1 * level->stride;
+    return bilinearTexels(row0[x0], row0[x1], row1[x0], row1[x1], wx, wy);
+}
+
+/* log2 of the texels per pixel, from the derivatives of u / w, v / w and 1 / w */
+static inline float textureLod(const float (*plane)[3], float u, float v, float invW)
+{
+    float w = 1.0f / invW;
+    float dudx = (plane[PLANE_U][1] - u * plane[PLANE_INV_W][1]) * w;
+    float dvdx = (plane[PLANE_V][1] - v * plane[PLANE_INV_W][1]) * w;
+    float dudy = (plane[PLANE_U][2] - u * plane[PLANE_INV_W][2]) * w;
+    float dvdy = (plane[PLANE_V][2] - v * plane[PLANE_INV_W][2]) * w;
+    float x = dudx * dudx + dvdx * dvdx;
+    float y = dudy * dudy + dvdy * dvdy;
+    float rho2 = x > y ? x : y;
+    return rho2 > 0.0f ? 0.5f * log2f(rho2) : -16.0f;
+}
+
+static inline Color sampleTexture(const RasterState* state, float u, float v, float lod)
+{
+    /* magnification has no mipmaps */
+    int filter = lod > 0.0f ? state->texMinFilter : state->texMagFilter & 1;
+    int linear = filter & 1;
+    int last = state->texLevelCount - 1;
+    if (!(filter & 4) || last == 0) return sampleLevel(&state->texLevels[0], linear, u, v);
+
+    if (!(filter & 2)) {
+        /* GU_*_MIPMAP_NEAREST */
+        int level = (int)(lod + 0.5f);
+        return sampleLevel(&state->texLevels[level < last ? level : last], linear, u, v);
+    }
+    int level = (int)lod;
+    if (level >= last) return sampleLevel(&state->texLevels[last], linear, u, v);
+    int weight = (int)((lod - level) * 256.0f);
+    Color color = sampleLevel(&state->texLevels[level], linear, u, v);
+    if (weight == 0) return color;
+    return lerpTexels(color, sampleLevel(&state->texLevels[level + 1], linear, u, v), weight);
+}
+
+/*
+ * Texture function, alpha test and blending of one fragment; returns 0 if
+ * the alpha test fails
+ */
+static inline int shadeFragment(const RasterState* state, Color texel, int r, int g, int b, int a, Color* pixel)
+{
+    if (state->texture) {
+        int tr = COLOR_R(texel), tg = COLOR_G(texel), tb = COLOR_B(texel), ta = COLOR_A(texel);
+        switch (state->texFunc) {
+        case GU_TFX_DECAL:
+            if (state->texAlpha) {
+                r = div255(r * (255 - ta) + tr * ta);
+                g = div255(g * (255 - ta) + tg * ta);
+                b = div255(b * (255 - ta) + tb * ta);
+            } else {
+                r = tr; g = tg; b = tb;
+            }
+            break;
+        case GU_TFX_BLEND:
+            r = div255(r * (255 - tr) + COLOR_R(state->texEnvColor) * tr);
+            g = div255(g * (255 - tg) + COLOR_G(state->texEnvColor) * tg);
+            b = div255(b * (255 - tb) + COLOR_B(state->texEnvColor) * tb);
+            if (state->texAlpha) a = mul255(a, ta);
+            break;
+        case GU_TFX_REPLACE:
+            r = tr; g = tg; b = tb;
+            if (state->texAlpha) a = ta;
+            break;
+        case GU_TFX_ADD:
+            r += tr; if (r > 255) r = 255;
+            g += tg; if (g > 255) g = 255;
+            b += tb; if (b > 255) b = 255;
+            if (state->texAlpha) a = mul255(a, ta);
+            break;
+        default:
+            r = mul255(r, tr);
+            g = mul255(g, tg);
+            b = mul255(b, tb);
+            if (state->texAlpha) a = mul255(a, ta);
+            break;
+        }
+    }
+
+    if (state->alphaTest && !depthPasses(state->alphaFunc, a & state->alphaMask, state->alphaRef & state->alphaMask)) return 0;
+
+    if (state->blend) {
+        Color destination = *pixel;
+        int da = COLOR_A(destination);
+        int sr = r, sg = g, sb = b;
+        r = blendChannel(state, 0, sr, COLOR_R(destination), a, da);
+        g = blendChannel(state, 8, sg, COLOR_G(destination), a, da);
+        b = blendChannel(state, 16, sb, COLOR_B(destination), a, da);
+    }
+    *pixel = COLOR_RGBA(r, g, b, a);
+    return 1;
+}
+
+void rasterizeTriangle(const RasterTriangle* triangle, Color* framebuffer, int x0, int y0, int x1, int y1)
+{
+    const RasterState* state = triangle->state;
+    int minX = triangle->minX > x0 ? triangle->minX : x0;
+    int minY = triangle->minY > y0 ? triangle->minY : y0;
+    int maxX = triangle->maxX < x1 ? triangle->maxX : x1;
+    int maxY = triangle->maxY < y1 ? triangle->maxY : y1;
+    if (minX >= maxX || minY >= maxY) return;
+
+    /* edge functions c + a * x + b * y at the pixel centers, positive inside */
+    long long edgeC[3];
+    int edgeA[3], edgeB[3];
+    for (int e = 0; e < 3; e++) {
+        int i = e, j = (e + 1) % 3;
+        int dx = triangle->x[j] - triangle->x[i];
+        int dy = triangle->y[j] - triangle->y[i];
+        edgeA[e] = -dy * RASTER_SUBPIXELS;
+        edgeB[e] = dx * RASTER_SUBPIXELS;
+        edgeC[e] = (long long)dx * (RASTER_SUBPIXELS / 2 - triangle->y[i])
+                 - (long long)dy * (RASTER_SUBPIXELS / 2 - triangle->x[i]);
+        /* top-left rule: pixel centers exactly on a right or bottom edge are left out */
+        if (!(dy < 0 || (dy == 0 && dx > 0))) edgeC[e]--;
+    }
+
+    const float (*plane)[3] = triangle->plane;
+
+#if defined(__SSE2__)
+    const __m128i laneIndex = _mm_set_epi32(3, 2, 1, 0);
+    const __m128 laneOffset = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    __m128i edgeStep[3];
+    for (int e = 0; e < 3; e++) edgeStep[e] = _mm_set_epi32(3 * edgeA[e], 2 * edgeA[e], edgeA[e], 0);
+    __m128 planeStep[PLANE_COUNT];
+    for (int p = 0; p < PLANE_COUNT; p++) planeStep[p] = _mm_mul_ps(_mm_set1_ps(plane[p][1]), laneOffset);
+#endif
+
+    for (int by = minY & ~(BLOCK_SIZE - 1); by < maxY; by += BLOCK_SIZE) {
+        for (int bx = minX & ~(BLOCK_SIZE - 1); bx < maxX; bx += BLOCK_SIZE) {
+            /* trivial reject and accept with the block corners */
+            int blockE[3];
+            int outside = 0, partial = 0;
+            for (int e = 0; e < 3; e++) {
+                long long corner = edgeC[e] + (long long)edgeA[e] * bx + (long long)edgeB[e] * by;
+                long long spanA = (long long)edgeA[e] * (BLOCK_SIZE - 1);
+                long long spanB = (long long)edgeB[e] * (BLOCK_SIZE - 1);
+                long long maxE = corner + (spanA > 0 ? spanA : 0) + (spanB > 0 ? spanB : 0);
+                long long minE = corner + (spanA < 0 ? spanA : 0) + (spanB < 0 ? spanB : 0);
+                if (maxE < 0) outside = 1;
+                if (minE < 0) partial = 1;
+                /* far from the edge the exact value doesn't matter, only the sign */
+                if (corner > (1 << 30)) corner = 1 << 30;
+                if (corner < -(1 << 30)) corner = -(1 << 30);
+                blockE[e] = (int)corner;
+            }
+            if (outside) continue;
+
+            int rowStart = by > minY ? by : minY;
+            int rowEnd = by + BLOCK_SIZE < maxY ? by + BLOCK_SIZE : maxY;
+            for (int py = rowStart; py < rowEnd; py++) {
+                Color* pixelRow = framebuffer + py * PLATFORM_LINE_SIZE;
+                u16* depthRow = g_depth_buffer + py * PLATFORM_LINE_SIZE;
+                for (int px = bx; px < bx + BLOCK_SIZE; px += LANES) {
+                    if (px >= maxX || px + LANES <= minX) continue;
+                    int mask;
+                    int depth[LANES];
+                    float attribute[PLANE_COUNT][LANES];
+#if defined(__SSE2__)
+                    __m128i x = _mm_add_epi32(_mm_set1_epi32(px), laneIndex);
+                    __m128i inside = _mm_and_si128(_mm_cmpgt_epi32(x, _mm_set1_epi32(minX - 1)),
+                                                   _mm_cmplt_epi32(x, _mm_set1_epi32(maxX)));
+                    if (partial) {
+                        for (int e = 0; e < 3; e++) {
+                            int start = blockE[e] + edgeA[e] * (px - bx) + edgeB[e] * (py - by);
+                            __m128i value = _mm_add_epi32(_mm_set1_epi32(start), edgeStep[e]);
+                            inside = _mm_and_si128(inside, _mm_cmpgt_epi32(value, minusOne));
+                        }
+                    }
+                    mask = _mm_movemask_ps(_mm_castsi128_ps(inside));
+                    if (!mask) continue;
+
+                    __m128 base[PLANE_COUNT];
+                    for (int p = 0; p < PLANE_COUNT; p++) {
+                        base[p] = _mm_add_ps(_mm_set1_ps(plane[p][0] + plane[p][1] * px + plane[p][2] * py), planeStep[p]);
+                    }
+                    __m128 z = _mm_min_ps(_mm_max_ps(base[PLANE_Z], _mm_setzero_ps()), _mm_set1_ps(65535.0f));
+                    __m128i depths = _mm_cvttps_epi32(z);
+                    if (state->depthTest) {
+                        __m128i buffer = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*) (depthRow + px)), _mm_setzero_si128());
+                        inside = _mm_and_si128(inside, depthPasses4(state->depthFunc, depths, buffer));
+                        mask = _mm_movemask_ps(_mm_castsi128_ps(inside));
+                        if (!mask) continue;
+                    }
+                    _mm_storeu_si128((__m128i*) depth, depths);
+
+                    __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), base[PLANE_INV_W]);
+                    _mm_storeu_ps(attribute[PLANE_INV_W], base[PLANE_INV_W]);
+                    for (int p = PLANE_U; p < PLANE_COUNT; p++) {
+                        _mm_storeu_ps(attribute[p], _mm_mul_ps(base[p], w));
+                    }
+#else
+                    mask = 0;
+                    for (int lane = 0; lane < LANES; lane++) {
+                        int x = px + lane;
+                        if (x < minX || x >= maxX) continue;
+                        int covered = 1;
+                        for (int e = 0; e < 3; e++) {
+                            if (blockE[e] + edgeA[e] * (x - bx) + edgeB[e] * (py - by) < 0) covered = 0;
+                        }
+                        if (!covered) continue;
+                        float z = plane[PLANE_Z][0] + plane[PLANE_Z][1] * x + plane[PLANE_Z][2] * py;
+                        depth[lane] = z <= 0.0f ? 0 : z >= 65535.0f ? 65535 : (int)z;
+                        if (state->depthTest && !depthPasses(state->depthFunc, depth[lane], depthRow[x])) continue;
+                        attribute[PLANE_INV_W][lane] = plane[PLANE_INV_W][0] + plane[PLANE_INV_W][1] * x + plane[PLANE_INV_W][2] * py;
+                        float w = 1.0f / attribute[PLANE_INV_W][lane];
+                        for (int p = PLANE_U; p < PLANE_COUNT; p++) {
+                            attribute[p][lane] = (plane[p][0] + plane[p][1] * x + plane[p][2] * py) * w;
+                        }
+                        mask |= 1 << lane;
+                    }
+#endif
+                    for (int lane = 0; lane < LANES; lane++) {
+                        if (!(mask & (1 << lane))) continue;
+                        int x = px + lane;
+                        Color texel = 0;
+                        if (state->texture) {
+                            float u = attribute[PLANE_U][lane], v = attribute[PLANE_V][lane];
+                            float lod = state->texLod ? textureLod(plane, u, v, attribute[PLANE_INV_W][lane]) : 0.0f;
+                            texel = sampleTexture(state, u, v, lod);
+                        }
+                        if (shadeFragment(state, texel,
+                                          clampColor(attribute[PLANE_R][lane]), clampColor(attribute[PLANE_G][lane]),
+                                          clampColor(attribute[PLANE_B][lane]), clampColor(attribute[PLANE_A][lane]),
+                                          pixelRow + x)) {
+                            if (state->depthTest) depthRow[x] = (u16)depth[lane];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Binned, multi-threaded rasterisation for the software GE
+ *
+ * Queued triangles are sorted into bins of 32x32 screen pixels by their
+ * bounding boxes. A flush rasterises the bins with one job per raster
+ * thread on the job system, the calling thread included. Every bin is owned
+ * by one thread at a time and processes its triangles in submission order,
+ * so the result is the same as with a single thread.
+ */
+
+#include "softgu.h"
+
+#include <stdlib.h>
+#include <atomic>
+
+#define BIN_SIZE 32
+#define BINS_X ((PLATFORM_SCREEN_WIDTH + BIN_SIZE - 1) / BIN_SIZE)
+#define BINS_Y ((PLATFORM_SCREEN_HEIGHT + BIN_SIZE - 1) / BIN_SIZE)
+#define BIN_COUNT (BINS_X * BINS_Y)
+#define QUEUE_SIZE 16384
+
+typedef struct {
+    int* triangles;  /* indices into g_triangles */
+    int count;
+    int capacity;
+} Bin;
+
+static RasterTriangle* g_triangles = NULL;
+static int g_triangle_count = 0;
+static Bin g_bins[BIN_COUNT];
+static Color* g_target = NULL;
+
+/* the jobs of a flush, 0 until the first setRasterThreads */
+static int g_thread_count = 0;
+static std::atomic<int> g_next_bin(0);
+
+static void addToBin(Bin* bin, int triangle)
+{
+    if (bin->count == bin->capacity) {
+        bin->capacity = bin->capacity ? bin->capacity * 2 : 64;
+        bin->triangles = (int*) realloc(bin->triangles, bin->capacity * sizeof(int));
+    }
+    bin->triangles[bin->count++] = triangle;
+}
+
+/* rasterise bins until none is left, run by every job of a flush */
+static void rasterizeBins(void* data, int begin, int end)
+{
+    for (;;) {
+        int index = g_next_bin.fetch_add(1);
+        if (index >= BIN_COUNT) break;
+        const Bin* bin = &g_bins[index];
+        int x0 = (index % BINS_X) * BIN_SIZE;
+        int y0 = (index / BINS_X) * BIN_SIZE;
+        int x1 = x0 + BIN_SIZE < PLATFORM_SCREEN_WIDTH ? x0 + BIN_SIZE : PLATFORM_SCREEN_WIDTH;
+        int y1 = y0 + BIN_SIZE < PLATFORM_SCREEN_HEIGHT ? y0 + BIN_SIZE : PLATFORM_SCREEN_HEIGHT;
+        for (int i = 0; i < bin->count; i++) {
+            rasterizeTriangle(&g_triangles[bin->triangles[i]], g_target, x0, y0, x1, y1);
+        }
+    }
+}
+
+void setRasterThreads(int count)
+{
+    if (count <= 0 || count > getJobThreads()) count = getJobThreads();
+    if (count > RASTER_MAX_THREADS) count = RASTER_MAX_THREADS;
+    if (count == g_thread_count) return;
+    if (g_thread_count > 0) flushTriangles();
+    g_thread_count = count;
+}
+
+int getRasterThreads(void)
+{
+    if (g_thread_count == 0) setRasterThreads(0);
+    return g_thread_count;
+}
+
+void queueTriangle(const RasterTriangle* triangle, Color* framebuffer)
+{
+    if (g_triangles == NULL) {
+        g_triangles = (RasterTriangle*) malloc(QUEUE_SIZE * sizeof(RasterTriangle));
+    }
+    if (g_triangle_count == QUEUE_SIZE || (g_target != framebuffer && g_triangle_count > 0)) {
+        flushTriangles();
+    }
+    g_target = framebuffer;
+
+    int index = g_triangle_count++;
+    g_triangles[index] = *triangle;
+    int bx0 = triangle->minX / BIN_SIZE;
+    int by0 = triangle->minY / BIN_SIZE;
+    int bx1 = (triangle->maxX - 1) / BIN_SIZE;
+    int by1 = (triangle->maxY - 1) / BIN_SIZE;
+    for (int by = by0; by <= by1; by++) {
+        for (int bx = bx0; bx <= bx1; bx++) addToBin(&g_bins[by * BINS_X + bx], index);
+    }
+}
+
+void flushTriangles(void)
+{
+    if (g_triangle_count == 0) return;
+    int threads = getRasterThreads();
+
+    g_next_bin = 0;
+    parallelFor(0, threads, 1, rasterizeBins, NULL);
+
+    for (int i = 0; i < BIN_COUNT; i++) g_bins[i].count = 0;
+    g_triangle_count = 0;
+}
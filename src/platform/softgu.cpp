@@ -0,0 +1,1321 @@
+/*
+ * Software GE for the Linux platform
+ * Implements the GU and GUM functions: render state, matrices, vertex
+ * decoding, transformation, clipping and primitive assembly. The triangles
+ * are queued for rasterisation until sceGuFinish or sceGuSync, or until
+ * something else accesses the frame buffer.
+ */
+
+#include "softgu.h"
+#include "vertexformat.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/* Frame buffer access from platform_linux.cpp */
+Color* getVramDrawBuffer(void);
+void emuFlipBuffers(void);
+
+/*
+ * A vertex in clip space
+ */
+typedef struct {
+    float x, y, z, w;
+    float u, v;        /* texels */
+    float r, g, b, a;  /* 0 - 255 */
+} ClipVertex;
+
+/*
+ * Clipping - triangles are clipped against w > 0, the near and far planes
+ * and a guard band around the viewport, which keeps the screen coordinates
+ * small enough for the fixed point edge functions. The scissor rectangle
+ * does the rest.
+ */
+#define CLIP_PLANE_COUNT 7
+#define CLIP_MAX_VERTICES (3 + CLIP_PLANE_COUNT)
+#define CLIP_W_EPSILON 1e-5f
+#define GUARD_BAND_PIXELS 1024.0f
+
+/* render states referenced by the queued triangles */
+#define MAX_QUEUED_STATES 256
+
+/*
+ * GE state
+ */
+static RasterState g_raster_state;
+static int g_enabled = 0;                /* bit mask of the enabled GU_* states */
+static Color g_clear_color = 0;
+static u16 g_clear_depth = 0;
+static int g_front_face = GU_CW;
+static int g_shade_model = GU_SMOOTH;
+static Color g_material_color = 0xffffffff;
+static int g_scissor[4] = { 0, 0, PLATFORM_SCREEN_WIDTH, PLATFORM_SCREEN_HEIGHT };
+static float g_offset_x = 0, g_offset_y = 0;
+static float g_viewport_x = 0, g_viewport_y = 0;           /* center */
+static float g_viewport_width = PLATFORM_SCREEN_WIDTH / 2;  /* half width */
+static float g_viewport_height = -PLATFORM_SCREEN_HEIGHT / 2;
+static float g_depth_center = 0, g_depth_scale = 0;
+static float g_guard_x = 1, g_guard_y = 1;
+static float g_texture_scale_u = 1, g_texture_scale_v = 1;
+static float g_texture_offset_u = 0, g_texture_offset_v = 0;
+static int g_texture_max_mips = 0;
+static const AlphaRuns* g_texture_runs = NULL;
+static float g_world_view_projection[16];  /* used by sceGuDrawArray, column major */
+static float g_world[16];                  /* the model matrix for lighting */
+
+static RasterState g_queued_states[MAX_QUEUED_STATES];
+static int g_queued_state_count = 0;
+
+/* transformed vertices of the current draw call */
+static ClipVertex* g_vertices = NULL;
+static int g_vertex_capacity = 0;
+
+/* g_vertex_stamps[i] == g_draw_stamp, if vertex i is transformed already */
+static u32* g_vertex_stamps = NULL;
+static u32 g_draw_stamp = 0;
+
+/* the vertices transformed by an indexed draw call */
+static int* g_transformed = NULL;
+
+/* the vertices of the primitives, in order */
+static const ClipVertex** g_elements = NULL;
+static int g_element_capacity = 0;
+
+static void resetMatrixStacks(void);
+
+static inline int isEnabled(int state)
+{
+    return (g_enabled >> state) & 1;
+}
+
+static void loadIdentityMatrix(float* matrix)
+{
+    memset(matrix, 0, 16 * sizeof(float));
+    matrix[0] = matrix[5] = matrix[10] = matrix[15] = 1.0f;
+}
+
+/* result = a * b, column major, result may be a or b */
+static void multiplyMatrix(float* result, const float* a, const float* b)
+{
+#if defined(__SSE__)
+    /* every column of the result is a linear combination of the columns of a */
+    __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+    __m128 product[4];
+    for (int column = 0; column < 4; column++) {
+        __m128 b0 = _mm_set1_ps(b[column * 4]);
+        __m128 b1 = _mm_set1_ps(b[column * 4 + 1]);
+        __m128 b2 = _mm_set1_ps(b[column * 4 + 2]);
+        __m128 b3 = _mm_set1_ps(b[column * 4 + 3]);
+        product[column] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, b0), _mm_mul_ps(a1, b1)),
+                                     _mm_add_ps(_mm_mul_ps(a2, b2), _mm_mul_ps(a3, b3)));
+    }
+    for (int column = 0; column < 4; column++) _mm_storeu_ps(result + column * 4, product[column]);
+#else
+    float product[16];
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++) {
+            product[column * 4 + row] =
+                a[row] * b[column * 4] + a[4 + row] * b[column * 4 + 1] +
+                a[8 + row] * b[column * 4 + 2] + a[12 + row] * b[column * 4 + 3];
+        }
+    }
+    memcpy(result, product, sizeof(product));
+#endif
+}
+
+/* rasterise the queued triangles, before the frame buffer is accessed otherwise */
+static void flushQueue(void)
+{
+    flushTriangles();
+    g_queued_state_count = 0;
+}
+
+/* a copy of the render state, which lives until the next flush */
+static const RasterState* queuedRasterState(void)
+{
+    if (g_queued_state_count > 0 &&
+        memcmp(&g_queued_states[g_queued_state_count - 1], &g_raster_state, sizeof(RasterState)) == 0) {
+        return &g_queued_states[g_queued_state_count - 1];
+    }
+    if (g_queued_state_count == MAX_QUEUED_STATES) flushQueue();
+    g_queued_states[g_queued_state_count] = g_raster_state;
+    return &g_queued_states[g_queued_state_count++];
+}
+
+static void updateRasterState(void)
+{
+    RasterState* state = &g_raster_state;
+    state->depthTest = isEnabled(GU_DEPTH_TEST);
+    state->alphaTest = isEnabled(GU_ALPHA_TEST);
+    state->blend = isEnabled(GU_BLEND);
+    state->texture = isEnabled(GU_TEXTURE_2D) && state->texLevels[0].data != NULL;
+    if (state->texture) {
+        /* the mipmaps up to the sceGuTexMode maximum, which have been set */
+        int count = 1;
+        while (count <= g_texture_max_mips && count < RASTER_TEXTURE_LEVELS && state->texLevels[count].data) count++;
+        state->texLevelCount = count;
+        for (int i = 0; i < count; i++) {
+            TextureLevel* level = &state->texLevels[i];
+            level->scaleU = (float)level->width / state->texLevels[0].width;
+            level->scaleV = (float)level->height / state->texLevels[0].height;
+        }
+        state->texLod = (count > 1 && (state->texMinFilter & 4)) ||
+                        (state->texMinFilter & 1) != (state->texMagFilter & 1);
+    }
+    if (isEnabled(GU_SCISSOR_TEST)) {
+        state->scissorX0 = g_scissor[0] > 0 ? g_scissor[0] : 0;
+        state->scissorY0 = g_scissor[1] > 0 ? g_scissor[1] : 0;
+        state->scissorX1 = g_scissor[2] < PLATFORM_SCREEN_WIDTH ? g_scissor[2] : PLATFORM_SCREEN_WIDTH;
+        state->scissorY1 = g_scissor[3] < PLATFORM_SCREEN_HEIGHT ? g_scissor[3] : PLATFORM_SCREEN_HEIGHT;
+    } else {
+        state->scissorX0 = 0;
+        state->scissorY0 = 0;
+        state->scissorX1 = PLATFORM_SCREEN_WIDTH;
+        state->scissorY1 = PLATFORM_SCREEN_HEIGHT;
+    }
+}
+
+/*
+ * Vertex decoding
+ */
+
+static inline float readUnsigned(const u8* data, int size, int index)
+{
+    switch (size) {
+    case 1: return data[index];
+    case 2: return ((const u16*)data)[index];
+    default: return ((const float*)data)[index];
+    }
+}
+
+static inline float readSigned(const u8* data, int size, int index)
+{
+    switch (size) {
+    case 1: return ((const s8*)data)[index];
+    case 2: return ((const s16*)data)[index];
+    default: return ((const float*)data)[index];
+    }
+}
+
+/* scale of fixed point components outside of through mode */
+static inline float normalizeScale(int size)
+{
+    return size == 1 ? 1.0f / 128.0f : size == 2 ? 1.0f / 32768.0f : 1.0f;
+}
+
+static inline int expandBits(int value, int bits)
+{
+    return (value << (8 - bits)) | (value >> (2 * bits - 8));
+}
+
+static void decodeColor(int format, const u8* data, ClipVertex* vertex)
+{
+    int r, g, b, a;
+    u16 packed = *(const u16*)data;
+    switch (format) {
+    case GU_COLOR_5650:
+        r = expandBits(packed & 0x1f, 5);
+        g = expandBits((packed >> 5) & 0x3f, 6);
+        b = expandBits(packed >> 11, 5);
+        a = 255;
+        break;
+    case GU_COLOR_5551:
+        r = expandBits(packed & 0x1f, 5);
+        g = expandBits((packed >> 5) & 0x1f, 5);
+        b = expandBits((packed >> 10) & 0x1f, 5);
+        a = (packed >> 15) ? 255 : 0;
+        break;
+    case GU_COLOR_4444:
+        r = (packed & 0xf) * 17;
+        g = ((packed >> 4) & 0xf) * 17;
+        b = ((packed >> 8) & 0xf) * 17;
+        a = (packed >> 12) * 17;
+        break;
+    default: {
+        Color color = *(const Color*)data;
+        r = COLOR_R(color);
+        g = COLOR_G(color);
+        b = COLOR_B(color);
+        a = COLOR_A(color);
+        break;
+    }
+    }
+    vertex->r = r;
+    vertex->g = g;
+    vertex->b = b;
+    vertex->a = a;
+}
+
+/* the constants for transformVertex */
+typedef struct {
+    const VertexFormat* format;
+    float positionScale;
+    float textureScale;
+    float scaleU, scaleV;
+    float offsetU, offsetV;
+} VertexTransform;
+
+/*
+ * Decode a vertex and transform it to clip space, or to screen space in
+ * through mode
+ */
+static void transformVertex(const VertexTransform* transform, const u8* data, ClipVertex* vertex)
+{
+    const VertexFormat* format = transform->format;
+    const float* m = g_world_view_projection;
+
+    float x = 0, y = 0, z = 0;
+    if (format->positionSize) {
+        const u8* position = data + format->positionOffset;
+        if (format->through) {
+            x = readSigned(position, format->positionSize, 0);
+            y = readSigned(position, format->positionSize, 1);
+            z = readUnsigned(position, format->positionSize, 2);
+        } else {
+            x = readSigned(position, format->positionSize, 0) * transform->positionScale;
+            y = readSigned(position, format->positionSize, 1) * transform->positionScale;
+            z = readSigned(position, format->positionSize, 2) * transform->positionScale;
+        }
+    }
+    if (format->through) {
+        vertex->x = x;
+        vertex->y = y;
+        vertex->z = z;
+        vertex->w = 1.0f;
+    } else {
+        vertex->x = m[0] * x + m[4] * y + m[8] * z + m[12];
+        vertex->y = m[1] * x + m[5] * y + m[9] * z + m[13];
+        vertex->z = m[2] * x + m[6] * y + m[10] * z + m[14];
+        vertex->w = m[3] * x + m[7] * y + m[11] * z + m[15];
+    }
+
+    if (format->textureSize) {
+        const u8* texture = data + format->textureOffset;
+        float u = readUnsigned(texture, format->textureSize, 0) * transform->textureScale;
+        float v = readUnsigned(texture, format->textureSize, 1) * transform->textureScale;
+        if (format->through) {
+            vertex->u = u;
+            vertex->v = v;
+        } else {
+            vertex->u = u * transform->scaleU + transform->offsetU;
+            vertex->v = v * transform->scaleV + transform->offsetV;
+        }
+    } else {
+        vertex->u = vertex->v = 0;
+    }
+
+    if (format->colorFormat) {
+        decodeColor(format->colorFormat, data + format->colorOffset, vertex);
+    } else {
+        vertex->r = COLOR_R(g_material_color);
+        vertex->g = COLOR_G(g_material_color);
+        vertex->b = COLOR_B(g_material_color);
+        vertex->a = COLOR_A(g_material_color);
+    }
+}
+
+/*
+ * Replace the colors of transformed vertices by their lit colors, in
+ * batches of LIGHT_BATCH. slots are the indices of the vertices, NULL for
+ * the first count vertices.
+ */
+static void lightVertices(const VertexTransform* transform, const u8* data, const int* slots, int count)
+{
+    static LightBatch batch;
+    const VertexFormat* format = transform->format;
+    float normalScale = normalizeScale(format->normalSize);
+    int enabledLights = (g_enabled >> GU_LIGHT0) & 0xf;
+
+    for (int start = 0; start < count; start += LIGHT_BATCH) {
+        int n = count - start < LIGHT_BATCH ? count - start : LIGHT_BATCH;
+        for (int i = 0; i < n; i++) {
+            int slot = slots ? slots[start + i] : start + i;
+            const u8* vertex = data + slot * format->size;
+            const u8* position = vertex + format->positionOffset;
+            const u8* normal = vertex + format->normalOffset;
+            batch.x[i] = format->positionSize ? readSigned(position, format->positionSize, 0) * transform->positionScale : 0;
+            batch.y[i] = format->positionSize ? readSigned(position, format->positionSize, 1) * transform->positionScale : 0;
+            batch.z[i] = format->positionSize ? readSigned(position, format->positionSize, 2) * transform->positionScale : 0;
+            batch.nx[i] = format->normalSize ? readSigned(normal, format->normalSize, 0) * normalScale : 0;
+            batch.ny[i] = format->normalSize ? readSigned(normal, format->normalSize, 1) * normalScale : 0;
+            batch.nz[i] = format->normalSize ? readSigned(normal, format->normalSize, 2) * normalScale : 0;
+            const ClipVertex* clipVertex = &g_vertices[slot];
+            batch.r[i] = clipVertex->r * (1.0f / 255.0f);
+            batch.g[i] = clipVertex->g * (1.0f / 255.0f);
+            batch.b[i] = clipVertex->b * (1.0f / 255.0f);
+        }
+        lightBatch(&batch, n, g_world, enabledLights, g_material_color);
+        for (int i = 0; i < n; i++) {
+            ClipVertex* clipVertex = &g_vertices[slots ? slots[start + i] : start + i];
+            clipVertex->r = batch.r[i] >= 1.0f ? 255.0f : batch.r[i] * 255.0f;
+            clipVertex->g = batch.g[i] >= 1.0f ? 255.0f : batch.g[i] * 255.0f;
+            clipVertex->b = batch.b[i] >= 1.0f ? 255.0f : batch.b[i] * 255.0f;
+        }
+    }
+}
+
+static void reserveVertices(int count)
+{
+    if (count <= g_vertex_capacity) return;
+    free(g_vertices);
+    free(g_vertex_stamps);
+    g_vertex_capacity = count;
+    g_vertices = (ClipVertex*) malloc(count * sizeof(ClipVertex));
+    g_vertex_stamps = (u32*) calloc(count, sizeof(u32));
+}
+
+static inline int readIndex(const void* indices, int indexType, int i)
+{
+    return indexType == GU_INDEX_8BIT ? ((const u8*)indices)[i] : ((const u16*)indices)[i];
+}
+
+/*
+ * Transform the vertices of a draw call. Returns the vertex of every
+ * element of the primitives. With indices, every referenced vertex is
+ * transformed once, no matter how many primitives share it.
+ */
+static const ClipVertex** transformVertices(const VertexFormat* format, int vtype, int count,
+                                            const void* indices, const void* vertices)
+{
+    VertexTransform transform;
+    transform.format = format;
+    transform.positionScale = format->through ? 1.0f : normalizeScale(format->positionSize);
+    transform.textureScale = format->through ? 1.0f : normalizeScale(format->textureSize);
+    const TextureLevel* texture = &g_raster_state.texLevels[0];
+    transform.scaleU = g_texture_scale_u * texture->width;
+    transform.scaleV = g_texture_scale_v * texture->height;
+    transform.offsetU = g_texture_offset_u * texture->width;
+    transform.offsetV = g_texture_offset_v * texture->height;
+
+    if (count > g_element_capacity) {
+        free(g_elements);
+        free(g_transformed);
+        g_element_capacity = count;
+        g_elements = (const ClipVertex**) malloc(count * sizeof(ClipVertex*));
+        g_transformed = (int*) malloc(count * sizeof(int));
+    }
+
+    const u8* data = (const u8*)vertices;
+    int lighting = isEnabled(GU_LIGHTING) && !format->through;
+    int indexType = vtype & GU_INDEX_BITS;
+    if (indices == NULL || indexType == 0) {
+        reserveVertices(count);
+        for (int i = 0; i < count; i++) {
+            transformVertex(&transform, data + i * format->size, &g_vertices[i]);
+            g_elements[i] = &g_vertices[i];
+        }
+        if (lighting) lightVertices(&transform, data, NULL, count);
+        return g_elements;
+    }
+
+    int maxIndex = 0;
+    for (int i = 0; i < count; i++) {
+        int index = readIndex(indices, indexType, i);
+        if (index > maxIndex) maxIndex = index;
+    }
+    reserveVertices(maxIndex + 1);
+    if (++g_draw_stamp == 0) {
+        memset(g_vertex_stamps, 0, g_vertex_capacity * sizeof(u32));
+        g_draw_stamp = 1;
+    }
+    int transformedCount = 0;
+    for (int i = 0; i < count; i++) {
+        int index = readIndex(indices, indexType, i);
+        if (g_vertex_stamps[index] != g_draw_stamp) {
+            transformVertex(&transform, data + index * format->size, &g_vertices[index]);
+            g_vertex_stamps[index] = g_draw_stamp;
+            g_transformed[transformedCount++] = index;
+        }
+        g_elements[i] = &g_vertices[index];
+    }
+    if (lighting) lightVertices(&transform, data, g_transformed, transformedCount);
+    return g_elements;
+}
+
+/*
+ * Clipping and projection
+ */
+
+static inline float clipDistance(const ClipVertex* vertex, int plane)
+{
+    switch (plane) {
+    case 0: return vertex->w - CLIP_W_EPSILON;
+    case 1: return vertex->w + vertex->z;
+    case 2: return vertex->w - vertex->z;
+    case 3: return g_guard_x * vertex->w - vertex->x;
+    case 4: return g_guard_x * vertex->w + vertex->x;
+    case 5: return g_guard_y * vertex->w - vertex->y;
+    default: return g_guard_y * vertex->w + vertex->y;
+    }
+}
+
+static inline int clipCode(const ClipVertex* vertex)
+{
+    int code = 0;
+    for (int plane = 0; plane < CLIP_PLANE_COUNT; plane++) {
+        if (clipDistance(vertex, plane) < 0) code |= 1 << plane;
+    }
+    return code;
+}
+
+static void interpolateVertex(ClipVertex* result, const ClipVertex* a, const ClipVertex* b, float t)
+{
+    const float* from = (const float*)a;
+    const float* to = (const float*)b;
+    float* out = (float*)result;
+    for (size_t i = 0; i < sizeof(ClipVertex) / sizeof(float); i++) {
+        out[i] = from[i] + (to[i] - from[i]) * t;
+    }
+}
+
+static void projectVertex(const ClipVertex* vertex, ScreenVertex* result, int through)
+{
+    if (through) {
+        result->x = vertex->x;
+        result->y = vertex->y;
+        result->z = vertex->z;
+        result->invW = 1.0f;
+    } else {
+        float invW = 1.0f / vertex->w;
+        result->x = g_viewport_x + vertex->x * invW * g_viewport_width - g_offset_x;
+        result->y = g_viewport_y + vertex->y * invW * g_viewport_height - g_offset_y;
+        result->z = g_depth_center + vertex->z * invW * g_depth_scale;
+        result->invW = invW;
+    }
+    result->u = vertex->u;
+    result->v = vertex->v;
+    result->r = vertex->r;
+    result->g = vertex->g;
+    result->b = vertex->b;
+    result->a = vertex->a;
+}
+
+static void rasterizeScreenTriangle(const ScreenVertex* v0, const ScreenVertex* v1, const ScreenVertex* v2,
+                                    int cull, const RasterState* state)
+{
+    const ScreenVertex* vertices[3] = { v0, v1, v2 };
+    RasterTriangle triangle;
+    if (!setupTriangle(&triangle, vertices, cull, state)) return;
+    markDrawBufferDirty(triangle.minX, triangle.minY, triangle.maxX - triangle.minX, triangle.maxY - triangle.minY);
+    queueTriangle(&triangle, getVramDrawBuffer());
+}
+
+/* Sutherland-Hodgman against the planes the triangle crosses, then a fan */
+static void clipTriangle(const ClipVertex* v0, const ClipVertex* v1, const ClipVertex* v2, int planes,
+                         int cull, const RasterState* state)
+{
+    ClipVertex buffers[2][CLIP_MAX_VERTICES];
+    ClipVertex* input = buffers[0];
+    ClipVertex* output = buffers[1];
+    int count = 3;
+    input[0] = *v0;
+    input[1] = *v1;
+    input[2] = *v2;
+
+    for (int plane = 0; plane < CLIP_PLANE_COUNT; plane++) {
+        if (!(planes & (1 << plane))) continue;
+        int outputCount = 0;
+        for (int i = 0; i < count; i++) {
+            const ClipVertex* current = &input[i];
+            const ClipVertex* next = &input[(i + 1) % count];
+            float currentDistance = clipDistance(current, plane);
+            float nextDistance = clipDistance(next, plane);
+            if (currentDistance >= 0) output[outputCount++] = *current;
+            if ((currentDistance >= 0) != (nextDistance >= 0)) {
+                interpolateVertex(&output[outputCount++], current, next, currentDistance / (currentDistance - nextDistance));
+            }
+        }
+        ClipVertex* swap = input; input = output; output = swap;
+        count = outputCount;
+        if (count < 3) return;
+    }
+
+    ScreenVertex projected[CLIP_MAX_VERTICES];
+    for (int i = 0; i < count; i++) projectVertex(&input[i], &projected[i], 0);
+    for (int i = 1; i + 1 < count; i++) {
+        rasterizeScreenTriangle(&projected[0], &projected[i], &projected[i + 1], cull, state);
+    }
+}
+
+static void drawTriangle(const ClipVertex* v0, const ClipVertex* v1, const ClipVertex* v2, int through,
+                         int cull, const RasterState* state)
+{
+    ClipVertex flat[3];
+    if (g_shade_model == GU_FLAT) {
+        /* the last vertex gives the color */
+        flat[0] = *v0;
+        flat[1] = *v1;
+        flat[2] = *v2;
+        flat[0].r = flat[1].r = v2->r;
+        flat[0].g = flat[1].g = v2->g;
+        flat[0].b = flat[1].b = v2->b;
+        flat[0].a = flat[1].a = v2->a;
+        v0 = &flat[0];
+        v1 = &flat[1];
+        v2 = &flat[2];
+    }
+
+    if (!through) {
+        int code0 = clipCode(v0), code1 = clipCode(v1), code2 = clipCode(v2);
+        if (code0 & code1 & code2) return;
+        if (code0 | code1 | code2) {
+            clipTriangle(v0, v1, v2, code0 | code1 | code2, cull, state);
+            return;
+        }
+    }
+
+    ScreenVertex projected[3];
+    projectVertex(v0, &projected[0], through);
+    projectVertex(v1, &projected[1], through);
+    projectVertex(v2, &projected[2], through);
+    rasterizeScreenTriangle(&projected[0], &projected[1], &projected[2], cull, state);
+}
+
+static void copyVisiblePixels(Color* dest, const Color* source, int count)
+{
+    for (int x = 0; x < count; x++) {
+        if (source[x] & 0xFF000000) dest[x] = source[x];
+    }
+}
+
+/*
+ * The fast path for the sprites of blitAlphaImageToScreen. With alpha runs
+ * of the texture, transparent runs are skipped and opaque runs copied.
+ */
+static void drawSprites(const void* vertices)
+{
+    const TextureLevel* texture = &g_raster_state.texLevels[0];
+    const SpriteVertex* v = (const SpriteVertex*)vertices;
+    int sx = v[0].u;
+    int sy = v[0].v;
+    int dx = v[0].x;
+    int dy = v[0].y;
+    int width = v[1].x - v[0].x;
+    int height = v[1].y - v[0].y;
+    Color* dest = getVramDrawBuffer();
+    const AlphaRuns* runs = g_texture_runs;
+    if (runs && (runs->data != texture->data || runs->stride != texture->stride ||
+                 sx + width > runs->width || sy + height > runs->height)) {
+        runs = NULL;
+    }
+    flushQueue();
+    for (int y = 0; y < height; y++) {
+        const Color* sourceRow = texture->data + (y + sy) * texture->stride;
+        Color* destRow = dest + dx - sx + (y + dy) * PLATFORM_LINE_SIZE;
+        if (!runs) {
+            copyVisiblePixels(destRow + sx, sourceRow + sx, width);
+            continue;
+        }
+        for (int i = runs->rows[y + sy]; i < runs->rows[y + sy + 1]; i++) {
+            const AlphaRun* run = &runs->runs[i];
+            if (run->x >= sx + width) break;
+            int start = run->x > sx ? run->x : sx;
+            int end = run->x + run->count < sx + width ? run->x + run->count : sx + width;
+            if (start >= end || run->type == ALPHA_RUN_TRANSPARENT) continue;
+            if (run->type == ALPHA_RUN_OPAQUE) {
+                memcpy(destRow + start, sourceRow + start, (end - start) * sizeof(Color));
+            } else {
+                copyVisiblePixels(destRow + start, sourceRow + start, end - start);
+            }
+        }
+    }
+    markDrawBufferDirty(dx, dy, width, height);
+}
+
+/*
+ * GU functions
+ */
+
+void sceGuInit(void)
+{
+    RasterState* state = &g_raster_state;
+    memset(state, 0, sizeof(RasterState));
+    state->depthFunc = GU_ALWAYS;
+    state->alphaFunc = GU_ALWAYS;
+    state->alphaMask = 0xff;
+    state->blendOp = GU_ADD;
+    state->blendSrc = GU_SRC_ALPHA;
+    state->blendDst = GU_ONE_MINUS_SRC_ALPHA;
+    state->texFunc = GU_TFX_MODULATE;
+    state->texAlpha = GU_TCC_RGBA;
+    g_texture_max_mips = 0;
+    g_texture_runs = NULL;
+    resetList();
+    loadIdentityMatrix(g_world_view_projection);
+    loadIdentityMatrix(g_world);
+    resetMatrixStacks();
+    resetLights();
+}
+
+int sceGuDisplay(int state) { (void)state; return 0; }
+/* the commands are recorded by displaylist.cpp, not in the given list */
+void sceGuStart(int cid, void* list)
+{
+    (void)cid;
+    (void)list;
+    startList();
+}
+
+int sceGuFinish(void)
+{
+    executeList();
+    flushQueue();
+    g_texture_runs = NULL;
+    return 0;
+}
+
+int sceGuSync(int mode, int a1)
+{
+    (void)mode;
+    (void)a1;
+    flushQueue();
+    return 0;
+}
+
+void* sceGuSwapBuffers(void)
+{
+    flushQueue();
+    emuFlipBuffers();
+    return NULL;
+}
+
+void sceGuClearColor(unsigned int color)
+{
+    Command* command = newCommand(CMD_CLEAR_COLOR);
+    if (command) {
+        command->args[0].u = color;
+        recordCommand(command);
+        return;
+    }
+    g_clear_color = color;
+}
+
+void sceGuClearDepth(unsigned int depth)
+{
+    Command* command = newCommand(CMD_CLEAR_DEPTH);
+    if (command) {
+        command->args[0].u = depth;
+        recordCommand(command);
+        return;
+    }
+    g_clear_depth = depth;
+}
+
+void sceGuClear(int flags)
+{
+    Command* command = newCommand(CMD_CLEAR);
+    if (command) {
+        command->args[0].i = flags;
+        recordCommand(command);
+        return;
+    }
+    flushQueue();
+    if (flags & GU_COLOR_BUFFER_BIT) {
+        Color* dest = getVramDrawBuffer();
+        for (int n = 0; n < PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT; n++) {
+            dest[n] = g_clear_color;
+        }
+        markDrawBufferDirty(0, 0, PLATFORM_SCREEN_WIDTH, PLATFORM_SCREEN_HEIGHT);
+    }
+    if (flags & GU_DEPTH_BUFFER_BIT) {
+        for (int n = 0; n < PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT; n++) {
+            g_depth_buffer[n] = g_clear_depth;
+        }
+    }
+}
+
+void sceGuDrawBuffer(int psm, void* fbp, int fbw) { (void)psm; (void)fbp; (void)fbw; }
+void sceGuDispBuffer(int width, int height, void* dispbp, int dispbw) { (void)width; (void)height; (void)dispbp; (void)dispbw; }
+void sceGuDepthBuffer(void* zbp, int zbw) { (void)zbp; (void)zbw; }
+
+void sceGuOffset(unsigned int x, unsigned int y)
+{
+    Command* command = newCommand(CMD_OFFSET);
+    if (command) {
+        command->args[0].u = x;
+        command->args[1].u = y;
+        recordCommand(command);
+        return;
+    }
+    g_offset_x = x;
+    g_offset_y = y;
+}
+
+void sceGuViewport(int cx, int cy, int width, int height)
+{
+    Command* command = newCommand(CMD_VIEWPORT);
+    if (command) {
+        command->args[0].i = cx;
+        command->args[1].i = cy;
+        command->args[2].i = width;
+        command->args[3].i = height;
+        recordCommand(command);
+        return;
+    }
+    g_viewport_x = cx;
+    g_viewport_y = cy;
+    g_viewport_width = width * 0.5f;
+    g_viewport_height = -height * 0.5f;
+    g_guard_x = width ? GUARD_BAND_PIXELS / fabsf(g_viewport_width) : 1.0f;
+    g_guard_y = height ? GUARD_BAND_PIXELS / fabsf(g_viewport_height) : 1.0f;
+}
+
+void sceGuDepthRange(int near, int far)
+{
+    Command* command = newCommand(CMD_DEPTH_RANGE);
+    if (command) {
+        command->args[0].i = near;
+        command->args[1].i = far;
+        recordCommand(command);
+        return;
+    }
+    g_depth_center = (near + far) * 0.5f;
+    g_depth_scale = (far - near) * 0.5f;
+}
+
+/* like on the PSP, w and h are the right and bottom end of the rectangle */
+void sceGuScissor(int x, int y, int w, int h)
+{
+    Command* command = newCommand(CMD_SCISSOR);
+    if (command) {
+        command->args[0].i = x;
+        command->args[1].i = y;
+        command->args[2].i = w;
+        command->args[3].i = h;
+        recordCommand(command);
+        return;
+    }
+    g_scissor[0] = x;
+    g_scissor[1] = y;
+    g_scissor[2] = w;
+    g_scissor[3] = h;
+}
+
+void sceGuEnable(int state)
+{
+    Command* command = newCommand(CMD_ENABLE);
+    if (command) {
+        command->args[0].i = state;
+        command->args[1].i = 1;
+        recordCommand(command);
+        return;
+    }
+    if (state >= 0 && state < 32) g_enabled |= 1 << state;
+}
+
+void sceGuDisable(int state)
+{
+    Command* command = newCommand(CMD_ENABLE);
+    if (command) {
+        command->args[0].i = state;
+        command->args[1].i = 0;
+        recordCommand(command);
+        return;
+    }
+    if (state >= 0 && state < 32) g_enabled &= ~(1 << state);
+}
+
+void sceGuAlphaFunc(int func, int value, int mask)
+{
+    Command* command = newCommand(CMD_ALPHA_FUNC);
+    if (command) {
+        command->args[0].i = func;
+        command->args[1].i = value;
+        command->args[2].i = mask;
+        recordCommand(command);
+        return;
+    }
+    g_raster_state.alphaFunc = func;
+    g_raster_state.alphaRef = value;
+    g_raster_state.alphaMask = mask;
+}
+
+void sceGuDepthFunc(int function)
+{
+    Command* command = newCommand(CMD_DEPTH_FUNC);
+    if (command) {
+        command->args[0].i = function;
+        recordCommand(command);
+        return;
+    }
+    g_raster_state.depthFunc = function;
+}
+
+void sceGuFrontFace(int order)
+{
+    Command* command = newCommand(CMD_FRONT_FACE);
+    if (command) {
+        command->args[0].i = order;
+        recordCommand(command);
+        return;
+    }
+    g_front_face = order;
+}
+
+void sceGuShadeModel(int mode)
+{
+    Command* command = newCommand(CMD_SHADE_MODEL);
+    if (command) {
+        command->args[0].i = mode;
+        recordCommand(command);
+        return;
+    }
+    g_shade_model = mode;
+}
+
+void sceGuBlendFunc(int op, int src, int dest, unsigned int srcfix, unsigned int destfix)
+{
+    Command* command = newCommand(CMD_BLEND_FUNC);
+    if (command) {
+        command->args[0].i = op;
+        command->args[1].i = src;
+        command->args[2].i = dest;
+        command->args[3].u = srcfix;
+        command->args[4].u = destfix;
+        recordCommand(command);
+        return;
+    }
+    g_raster_state.blendOp = op;
+    g_raster_state.blendSrc = src;
+    g_raster_state.blendDst = dest;
+    g_raster_state.blendFixSrc = srcfix;
+    g_raster_state.blendFixDst = destfix;
+}
+
+/* only GU_PSM_8888 textures exist here, without swizzling */
+void sceGuTexMode(int tpsm, int maxmips, int a2, int swizzle)
+{
+    Command* command = newCommand(CMD_TEX_MODE);
+    if (command) {
+        command->args[0].i = tpsm;
+        command->args[1].i = maxmips;
+        command->args[2].i = a2;
+        command->args[3].i = swizzle;
+        recordCommand(command);
+        return;
+    }
+    (void)tpsm;
+    (void)a2;
+    (void)swizzle;
+    g_texture_max_mips = maxmips;
+}
+
+void sceGuTexFunc(int tfx, int tcc)
+{
+    Command* command = newCommand(CMD_TEX_FUNC);
+    if (command) {
+        command->args[0].i = tfx;
+        command->args[1].i = tcc;
+        recordCommand(command);
+        return;
+    }
+    g_raster_state.texFunc = tfx;
+    g_raster_state.texAlpha = tcc;
+}
+
+void sceGuTexFilter(int min, int mag)
+{
+    Command* command = newCommand(CMD_TEX_FILTER);
+    if (command) {
+        command->args[0].i = min;
+        command->args[1].i = mag;
+        recordCommand(command);
+        return;
+    }
+    g_raster_state.texMinFilter = min;
+    g_raster_state.texMagFilter = mag;
+}
+
+void sceGuTexImage(int mipmap, int width, int height, int tbw, const void* tbp)
+{
+    Command* command = newCommand(CMD_TEX_IMAGE);
+    if (command) {
+        command->args[0].i = mipmap;
+        command->args[1].i = width;
+        command->args[2].i = height;
+        command->args[3].i = tbw;
+        command->args[4].p = tbp;
+        recordCommand(command);
+        return;
+    }
+    if (mipmap < 0 || mipmap >= RASTER_TEXTURE_LEVELS) return;
+    TextureLevel* level = &g_raster_state.texLevels[mipmap];
+    level->data = (const Color*)tbp;
+    level->width = width;
+    level->height = height;
+    level->stride = tbw;
+}
+
+void setTextureAlphaRuns(const AlphaRuns* runs)
+{
+    Command* command = newCommand(CMD_TEX_ALPHA_RUNS);
+    if (command) {
+        command->args[0].p = runs;
+        recordCommand(command);
+        return;
+    }
+    g_texture_runs = runs;
+}
+
+void sceGuTexScale(float u, float v)
+{
+    Command* command = newCommand(CMD_TEX_SCALE);
+    if (command) {
+        command->args[0].f = u;
+        command->args[1].f = v;
+        recordCommand(command);
+        return;
+    }
+    g_texture_scale_u = u;
+    g_texture_scale_v = v;
+}
+
+void sceGuTexOffset(float u, float v)
+{
+    Command* command = newCommand(CMD_TEX_OFFSET);
+    if (command) {
+        command->args[0].f = u;
+        command->args[1].f = v;
+        recordCommand(command);
+        return;
+    }
+    g_texture_offset_u = u;
+    g_texture_offset_v = v;
+}
+
+void sceGuTexEnvColor(unsigned int color)
+{
+    Command* command = newCommand(CMD_TEX_ENV_COLOR);
+    if (command) {
+        command->args[0].u = color;
+        recordCommand(command);
+        return;
+    }
+    g_raster_state.texEnvColor = color;
+}
+
+void sceGuCopyImage(int psm, int sx, int sy, int width, int height, int srcw, void* src, int dx, int dy, int destw, void* dest)
+{
+    Command* command = newCommand(CMD_COPY_IMAGE);
+    if (command) {
+        CommandArgument* c = (CommandArgument*) listMemory(11 * sizeof(CommandArgument));
+        c[0].i = psm;
+        c[1].i = sx;
+        c[2].i = sy;
+        c[3].i = width;
+        c[4].i = height;
+        c[5].i = srcw;
+        c[6].p = src;
+        c[7].i = dx;
+        c[8].i = dy;
+        c[9].i = destw;
+        c[10].p = dest;
+        command->args[0].p = c;
+        recordCommand(command);
+        return;
+    }
+    (void)psm;
+    flushQueue();
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            ((Color*)dest)[x + dx + (y + dy) * destw] = ((Color*)src)[x + sx + (y + sy) * srcw];
+        }
+    }
+    if (dest == getVramDrawBuffer()) markDrawBufferDirty(dx, dy, width, height);
+}
+
+void sceGuDrawArray(int prim, int vtype, int count, const void* indices, const void* vertices)
+{
+    Command* command = newCommand(CMD_DRAW_ARRAY);
+    if (command) {
+        command->args[0].i = prim;
+        command->args[1].i = vtype;
+        command->args[2].i = count;
+        command->args[3].p = indices;
+        command->args[4].p = vertices;
+        recordCommand(command);
+        return;
+    }
+    if (prim == GU_SPRITES) {
+        drawSprites(vertices);
+        return;
+    }
+    /* points and lines are not supported */
+    if (prim != GU_TRIANGLES && prim != GU_TRIANGLE_STRIP && prim != GU_TRIANGLE_FAN) return;
+    if (count < 3) return;
+
+    VertexFormat format;
+    getVertexFormat(vtype, &format);
+    updateRasterState();
+    const ClipVertex** v = transformVertices(&format, vtype, count, indices, vertices);
+    const RasterState* state = queuedRasterState();
+
+    int cull = RASTER_CULL_NONE;
+    if (isEnabled(GU_CULL_FACE)) cull = g_front_face == GU_CW ? RASTER_CULL_CCW : RASTER_CULL_CW;
+
+    switch (prim) {
+    case GU_TRIANGLES:
+        for (int i = 0; i + 2 < count; i += 3) drawTriangle(v[i], v[i + 1], v[i + 2], format.through, cull, state);
+        break;
+    case GU_TRIANGLE_STRIP:
+        /* every second triangle is reversed, to keep the winding */
+        for (int i = 0; i + 2 < count; i++) {
+            if (i & 1) {
+                drawTriangle(v[i + 1], v[i], v[i + 2], format.through, cull, state);
+            } else {
+                drawTriangle(v[i], v[i + 1], v[i + 2], format.through, cull, state);
+            }
+        }
+        break;
+    case GU_TRIANGLE_FAN:
+        for (int i = 1; i + 1 < count; i++) drawTriangle(v[0], v[i], v[i + 1], format.through, cull, state);
+        break;
+    }
+}
+
+void* sceGuGetMemory(int size)
+{
+    return listMemory(size);
+}
+
+void sceGuAmbientColor(unsigned int color)
+{
+    Command* command = newCommand(CMD_AMBIENT_COLOR);
+    if (command) {
+        command->args[0].u = color;
+        recordCommand(command);
+        return;
+    }
+    g_material_color = color;
+}
+
+
+/*
+ * GUM functions - a matrix stack per mode, like the PSP SDK every operation
+ * multiplies the current matrix from the right. The combined matrix for
+ * sceGuDrawArray is only computed again after a change of the projection,
+ * view or model matrix.
+ */
+
+#define MATRIX_STACK_DEPTH 32
+
+static float g_matrix_stack[4][MATRIX_STACK_DEPTH][16] __attribute__((aligned(16)));
+static int g_matrix_top[4] = { 0, 0, 0, 0 };
+static int g_matrix_mode = GU_MODEL;
+static int g_matrix_dirty = 1;
+
+static inline float* currentMatrix(void)
+{
+    return g_matrix_stack[g_matrix_mode][g_matrix_top[g_matrix_mode]];
+}
+
+static inline void currentMatrixChanged(void)
+{
+    if (g_matrix_mode != GU_TEXTURE) g_matrix_dirty = 1;
+}
+
+static void multiplyCurrentMatrix(const float* matrix)
+{
+    multiplyMatrix(currentMatrix(), currentMatrix(), matrix);
+    currentMatrixChanged();
+}
+
+static void resetMatrixStacks(void)
+{
+    for (int mode = GU_PROJECTION; mode <= GU_TEXTURE; mode++) {
+        g_matrix_top[mode] = 0;
+        loadIdentityMatrix(g_matrix_stack[mode][0]);
+    }
+    g_matrix_mode = GU_MODEL;
+    g_matrix_dirty = 1;
+}
+
+void sceGumMatrixMode(int mode)
+{
+    if (mode >= GU_PROJECTION && mode <= GU_TEXTURE) g_matrix_mode = mode;
+}
+
+void sceGumLoadIdentity(void)
+{
+    loadIdentityMatrix(currentMatrix());
+    currentMatrixChanged();
+}
+
+void sceGumLoadMatrix(const ScePspFMatrix4* m)
+{
+    memcpy(currentMatrix(), m, 16 * sizeof(float));
+    currentMatrixChanged();
+}
+
+void sceGumMultMatrix(const ScePspFMatrix4* m)
+{
+    multiplyCurrentMatrix((const float*)m);
+}
+
+/* like on the PSP, overflows and underflows of the stack are ignored */
+void sceGumPushMatrix(void)
+{
+    int top = g_matrix_top[g_matrix_mode];
+    if (top + 1 >= MATRIX_STACK_DEPTH) return;
+    memcpy(g_matrix_stack[g_matrix_mode][top + 1], g_matrix_stack[g_matrix_mode][top], 16 * sizeof(float));
+    g_matrix_top[g_matrix_mode] = top + 1;
+}
+
+void sceGumPopMatrix(void)
+{
+    if (g_matrix_top[g_matrix_mode] == 0) return;
+    g_matrix_top[g_matrix_mode]--;
+    currentMatrixChanged();
+}
+
+void sceGumPerspective(float fovy, float aspect, float near, float far)
+{
+    float angle = (fovy / 2) * (GU_PI / 180.0f);
+    float cotangent = cosf(angle) / sinf(angle);
+    float deltaZ = near - far;
+    float matrix[16];
+    memset(matrix, 0, sizeof(matrix));
+    matrix[0] = cotangent / aspect;
+    matrix[5] = cotangent;
+    matrix[10] = (far + near) / deltaZ;
+    matrix[11] = -1.0f;
+    matrix[14] = 2.0f * (far * near) / deltaZ;
+    multiplyCurrentMatrix(matrix);
+}
+
+void sceGumOrtho(float left, float right, float bottom, float top, float near, float far)
+{
+    float deltaX = right - left;
+    float deltaY = top - bottom;
+    float deltaZ = far - near;
+    float matrix[16];
+    loadIdentityMatrix(matrix);
+    matrix[0] = 2.0f / deltaX;
+    matrix[5] = 2.0f / deltaY;
+    matrix[10] = -2.0f / deltaZ;
+    matrix[12] = -(right + left) / deltaX;
+    matrix[13] = -(top + bottom) / deltaY;
+    matrix[14] = -(far + near) / deltaZ;
+    multiplyCurrentMatrix(matrix);
+}
+
+static void normalizeVector(ScePspFVector3* v)
+{
+    float length = sqrtf(v->x * v->x + v->y * v->y + v->z * v->z);
+    if (length > 0.0f) {
+        v->x /= length;
+        v->y /= length;
+        v->z /= length;
+    }
+}
+
+static void crossVector(ScePspFVector3* result, const ScePspFVector3* a, const ScePspFVector3* b)
+{
+    result->x = a->y * b->z - a->z * b->y;
+    result->y = a->z * b->x - a->x * b->z;
+    result->z = a->x * b->y - a->y * b->x;
+}
+
+void sceGumLookAt(ScePspFVector3* eye, ScePspFVector3* center, ScePspFVector3* up)
+{
+    ScePspFVector3 forward, side, cameraUp;
+    forward.x = center->x - eye->x;
+    forward.y = center->y - eye->y;
+    forward.z = center->z - eye->z;
+    normalizeVector(&forward);
+    crossVector(&side, &forward, up);
+    normalizeVector(&side);
+    crossVector(&cameraUp, &side, &forward);
+
+    float matrix[16];
+    loadIdentityMatrix(matrix);
+    matrix[0] = side.x;
+    matrix[4] = side.y;
+    matrix[8] = side.z;
+    matrix[1] = cameraUp.x;
+    matrix[5] = cameraUp.y;
+    matrix[9] = cameraUp.z;
+    matrix[2] = -forward.x;
+    matrix[6] = -forward.y;
+    matrix[10] = -forward.z;
+    multiplyCurrentMatrix(matrix);
+
+    ScePspFVector3 translation = { -eye->x, -eye->y, -eye->z };
+    sceGumTranslate(&translation);
+}
+
+void sceGumRotateXYZ(const ScePspFVector3* v)
+{
+    float matrix[16];
+    float c, s;
+
+    c = cosf(v->x); s = sinf(v->x);
+    loadIdentityMatrix(matrix);
+    matrix[5] = c; matrix[6] = s; matrix[9] = -s; matrix[10] = c;
+    multiplyCurrentMatrix(matrix);
+
+    c = cosf(v->y); s = sinf(v->y);
+    loadIdentityMatrix(matrix);
+    matrix[0] = c; matrix[2] = -s; matrix[8] = s; matrix[10] = c;
+    multiplyCurrentMatrix(matrix);
+
+    c = cosf(v->z); s = sinf(v->z);
+    loadIdentityMatrix(matrix);
+    matrix[0] = c; matrix[1] = s; matrix[4] = -s; matrix[5] = c;
+    multiplyCurrentMatrix(matrix);
+}
+
+void sceGumScale(const ScePspFVector3* v)
+{
+    float matrix[16];
+    loadIdentityMatrix(matrix);
+    matrix[0] = v->x;
+    matrix[5] = v->y;
+    matrix[10] = v->z;
+    multiplyCurrentMatrix(matrix);
+}
+
+void sceGumTranslate(const ScePspFVector3* v)
+{
+    float matrix[16];
+    loadIdentityMatrix(matrix);
+    matrix[12] = v->x;
+    matrix[13] = v->y;
+    matrix[14] = v->z;
+    multiplyCurrentMatrix(matrix);
+}
+
+void setDrawMatrices(const float* worldViewProjection, const float* world)
+{
+    Command* command = newCommand(CMD_MATRICES);
+    if (command) {
+        float* matrices = (float*) listMemory(32 * sizeof(float));
+        memcpy(matrices, worldViewProjection, 16 * sizeof(float));
+        memcpy(matrices + 16, world, 16 * sizeof(float));
+        command->args[0].p = matrices;
+        recordCommand(command);
+        return;
+    }
+    memcpy(g_world_view_projection, worldViewProjection, sizeof(g_world_view_projection));
+    memcpy(g_world, world, sizeof(g_world));
+}
+
+void sceGumDrawArray(int prim, int vtype, int count, const void* indices, const void* vertices)
+{
+    if (g_matrix_dirty) {
+        float viewProjection[16], worldViewProjection[16];
+        const float* world = g_matrix_stack[GU_MODEL][g_matrix_top[GU_MODEL]];
+        multiplyMatrix(viewProjection,
+                       g_matrix_stack[GU_PROJECTION][g_matrix_top[GU_PROJECTION]],
+                       g_matrix_stack[GU_VIEW][g_matrix_top[GU_VIEW]]);
+        multiplyMatrix(worldViewProjection, viewProjection, world);
+        setDrawMatrices(worldViewProjection, world);
+        g_matrix_dirty = 0;
+    }
+    sceGuDrawArray(prim, vtype, count, indices, vertices);
+}
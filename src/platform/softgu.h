@@ -0,0 +1,249 @@
+/*
+ * Software GE for the Linux platform
+ *
+ * softgu.cpp keeps the GU state and does the vertex processing: decoding,
+ * transformation, clipping and primitive assembly. raster.cpp sets up and
+ * rasterises the resulting screen space triangles, rasterqueue.cpp bins them
+ * into screen tiles and distributes the tiles to worker threads.
+ * softlight.cpp implements the vertex lighting, displaylist.cpp records the
+ * GU functions called between sceGuStart and sceGuFinish.
+ */
+
+#ifndef SOFTGU_H
+#define SOFTGU_H
+
+#include "platform.h"
+
+/* mipmap levels of a texture, like the 8 texture registers of the GE */
+#define RASTER_TEXTURE_LEVELS 8
+
+/*
+ * A texture level set by sceGuTexImage
+ */
+typedef struct {
+    const Color* data;
+    int width;                 /* power of 2 */
+    int height;                /* power of 2 */
+    int stride;
+    float scaleU, scaleV;      /* from texels of level 0 to texels of this level */
+} TextureLevel;
+
+/*
+ * The render state used by the rasteriser
+ */
+typedef struct {
+    int depthTest;
+    int depthFunc;
+    int alphaTest;
+    int alphaFunc;
+    int alphaRef;
+    int alphaMask;
+    int blend;
+    int blendOp;
+    int blendSrc;
+    int blendDst;
+    Color blendFixSrc;
+    Color blendFixDst;
+    int texture;               /* GU_TEXTURE_2D enabled and a texture set */
+    TextureLevel texLevels[RASTER_TEXTURE_LEVELS];  /* level 0 is the base texture */
+    int texLevelCount;         /* levels used by the mipmap filters */
+    int texMinFilter;          /* GU_NEAREST, GU_LINEAR or GU_*_MIPMAP_* */
+    int texMagFilter;
+    int texLod;                /* the filter depends on the level of detail */
+    int texFunc;
+    int texAlpha;              /* GU_TCC_RGBA */
+    Color texEnvColor;
+    int scissorX0, scissorY0;  /* pixels */
+    int scissorX1, scissorY1;  /* exclusive */
+} RasterState;
+
+/*
+ * A vertex in screen space
+ */
+typedef struct {
+    float x, y;        /* pixels */
+    float z;           /* depth, 0 - 65535 */
+    float invW;        /* 1 / w of the clip space position, 1 in through mode */
+    float u, v;        /* texels of level 0 */
+    float r, g, b, a;  /* 0 - 255 */
+} ScreenVertex;
+
+#define RASTER_SUBPIXEL_BITS 4
+#define RASTER_SUBPIXELS (1 << RASTER_SUBPIXEL_BITS)
+
+/* the interpolated values; u, v and the color are divided by w */
+enum {
+    PLANE_Z, PLANE_INV_W, PLANE_U, PLANE_V, PLANE_R, PLANE_G, PLANE_B, PLANE_A, PLANE_COUNT
+};
+
+/*
+ * A triangle prepared for rasterisation
+ */
+typedef struct {
+    int x[3], y[3];                /* fixed point with RASTER_SUBPIXEL_BITS, interior on the positive side */
+    float plane[PLANE_COUNT][3];   /* value at the center of pixel (0, 0), change per pixel in x and y */
+    int minX, minY;                /* bounding box in pixels, clipped to the scissor rectangle */
+    int maxX, maxY;                /* exclusive */
+    const RasterState* state;
+} RasterTriangle;
+
+/* culling modes for setupTriangle */
+#define RASTER_CULL_NONE 0
+#define RASTER_CULL_CW   1   /* clockwise on the screen */
+#define RASTER_CULL_CCW  2
+
+/* the 16 bit depth buffer, with the layout of the frame buffer */
+extern u16 g_depth_buffer[PLATFORM_LINE_SIZE * PLATFORM_SCREEN_HEIGHT];
+
+/**
+ * Snap a triangle to the subpixel grid and compute its edges, bounding box
+ * and interpolation planes.
+ *
+ * @param triangle - the result
+ * @param vertices - three vertices
+ * @param cull - one of RASTER_CULL_*
+ * @param state - the render state, must live until the triangle is rasterised
+ * @return 0, if the triangle is culled or covers no pixel
+ */
+int setupTriangle(RasterTriangle* triangle, const ScreenVertex* vertices[3], int cull, const RasterState* state);
+
+/**
+ * Rasterise the part of a triangle within a rectangle.
+ *
+ * @param triangle - a triangle from setupTriangle
+ * @param framebuffer - destination, PLATFORM_LINE_SIZE pixels per line
+ * @param x0, y0 - top left corner of the rectangle
+ * @param x1, y1 - bottom right corner of the rectangle, exclusive
+ */
+void rasterizeTriangle(const RasterTriangle* triangle, Color* framebuffer, int x0, int y0, int x1, int y1);
+
+/* vertices per call of lightBatch, a multiple of 4 */
+#define LIGHT_BATCH 64
+
+/*
+ * Vertices to light, one array per component
+ */
+typedef struct {
+    float x[LIGHT_BATCH], y[LIGHT_BATCH], z[LIGHT_BATCH];     /* model space position */
+    float nx[LIGHT_BATCH], ny[LIGHT_BATCH], nz[LIGHT_BATCH];  /* model space normal */
+    float r[LIGHT_BATCH], g[LIGHT_BATCH], b[LIGHT_BATCH];     /* diffuse material color 0 - 1, replaced by the lit color */
+} __attribute__((aligned(16))) LightBatch;
+
+/**
+ * Light a batch of vertices with the lights set by sceGuLight etc.
+ *
+ * @param batch - the vertices, the results are stored in r, g and b
+ * @param count - number of vertices, LIGHT_BATCH at most
+ * @param world - the model matrix, column major
+ * @param enabledLights - bit 0 - 3 for GU_LIGHT0 - GU_LIGHT3
+ * @param materialAmbient - the color of sceGuAmbientColor
+ */
+void lightBatch(LightBatch* batch, int count, const float* world, int enabledLights, Color materialAmbient);
+
+/**
+ * Set the lights to their defaults, for sceGuInit.
+ */
+void resetLights(void);
+
+/* maximum number of threads for rasterisation, see setRasterThreads */
+#define RASTER_MAX_THREADS 16
+
+/**
+ * Add a triangle to the bins of the next flush. Flushes first if the
+ * queue is full or the frame buffer changed.
+ *
+ * @param triangle - a triangle from setupTriangle, it is copied but its
+ * state must live until the flush
+ * @param framebuffer - destination, PLATFORM_LINE_SIZE pixels per line
+ */
+void queueTriangle(const RasterTriangle* triangle, Color* framebuffer);
+
+/**
+ * Rasterise all queued triangles and wait for the worker threads.
+ */
+void flushTriangles(void);
+
+/*
+ * The vertices of the sprites of blitAlphaImageToScreen,
+ * GU_TEXTURE_16BIT | GU_VERTEX_16BIT | GU_TRANSFORM_2D
+ */
+typedef struct {
+    unsigned short u, v;
+    short x, y, z;
+} SpriteVertex;
+
+/* the commands of a display list, one per GU function with an effect */
+enum {
+    CMD_CLEAR_COLOR, CMD_CLEAR_DEPTH, CMD_CLEAR, CMD_OFFSET, CMD_VIEWPORT, CMD_DEPTH_RANGE, CMD_SCISSOR,
+    CMD_ENABLE, CMD_ALPHA_FUNC, CMD_DEPTH_FUNC, CMD_FRONT_FACE, CMD_SHADE_MODEL, CMD_BLEND_FUNC,
+    CMD_TEX_MODE, CMD_TEX_FUNC, CMD_TEX_FILTER, CMD_TEX_IMAGE, CMD_TEX_SCALE, CMD_TEX_OFFSET,
+    CMD_TEX_ENV_COLOR, CMD_COPY_IMAGE, CMD_DRAW_ARRAY, CMD_MATRICES, CMD_AMBIENT_COLOR, CMD_AMBIENT,
+    CMD_LIGHT, CMD_LIGHT_ATT, CMD_LIGHT_COLOR, CMD_LIGHT_SPOT, CMD_TEX_ALPHA_RUNS, CMD_COUNT
+};
+
+typedef union {
+    int i;
+    unsigned int u;
+    float f;
+    const void* p;
+} CommandArgument;
+
+/*
+ * A recorded GU function call. Commands with an index, like the light
+ * number, have it as first argument.
+ */
+typedef struct {
+    int op;
+    CommandArgument args[6];
+} Command;
+
+/**
+ * Start a command. The GU functions call this first and execute only if
+ * there is no list to record to.
+ *
+ * @param op - one of CMD_*
+ * @return a cleared command to fill in and to pass to recordCommand, or
+ * NULL if the function has to be executed
+ */
+Command* newCommand(int op);
+
+/**
+ * Append a command from newCommand to the list, unless it sets a state to
+ * the values it has already.
+ *
+ * @param command - the command
+ */
+void recordCommand(Command* command);
+
+/**
+ * Allocate memory, which lives until the current list is executed.
+ *
+ * @param size - size in bytes
+ * @return memory aligned to 16 bytes
+ */
+void* listMemory(int size);
+
+/**
+ * Start recording a list, for sceGuStart.
+ */
+void startList(void);
+
+/**
+ * Execute and clear the recorded list, for sceGuFinish.
+ */
+void executeList(void);
+
+/**
+ * Stop recording and forget the recorded states, for sceGuInit.
+ */
+void resetList(void);
+
+/**
+ * Set the matrices of sceGumDrawArray, the command recorded for it.
+ *
+ * @param worldViewProjection - the combined matrix, column major
+ * @param world - the model matrix for lighting
+ */
+void setDrawMatrices(const float* worldViewProjection, const float* world);
+
+#endif /* SOFTGU_H */
@@ -0,0 +1,275 @@
+/*
+ * Vertex lighting of the software GE
+ *
+ * Implements the light functions of GU. Like on the PSP, lighting is
+ * computed in world space with up to four directional, point or spot lights
+ * with ambient and diffuse colors and distance attenuation. The vertices
+ * are lit in batches, stored as separate arrays per component, so that 4
+ * vertices are computed at once with SSE.
+ */
+
+#include "softgu.h"
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define LIGHT_COUNT 4
+
+typedef struct {
+    int type;               /* GU_DIRECTIONAL, GU_POINTLIGHT or GU_SPOTLIGHT */
+    int components;
+    float position[3];      /* direction to the light for GU_DIRECTIONAL */
+    float direction[3];     /* normalized spot direction */
+    float attenuation[3];   /* constant, linear, quadratic */
+    float exponent;
+    float cutoff;           /* cosine of the spot angle */
+    float ambient[3];       /* 0 - 1 */
+    float diffuse[3];
+} Light;
+
+static Light g_lights[LIGHT_COUNT];
+static float g_scene_ambient[3] = { 0, 0, 0 };
+
+static void colorToFloats(Color color, float* result)
+{
+    result[0] = COLOR_R(color) / 255.0f;
+    result[1] = COLOR_G(color) / 255.0f;
+    result[2] = COLOR_B(color) / 255.0f;
+}
+
+/*
+ * 4 lanes of floats, SSE or a portable fallback
+ */
+#if defined(__SSE__)
+typedef __m128 Lanes;
+static inline Lanes lanesSet(float value) { return _mm_set1_ps(value); }
+static inline Lanes lanesLoad(const float* values) { return _mm_load_ps(values); }
+static inline void lanesStore(float* values, Lanes a) { _mm_store_ps(values, a); }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes lanesSub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes lanesDiv(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+static inline Lanes lanesMax(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+static inline Lanes lanesSqrt(Lanes a) { return _mm_sqrt_ps(a); }
+#else
+typedef struct { float v[4]; } Lanes;
+static inline Lanes lanesSet(float value) { Lanes r; for (int i = 0; i < 4; i++) r.v[i] = value; return r; }
+static inline Lanes lanesLoad(const float* values) { Lanes r; memcpy(r.v, values, sizeof(r.v)); return r; }
+static inline void lanesStore(float* values, Lanes a) { memcpy(values, a.v, sizeof(a.v)); }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+static inline Lanes lanesSub(Lanes a, Lanes b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+static inline Lanes lanesMul(Lanes a, Lanes b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+static inline Lanes lanesDiv(Lanes a, Lanes b) { for (int i = 0; i < 4; i++) a.v[i] /= b.v[i]; return a; }
+static inline Lanes lanesMax(Lanes a, Lanes b) { for (int i = 0; i < 4; i++) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+static inline Lanes lanesSqrt(Lanes a) { for (int i = 0; i < 4; i++) a.v[i] = sqrtf(a.v[i]); return a; }
+#endif
+
+static inline Lanes dot3(Lanes ax, Lanes ay, Lanes az, Lanes bx, Lanes by, Lanes bz)
+{
+    return lanesAdd(lanesAdd(lanesMul(ax, bx), lanesMul(ay, by)), lanesMul(az, bz));
+}
+
+/* the rows of a column major matrix applied to 4 vectors */
+static inline void transform3(const float* m, int w, Lanes x, Lanes y, Lanes z, Lanes* rx, Lanes* ry, Lanes* rz)
+{
+    *rx = lanesAdd(lanesAdd(lanesMul(lanesSet(m[0]), x), lanesMul(lanesSet(m[4]), y)), lanesMul(lanesSet(m[8]), z));
+    *ry = lanesAdd(lanesAdd(lanesMul(lanesSet(m[1]), x), lanesMul(lanesSet(m[5]), y)), lanesMul(lanesSet(m[9]), z));
+    *rz = lanesAdd(lanesAdd(lanesMul(lanesSet(m[2]), x), lanesMul(lanesSet(m[6]), y)), lanesMul(lanesSet(m[10]), z));
+    if (w) {
+        *rx = lanesAdd(*rx, lanesSet(m[12]));
+        *ry = lanesAdd(*ry, lanesSet(m[13]));
+        *rz = lanesAdd(*rz, lanesSet(m[14]));
+    }
+}
+
+void lightBatch(LightBatch* batch, int count, const float* world, int enabledLights, Color materialAmbient)
+{
+    float ambient[3];
+    colorToFloats(materialAmbient, ambient);
+    const Lanes zero = lanesSet(0.0f);
+    const Lanes tiny = lanesSet(1e-12f);
+
+    for (int i = 0; i < count; i += 4) {
+        Lanes px, py, pz, nx, ny, nz;
+        transform3(world, 1, lanesLoad(batch->x + i), lanesLoad(batch->y + i), lanesLoad(batch->z + i), &px, &py, &pz);
+        transform3(world, 0, lanesLoad(batch->nx + i), lanesLoad(batch->ny + i), lanesLoad(batch->nz + i), &nx, &ny, &nz);
+        Lanes length = lanesSqrt(lanesMax(dot3(nx, ny, nz, nx, ny, nz), tiny));
+        nx = lanesDiv(nx, length);
+        ny = lanesDiv(ny, length);
+        nz = lanesDiv(nz, length);
+
+        Lanes diffuseR = lanesLoad(batch->r + i);
+        Lanes diffuseG = lanesLoad(batch->g + i);
+        Lanes diffuseB = lanesLoad(batch->b + i);
+        Lanes r = lanesSet(g_scene_ambient[0] * ambient[0]);
+        Lanes g = lanesSet(g_scene_ambient[1] * ambient[1]);
+        Lanes b = lanesSet(g_scene_ambient[2] * ambient[2]);
+
+        for (int l = 0; l < LIGHT_COUNT; l++) {
+            if (!(enabledLights & (1 << l))) continue;
+            const Light* light = &g_lights[l];
+            Lanes lx, ly, lz, attenuation;
+            if (light->type == GU_DIRECTIONAL) {
+                lx = lanesSet(light->position[0]);
+                ly = lanesSet(light->position[1]);
+                lz = lanesSet(light->position[2]);
+                attenuation = lanesSet(1.0f);
+            } else {
+                lx = lanesSub(lanesSet(light->position[0]), px);
+                ly = lanesSub(lanesSet(light->position[1]), py);
+                lz = lanesSub(lanesSet(light->position[2]), pz);
+                Lanes distance2 = lanesMax(dot3(lx, ly, lz, lx, ly, lz), tiny);
+                Lanes distance = lanesSqrt(distance2);
+                lx = lanesDiv(lx, distance);
+                ly = lanesDiv(ly, distance);
+                lz = lanesDiv(lz, distance);
+                Lanes denominator = lanesAdd(lanesAdd(lanesSet(light->attenuation[0]),
+                                                      lanesMul(lanesSet(light->attenuation[1]), distance)),
+                                             lanesMul(lanesSet(light->attenuation[2]), distance2));
+                attenuation = lanesDiv(lanesSet(1.0f), lanesMax(denominator, tiny));
+                if (light->type == GU_SPOTLIGHT) {
+                    /* the power is computed per lane */
+                    float cosine[4] __attribute__((aligned(16)));
+                    float factor[4] __attribute__((aligned(16)));
+                    lanesStore(cosine, lanesSub(zero, dot3(lx, ly, lz, lanesSet(light->direction[0]),
+                                                           lanesSet(light->direction[1]), lanesSet(light->direction[2]))));
+                    for (int lane = 0; lane < 4; lane++) {
+                        factor[lane] = cosine[lane] > light->cutoff && cosine[lane] > 0.0f ?
+                                       powf(cosine[lane], light->exponent) : 0.0f;
+                    }
+                    attenuation = lanesMul(attenuation, lanesLoad(factor));
+                }
+            }
+            Lanes lambert = lanesMul(lanesMax(dot3(nx, ny, nz, lx, ly, lz), zero), attenuation);
+            r = lanesAdd(r, lanesAdd(lanesMul(attenuation, lanesSet(light->ambient[0] * ambient[0])),
+                                     lanesMul(lambert, lanesMul(lanesSet(light->diffuse[0]), diffuseR))));
+            g = lanesAdd(g, lanesAdd(lanesMul(attenuation, lanesSet(light->ambient[1] * ambient[1])),
+                                     lanesMul(lambert, lanesMul(lanesSet(light->diffuse[1]), diffuseG))));
+            b = lanesAdd(b, lanesAdd(lanesMul(attenuation, lanesSet(light->ambient[2] * ambient[2])),
+                                     lanesMul(lambert, lanesMul(lanesSet(light->diffuse[2]), diffuseB))));
+        }
+        lanesStore(batch->r + i, r);
+        lanesStore(batch->g + i, g);
+        lanesStore(batch->b + i, b);
+    }
+}
+
+void resetLights(void)
+{
+    memset(g_lights, 0, sizeof(g_lights));
+    for (int l = 0; l < LIGHT_COUNT; l++) {
+        g_lights[l].attenuation[0] = 1.0f;
+        g_lights[l].direction[2] = -1.0f;
+        g_lights[l].cutoff = -1.0f;
+    }
+    memset(g_scene_ambient, 0, sizeof(g_scene_ambient));
+}
+
+/*
+ * GU functions
+ */
+
+void sceGuAmbient(int color)
+{
+    Command* command = newCommand(CMD_AMBIENT);
+    if (command) {
+        command->args[0].i = color;
+        recordCommand(command);
+        return;
+    }
+    colorToFloats(color, g_scene_ambient);
+}
+
+void sceGuLight(int light, int type, int components, const ScePspFVector3* position)
+{
+    Command* command = newCommand(CMD_LIGHT);
+    if (command) {
+        command->args[0].i = light;
+        command->args[1].i = type;
+        command->args[2].i = components;
+        command->args[3].f = position->x;
+        command->args[4].f = position->y;
+        command->args[5].f = position->z;
+        recordCommand(command);
+        return;
+    }
+    if (light < 0 || light >= LIGHT_COUNT) return;
+    Light* l = &g_lights[light];
+    l->type = type;
+    l->components = components;
+    l->position[0] = position->x;
+    l->position[1] = position->y;
+    l->position[2] = position->z;
+    if (type == GU_DIRECTIONAL) {
+        float length = sqrtf(position->x * position->x + position->y * position->y + position->z * position->z);
+        if (length > 0.0f) {
+            for (int i = 0; i < 3; i++) l->position[i] /= length;
+        }
+    }
+}
+
+void sceGuLightAtt(int light, float atten0, float atten1, float atten2)
+{
+    Command* command = newCommand(CMD_LIGHT_ATT);
+    if (command) {
+        command->args[0].i = light;
+        command->args[1].f = atten0;
+        command->args[2].f = atten1;
+        command->args[3].f = atten2;
+        recordCommand(command);
+        return;
+    }
+    if (light < 0 || light >= LIGHT_COUNT) return;
+    g_lights[light].attenuation[0] = atten0;
+    g_lights[light].attenuation[1] = atten1;
+    g_lights[light].attenuation[2] = atten2;
+}
+
+void sceGuLightColor(int light, int component, unsigned int color)
+{
+    Command* command = newCommand(CMD_LIGHT_COLOR);
+    if (command) {
+        command->args[0].i = light;
+        command->args[1].i = component;
+        command->args[2].u = color;
+        recordCommand(command);
+        return;
+    }
+    if (light < 0 || light >= LIGHT_COUNT) return;
+    if (component & GU_AMBIENT) colorToFloats(color, g_lights[light].ambient);
+    if (component & GU_DIFFUSE) colorToFloats(color, g_lights[light].diffuse);
+}
+
+/* specular highlights are not implemented, so the mode makes no difference */
+void sceGuLightMode(int mode)
+{
+    (void)mode;
+}
+
+void sceGuLightSpot(int index, const ScePspFVector3* direction, float f12, float f13)
+{
+    Command* command = newCommand(CMD_LIGHT_SPOT);
+    if (command) {
+        command->args[0].i = index;
+        command->args[1].f = direction->x;
+        command->args[2].f = direction->y;
+        command->args[3].f = direction->z;
+        command->args[4].f = f12;
+        command->args[5].f = f13;
+        recordCommand(command);
+        return;
+    }
+    if (index < 0 || index >= LIGHT_COUNT) return;
+    Light* l = &g_lights[index];
+    float length = sqrtf(direction->x * direction->x + direction->y * direction->y + direction->z * direction->z);
+    if (length == 0.0f) length = 1.0f;
+    l->direction[0] = direction->x / length;
+    l->direction[1] = direction->y / length;
+    l->direction[2] = direction->z / length;
+    l->exponent = f12;
+    l->cutoff = f13;
+}
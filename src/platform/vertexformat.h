@@ -0,0 +1,85 @@
+/*
+ * Layout of GU vertices
+ *
+ * A vertex as declared by the vtype of sceGuDrawArray consists of the
+ * components weights, texture, color, normal and position, in this order.
+ * Every component is aligned to the size of its elements and the vertex
+ * size is aligned to the largest element.
+ */
+
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include "platform.h"
+
+typedef struct {
+    int weightCount;      /* 0 without weights */
+    int weightSize;       /* size of one element in bytes: 1, 2 or 4 (float) */
+    int weightOffset;
+    int textureSize;      /* 0 without texture coordinates */
+    int textureOffset;
+    int colorFormat;      /* GU_COLOR_5650, GU_COLOR_5551, GU_COLOR_4444, GU_COLOR_8888 or 0 */
+    int colorOffset;
+    int normalSize;       /* 0 without normal */
+    int normalOffset;
+    int positionSize;     /* 0 without position */
+    int positionOffset;
+    int size;             /* size of the whole vertex */
+    int through;          /* GU_TRANSFORM_2D: screen coordinates, no transformation */
+} VertexFormat;
+
+static inline int vertexElementSize(int bits)
+{
+    static const int sizes[4] = { 0, 1, 2, 4 };
+    return sizes[bits & 3];
+}
+
+static inline int vertexAlignComponent(int offset, int elementSize, int count, int* componentOffset, int* alignment)
+{
+    if (elementSize == 0 || count == 0) return offset;
+    offset = (offset + elementSize - 1) & ~(elementSize - 1);
+    *componentOffset = offset;
+    if (elementSize > *alignment) *alignment = elementSize;
+    return offset + elementSize * count;
+}
+
+/**
+ * Compute the layout of the vertices for a vtype.
+ *
+ * @param vtype - vertex declaration, GU_TEXTURE_*, GU_COLOR_* etc.
+ * @param format - the layout
+ */
+static inline void getVertexFormat(int vtype, VertexFormat* format)
+{
+    int offset = 0;
+    int alignment = 1;
+    int colorSize;
+
+    format->weightSize = vertexElementSize((vtype & GU_WEIGHT_BITS) >> 9);
+    format->weightCount = format->weightSize ? ((vtype & GU_WEIGHTS_BITS) >> 14) + 1 : 0;
+    format->weightOffset = 0;
+    offset = vertexAlignComponent(offset, format->weightSize, format->weightCount, &format->weightOffset, &alignment);
+
+    format->textureSize = vertexElementSize(vtype & GU_TEXTURE_BITS);
+    format->textureOffset = 0;
+    offset = vertexAlignComponent(offset, format->textureSize, 2, &format->textureOffset, &alignment);
+
+    format->colorFormat = vtype & GU_COLOR_BITS;
+    if (format->colorFormat < GU_COLOR_5650) format->colorFormat = 0;
+    colorSize = format->colorFormat == GU_COLOR_8888 ? 4 : format->colorFormat ? 2 : 0;
+    format->colorOffset = 0;
+    offset = vertexAlignComponent(offset, colorSize, 1, &format->colorOffset, &alignment);
+
+    format->normalSize = vertexElementSize((vtype & GU_NORMAL_BITS) >> 5);
+    format->normalOffset = 0;
+    offset = vertexAlignComponent(offset, format->normalSize, 3, &format->normalOffset, &alignment);
+
+    format->positionSize = vertexElementSize((vtype & GU_VERTEX_BITS) >> 7);
+    format->positionOffset = 0;
+    offset = vertexAlignComponent(offset, format->positionSize, 3, &format->positionOffset, &alignment);
+
+    format->size = (offset + alignment - 1) & ~(alignment - 1);
+    format->through = (vtype & GU_TRANSFORM_BITS) == GU_TRANSFORM_2D;
+}
+
+#endif /* VERTEXFORMAT_H */
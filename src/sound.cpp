@@ -82,6 +82,13 @@ void unloadSound(Sound handle) {
 	if (handle) Sample_Free(handle);
 }
 
+int getSoundMemorySize(Sound handle) {
+	int size = handle->length;
+	if (handle->flags & SF_16BITS) size *= 2;
+	if (handle->flags & SF_STEREO) size *= 2;
+	return size;
+}
+
 
 Voice playSound(Sound handle) {
 	if (handle) {
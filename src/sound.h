@@ -54,6 +54,15 @@ extern Sound loadSound(char* filename);
  */
 extern void unloadSound(Sound handle);
 
+/**
+ * The bytes of the sample data of a loaded sound.
+ *
+ * @pre handle != NULL
+ * @param handle - the loaded wav file
+ * @return size of the sample data in bytes
+ */
+extern int getSoundMemorySize(Sound handle);
+
 /**
  * Play sample with volume 255, pan 127.
  *
@@ -0,0 +1,133 @@
+--[[
+Scaling benchmark for the software 3D renderer (Linux only).
+
+Renders the same fill-bound scene with 1, 2, 4 and one rasteriser thread per
+core and prints the time per frame. The last frame of every run is hashed,
+all runs have to produce the same image.
+]]
+
+frames = 60
+
+white = Color.new(255, 255, 255)
+black = Color.new(0, 0, 0)
+green = Color.new(0, 255, 0)
+red = Color.new(255, 0, 0)
+translucent = Color.new(255, 255, 255, 96)
+
+texture = Image.createEmpty(64, 64)
+for y = 0, 63 do
+	for x = 0, 63 do
+		texture:pixel(x, y, Color.new(x * 4, y * 4, 128, 255))
+	end
+end
+
+function face(list, color, a, b, c, d)
+	table.insert(list, { 0, 0, color, a[1], a[2], a[3] })
+	table.insert(list, { 1, 0, color, b[1], b[2], b[3] })
+	table.insert(list, { 1, 1, color, c[1], c[2], c[3] })
+	table.insert(list, { 0, 0, color, a[1], a[2], a[3] })
+	table.insert(list, { 1, 1, color, c[1], c[2], c[3] })
+	table.insert(list, { 0, 1, color, d[1], d[2], d[3] })
+end
+
+cube = {}
+face(cube, white, { -1, -1, 1 }, { -1, 1, 1 }, { 1, 1, 1 }, { 1, -1, 1 })
+face(cube, white, { -1, -1, -1 }, { 1, -1, -1 }, { 1, 1, -1 }, { -1, 1, -1 })
+face(cube, white, { 1, -1, -1 }, { 1, -1, 1 }, { 1, 1, 1 }, { 1, 1, -1 })
+face(cube, white, { -1, -1, -1 }, { -1, 1, -1 }, { -1, 1, 1 }, { -1, -1, 1 })
+face(cube, white, { -1, 1, -1 }, { 1, 1, -1 }, { 1, 1, 1 }, { -1, 1, 1 })
+face(cube, white, { -1, -1, -1 }, { -1, -1, 1 }, { 1, -1, 1 }, { 1, -1, -1 })
+
+-- screen filling translucent layers for overdraw
+layer = {
+	{ translucent, -8, -5, 0 }, { translucent, 8, 5, 0 }, { translucent, 8, -5, 0 },
+	{ translucent, 8, 5, 0 }, { translucent, -8, -5, 0 }, { translucent, -8, 5, 0 },
+}
+
+function renderFrame(frame)
+	Gu.start3d()
+	Gu.clearColor(black)
+	Gu.clearDepth(0)
+	Gu.clear(Gu.COLOR_BUFFER_BIT + Gu.DEPTH_BUFFER_BIT)
+
+	Gum.matrixMode(Gu.PROJECTION)
+	Gum.loadIdentity()
+	Gum.perspective(75, 16 / 9, 0.5, 1000)
+	Gum.matrixMode(Gu.VIEW)
+	Gum.loadIdentity()
+
+	Gu.enable(Gu.TEXTURE_2D)
+	Gu.texImage(texture)
+	Gu.texFunc(Gu.TFX_MODULATE, Gu.TCC_RGBA)
+	Gu.texScale(1, 1)
+	Gu.texOffset(0, 0)
+	Gu.disable(Gu.BLEND)
+	for y = -2, 2 do
+		for x = -4, 4 do
+			Gum.matrixMode(Gu.MODEL)
+			Gum.loadIdentity()
+			Gum.translate(x * 1.6, y * 1.6, -6)
+			Gum.rotateXYZ(frame * 0.02 + x, frame * 0.03 + y, 0)
+			Gum.drawArray(Gu.TRIANGLES, Gu.TEXTURE_32BITF + Gu.COLOR_8888 + Gu.VERTEX_32BITF + Gu.TRANSFORM_3D, cube)
+		end
+	end
+
+	Gu.disable(Gu.TEXTURE_2D)
+	Gu.enable(Gu.BLEND)
+	Gu.blendFunc(Gu.ADD, Gu.SRC_ALPHA, Gu.ONE_MINUS_SRC_ALPHA, 0, 0)
+	for i = 1, 8 do
+		Gum.matrixMode(Gu.MODEL)
+		Gum.loadIdentity()
+		Gum.translate(0, 0, -3 - i * 0.1)
+		Gum.drawArray(Gu.TRIANGLES, Gu.COLOR_8888 + Gu.VERTEX_32BITF + Gu.TRANSFORM_3D, layer)
+	end
+	Gu.disable(Gu.BLEND)
+	Gu.end3d()
+end
+
+function hashScreen()
+	local hash = 0
+	for y = 0, 271, 4 do
+		for x = 0, 479, 4 do
+			local color = screen:pixel(x, y):colors()
+			hash = (hash * 31 + color.r * 65536 + color.g * 256 + color.b) % 2147483647
+		end
+	end
+	return hash
+end
+
+cores = Gu.rasterThreads(0)
+counts = { 1, 2, 4 }
+if cores ~= 1 and cores ~= 2 and cores ~= 4 then table.insert(counts, cores) end
+
+results = {}
+for _, threads in ipairs(counts) do
+	threads = Gu.rasterThreads(threads)
+	renderFrame(0)
+	local timer = Timer.new()
+	timer:start()
+	for frame = 1, frames do
+		renderFrame(frame)
+	end
+	local time = timer:time()
+	table.insert(results, { threads = threads, time = time, hash = hashScreen() })
+	screen.flip()
+end
+Gu.rasterThreads(0)
+
+screen:clear()
+local y = 0
+for _, result in ipairs(results) do
+	local color = result.hash == results[1].hash and green or red
+	local text = result.threads .. " threads: " .. string.format("%.2f", result.time / frames)
+		.. " ms per frame, speedup " .. string.format("%.2f", results[1].time / result.time)
+	print(text)
+	screen:print(0, y, text, color)
+	y = y + 8
+end
+screen.flip()
+
+while true do
+	screen.waitVblankStart()
+	if Controls.read():start() then break end
+end